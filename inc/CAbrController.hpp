@@ -0,0 +1,96 @@
+#pragma once
+#ifndef ABRCONTROLLER_HPP
+#define ABRCONTROLLER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @class AbrController
+ * @brief Picks the ladder tier of one client from what its connection actually drains.
+ *
+ * The socket reports, after every send, the bytes handed to the connection and the bytes still waiting
+ * in its buffer. Their difference is what reached the network, measured over fixed windows to give the
+ * throughput. When the backlog is past Params::max_backlog_seconds of the current tier and still growing, the client
+ * steps down to the best tier that fits in the measured throughput. A link that keeps up only shows the
+ * rate it is fed, so going up is a probe: after the backlog stayed near empty for a while the next tier
+ * is tried, and each probe that fails doubles the wait before the next one.
+ * Not thread safe: each connection owns its controller.
+ */
+class AbrController
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * @struct Params
+     * @brief Switching thresholds.
+     */
+    struct Params
+    {
+        double window_seconds = 1.0; ///< Length of the throughput measurement windows.
+        double headroom = 0.8; ///< Share of the measured throughput a tier may take when stepping down.
+        double max_backlog_seconds = 1.0; ///< Backlog, in seconds of the current tier, that forces a step down.
+        double calm_backlog_seconds = 0.1; ///< Backlog under which the connection counts as keeping up.
+        double probe_after_seconds = 5.0; ///< Time the connection must keep up before the next tier is tried.
+        double max_probe_after_seconds = 60.0; ///< Limit of the probe delay, which doubles after each failed probe.
+    };
+
+    /**
+     * @brief Constructor with the default thresholds.
+     *
+     * @param bitrates Bitrate of each tier in bits per second, lowest first.
+     */
+    explicit AbrController(const std::vector<uint32_t> &bitrates);
+
+    /**
+     * @brief Constructor.
+     *
+     * @param bitrates Bitrate of each tier in bits per second, lowest first.
+     * @param params Switching thresholds.
+     */
+    AbrController(const std::vector<uint32_t> &bitrates, const Params &params);
+
+    /**
+     * @brief Starts over on a tier, forgetting the measurements.
+     */
+    void Reset(size_t tier, Clock::time_point now);
+
+    /**
+     * @brief Feeds the connection counters and returns the tier the client should be on.
+     *
+     * @param now Current time.
+     * @param bytes_sent Bytes handed to the connection since Reset.
+     * @param buffered Bytes of those still waiting in the connection's buffer.
+     * @return The tier to switch to, or the current one.
+     */
+    size_t Update(Clock::time_point now, uint64_t bytes_sent, size_t buffered);
+
+    size_t Tier() const { return mTier; } ///< Current tier.
+    double Throughput() const { return mThroughput; } ///< Smoothed drained rate in bits per second, 0 before the first window.
+    uint64_t Switches() const { return mSwitches; } ///< Tier changes since Reset.
+
+private:
+    /**
+     * @brief Moves to a tier and restarts the hold periods.
+     */
+    void SwitchTo(size_t tier, Clock::time_point now);
+
+    std::vector<uint32_t> mBitrates; ///< Tier bitrates, lowest first.
+    Params mParams; ///< Thresholds.
+    size_t mTier = 0; ///< Current tier.
+    double mThroughput = 0.0; ///< Smoothed throughput.
+    Clock::time_point mWindowStart; ///< Start of the measurement window.
+    uint64_t mWindowDelivered = 0; ///< Bytes drained when the window started.
+    size_t mWindowBuffered = 0; ///< Backlog when the window started.
+    bool mBacklogGrowing = false; ///< Whether the backlog grew over the last window.
+    Clock::time_point mSwitchTime; ///< Last tier change, or Reset.
+    Clock::time_point mCalmSince; ///< Since when the backlog is under Params::calm_backlog_seconds.
+    bool mProbing = false; ///< The current tier was reached by a probe that has not held yet.
+    double mProbeAfter = 0.0; ///< Current probe delay.
+    uint64_t mSwitches = 0; ///< Tier changes.
+};
+
+#endif // ABRCONTROLLER_HPP
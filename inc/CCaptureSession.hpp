@@ -0,0 +1,108 @@
+#pragma once
+#ifndef CAPTURESESSION_HPP
+#define CAPTURESESSION_HPP
+
+#include <map>
+#include <tuple>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+#include <CFramePool.hpp>
+
+struct SwsContext;
+
+/**
+ * @class CaptureSession
+ * @brief Per-capture state for turning decoded frames into RGB24 frames.
+ *
+ * The session keeps one conversion context per source format and resolution for as long as the
+ * capture runs, and takes the RGB frames from a fixed FramePool. A frame's buffer goes back to the
+ * pool when its last reference is dropped (usually on the encoder thread), so steady-state capture
+ * does no conversion setup and no heap allocation, and the RGB memory has a hard upper limit.
+ */
+class CaptureSession
+{
+public:
+    /**
+     * @brief Scaler quality tier used for the colour conversion.
+     */
+    enum class ScalerQuality
+    {
+        Fast, ///< SWS_FAST_BILINEAR
+        Bilinear, ///< SWS_BILINEAR
+        Bicubic, ///< SWS_BICUBIC
+        Lanczos ///< SWS_LANCZOS
+    };
+
+    CaptureSession() = default;
+    CaptureSession(const CaptureSession&) = delete;
+    CaptureSession& operator=(const CaptureSession&) = delete;
+
+    /**
+     * @brief Destructor that frees the conversion contexts and the frame pool.
+     */
+    ~CaptureSession();
+
+    /**
+     * @brief Selects the scaler quality. Cached contexts are rebuilt on the next conversion.
+     *
+     * @param quality The scaler quality tier.
+     */
+    void SetScalerQuality(ScalerQuality quality);
+
+    /**
+     * @brief Sets the size of the RGB frame pool, applied when the pool is next created.
+     *
+     * @param count Number of RGB frames that can be in flight at once.
+     * @param hugePages Back the pool with huge pages when possible.
+     */
+    void SetPoolSize(size_t count, bool hugePages);
+
+    /**
+     * @brief Converts a decoded frame to an RGB24 AVFrame taken from the frame pool.
+     *
+     * The buffer goes back to the pool when the last reference to the returned frame is freed,
+     * so the frame can be handed to another thread and released there with av_frame_free.
+     *
+     * @param frame The decoded frame, in any pixel format swscale supports. Its timestamps and properties are copied.
+     * @return A new RGB24 frame, or nullptr on error or when every pooled frame is still in use.
+     */
+    AVFrame* ConvertToRGBFrame(const AVFrame* frame);
+
+    /**
+     * @brief Number of conversions dropped because every pooled frame was in use.
+     */
+    uint64_t DroppedFrames() const;
+
+    /**
+     * @brief Frees the conversion contexts and releases the frame pool.
+     *
+     * Frames still held by consumers stay valid until they are freed.
+     */
+    void Reset();
+
+    /**
+     * @brief Reads the scaler quality from the SCALER_QUALITY environment variable.
+     *
+     * @return fast, bilinear, bicubic or lanczos; Lanczos if unset or unknown.
+     */
+    static ScalerQuality QualityFromEnvironment();
+
+private:
+    /**
+     * @brief Returns the cached conversion context for a source format and resolution, creating it if needed.
+     */
+    SwsContext* GetContext(AVPixelFormat format, int width, int height);
+
+    ScalerQuality mQuality = ScalerQuality::Lanczos; ///< Scaler quality tier.
+    std::map<std::tuple<int, int, int>, SwsContext*> mContexts; ///< Conversion contexts keyed by format, width and height.
+
+    FramePool mPool; ///< RGB frames, recreated when the resolution changes.
+    size_t mPoolSize = 8; ///< Number of frames in the pool.
+    bool mHugePages = false; ///< Back the pool with huge pages.
+    uint64_t mDroppedBefore = 0; ///< Drops counted by pools that were replaced.
+};
+
+#endif // CAPTURESESSION_HPP
@@ -0,0 +1,124 @@
+#pragma once
+#ifndef COLORCONVERT_HPP
+#define COLORCONVERT_HPP
+
+#include <cstdint>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+/**
+ * @class ColorConvert
+ * @brief Hand-vectorised colour conversions, dispatched at runtime to the widest instruction set the
+ *        CPU supports.
+ *
+ * RGB24 to YUV420P runs without scaling. Output is BT.601 limited range, the same matrix libswscale uses
+ * for these formats. Luma is computed per pixel and chroma from the average of each 2x2 block, all in
+ * 8.8 fixed point with rounding. Every kernel (scalar, SSE4.1, AVX2, AVX-512) produces exactly the same
+ * bytes as the scalar one, so the instruction set only changes the speed. Odd widths and heights are
+ * handled by the scalar tail.
+ *
+ * YUV 4:2:0, 4:2:2 or NV12 to BGR24 is meant for previews: it samples the source at the output size in
+ * the same pass, so it only reads the pixels it keeps, about one in seven for a 720p frame shown in a
+ * 500x280 box. Each output pixel takes the nearest luma sample and the chroma sample covering it.
+ *
+ * The kernel is chosen once, from the CPU features and the COLOR_CONVERT environment variable
+ * (auto, scalar, sse4.1, avx2, avx512 or swscale to disable it).
+ */
+class ColorConvert
+{
+public:
+    /**
+     * @brief Instruction sets with a kernel, in increasing order of width.
+     */
+    enum class Isa
+    {
+        None, ///< Kernel disabled, callers fall back to libswscale.
+        Scalar, ///< Portable C++.
+        SSE41, ///< 16 pixels per step.
+        AVX2, ///< 32 pixels per step.
+        AVX512 ///< 64 pixels per step, needs AVX-512BW.
+    };
+
+    /**
+     * @brief Checks if a conversion between two formats of the same size can use the kernel.
+     */
+    static bool CanConvert(int src_format, int dst_format);
+
+    /**
+     * @brief Converts one RGB24 picture to planar YUV 4:2:0 with the active kernel.
+     *
+     * @param rgb First row of the RGB24 picture.
+     * @param rgb_stride Bytes between two RGB rows.
+     * @param dst Y, U and V planes.
+     * @param dst_stride Bytes between two rows of each plane.
+     * @param width Picture width in pixels.
+     * @param height Picture height in pixels.
+     */
+    static void RGB24ToI420(const uint8_t* rgb, int rgb_stride, uint8_t* const dst[3], const int dst_stride[3],
+                            int width, int height);
+
+    /**
+     * @brief Same as above with an explicit kernel, for accuracy checks and benchmarks.
+     *
+     * @return false if the CPU does not support the instruction set.
+     */
+    static bool RGB24ToI420(const uint8_t* rgb, int rgb_stride, uint8_t* const dst[3], const int dst_stride[3],
+                            int width, int height, Isa isa);
+
+    /**
+     * @brief Converts an RGB24 frame into a YUV420P frame of the same size with the active kernel.
+     *
+     * @return false if the frames do not qualify (see CanConvert) or the kernel is disabled.
+     */
+    static bool Convert(const AVFrame* src, AVFrame* dst);
+
+    /**
+     * @brief Checks if frames of a pixel format can be converted with ToBGRPreview.
+     */
+    static bool CanPreview(int src_format);
+
+    /**
+     * @brief Converts a YUV 4:2:0, 4:2:2 or NV12 frame to BGR24 (the layout of a 24-bit DIB), resized to the
+     *        output size in the same pass, with the active kernel.
+     *
+     * @param src The frame to convert.
+     * @param bgr First row of the output picture.
+     * @param bgr_stride Bytes between two output rows.
+     * @param width Output width in pixels.
+     * @param height Output height in pixels.
+     * @return false if the frame does not qualify (see CanPreview) or the kernel is disabled.
+     */
+    static bool ToBGRPreview(const AVFrame* src, uint8_t* bgr, int bgr_stride, int width, int height);
+
+    /**
+     * @brief Same as above with an explicit kernel. AVX-512 runs the AVX2 kernel, preview rows are too short to gain from it.
+     *
+     * @return false if the frame does not qualify or the CPU does not support the instruction set.
+     */
+    static bool ToBGRPreview(const AVFrame* src, uint8_t* bgr, int bgr_stride, int width, int height, Isa isa);
+
+    /**
+     * @brief Widest instruction set supported by this CPU and operating system.
+     */
+    static Isa SupportedIsa();
+
+    /**
+     * @brief Kernel used by RGB24ToI420, Convert and ToBGRPreview, None when disabled.
+     */
+    static Isa ActiveIsa();
+
+    /**
+     * @brief Selects the kernel, clamped to what the CPU supports.
+     */
+    static void SetActiveIsa(Isa isa);
+
+    /**
+     * @brief Printable name of an instruction set.
+     */
+    static const char* IsaName(Isa isa);
+};
+
+#endif // COLORCONVERT_HPP
@@ -0,0 +1,71 @@
+#pragma once
+#ifndef ENCODEDFRAGMENT_HPP
+#define ENCODEDFRAGMENT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/buffer.h>
+}
+
+/**
+ * @class EncodedFragment
+ * @brief Reference-counted handle to one piece of muxer output: an init segment or a moof/mdat fragment.
+ *
+ * The bytes live in an AVBufferRef, usually taken from a FragmentPool. Copying a handle adds a reference
+ * instead of copying bytes, so the same fragment can wait in the send queue, be cached for late joiners
+ * and be handed to the socket layer without a copy. The buffer goes back to its pool when the last
+ * handle is dropped, on whichever thread that happens.
+ */
+class EncodedFragment
+{
+public:
+    /**
+     * @brief Creates an empty handle.
+     */
+    EncodedFragment() = default;
+
+    /**
+     * @brief Takes ownership of a buffer reference.
+     *
+     * @param buffer The buffer to adopt. It is unreferenced when the handle is destroyed.
+     * @param size Bytes of the buffer in use, at most buffer->size.
+     * @param init Whether the bytes are an init segment.
+     * @param keyframe Whether the fragment starts with a keyframe.
+     * @param start_time Presentation time of the fragment's first frame in microseconds, AV_NOPTS_VALUE if none.
+     */
+    EncodedFragment(AVBufferRef* buffer, size_t size, bool init, bool keyframe, int64_t start_time = AV_NOPTS_VALUE);
+
+    EncodedFragment(const EncodedFragment& other);
+    EncodedFragment(EncodedFragment&& other) noexcept;
+    EncodedFragment& operator=(const EncodedFragment& other);
+    EncodedFragment& operator=(EncodedFragment&& other) noexcept;
+    ~EncodedFragment();
+
+    /**
+     * @brief Drops this handle's reference.
+     */
+    void reset();
+
+    /**
+     * @brief Checks if the handle refers to a buffer.
+     */
+    explicit operator bool() const { return mBuffer != nullptr; }
+
+    const uint8_t* data() const { return mBuffer ? mBuffer->data : nullptr; } ///< First byte.
+    size_t size() const { return mSize; } ///< Bytes in use.
+    bool isInit() const { return mInit; } ///< Whether the bytes are an init segment (ftyp and moov).
+    bool startsWithKeyframe() const { return mKeyframe; } ///< Whether a decoder can start at this fragment.
+    int64_t startTime() const { return mStartTime; } ///< Time of the first frame in decoding order, in microseconds on the encoder's timeline.
+
+private:
+    AVBufferRef* mBuffer = nullptr; ///< Owned reference, the bytes are shared with the other handles.
+    size_t mSize = 0; ///< Bytes in use.
+    bool mInit = false; ///< Init segment.
+    bool mKeyframe = false; ///< Starts with a keyframe.
+    int64_t mStartTime = AV_NOPTS_VALUE; ///< Time of the first frame.
+};
+
+#endif // ENCODEDFRAGMENT_HPP
@@ -0,0 +1,349 @@
+#pragma once
+#ifndef ENCODERCORE_HPP
+#define ENCODERCORE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+#include <CFrameConverter.hpp>
+#include <CPacketSink.hpp>
+
+struct SwsContext;
+
+/**
+ * @class EncoderCore
+ * @brief Encodes frames once and fans the packets out to any number of PacketSinks.
+ *
+ * Recording to an MP4 file, streaming fMP4 to websocket clients, dumping Annex-B or sending MPEG-TS to a
+ * socket all take the same packets, so running several of them costs a single encode. Sinks can be
+ * attached before Open or while the core is running; a sink attached late gets packets from the next
+ * keyframe on. A sink that fails to write is closed and detached, the others carry on.
+ * AddSink and RemoveSink may be called from any thread while another one writes frames.
+ */
+class EncoderCore
+{
+public:
+    /**
+     * @brief How the encoder spreads work over threads.
+     *
+     * Frame threading codes several frames at once: it scales best but holds one frame back per extra thread.
+     * Slice threading splits each frame and adds no delay, at some cost in compression. Auto keeps the
+     * encoder's default, or slices with the low-latency profile.
+     */
+    enum class Threading
+    {
+        Auto,
+        Frame,
+        Slice
+    };
+
+    /**
+     * @struct Params
+     * @brief Encoding parameters.
+     */
+    struct Params
+    {
+        uint32_t width; ///< Width of the video frame.
+        uint32_t height; ///< Height of the video frame.
+        double fps; ///< Frames per second.
+        uint32_t bitrate; ///< Bitrate for encoding.
+        const char *preset; ///< Preset for encoding quality and speed.
+        uint32_t crf; ///< Constant Rate Factor (0–51).
+        enum AVPixelFormat src_format; ///< Source pixel format of raw input.
+        enum AVPixelFormat dst_format; ///< Pixel format of the encoder.
+        bool vfr = false; ///< Encode AVFrame input with its own timestamps (variable frame rate) instead of numbering frames at fps.
+        int scale_threads = 0; ///< Slice threads for converting AVFrame input to dst_format, 0 for one per core.
+        bool global_header = true; ///< Keep SPS/PPS in the extradata, as MP4 needs. AnnexBSink writes them back before keyframes.
+        int threads = 0; ///< Encoder threads, 0 to let the encoder pick from the core count.
+        Threading threading = Threading::Auto; ///< Encoder threading mode.
+        bool low_latency = false; ///< Low-latency profile: zerolatency tune, no B-frames, no lookahead, slice threads unless threading says otherwise.
+        bool intra_refresh = false; ///< With low_latency, refresh the picture with a column of intra blocks sweeping across each GOP instead of sending IDR frames. Only IDR packets are then flagged as keyframes.
+        uint32_t max_bitrate = 0; ///< Peak bitrate over a one second buffer, 0 for none. Caps crf so the stream fits a link of that rate.
+        int gop_size = 0; ///< Most frames between two keyframes the encoder places itself, over the preset file and options; 0 for theirs, else 12.
+        double keyframe_interval = 0.0; ///< Seconds between IDR frames, forced at the first frame of each interval of the timeline, 0 to let the encoder place them. Replaces intra refresh.
+        double keyframe_request_spacing = 0.5; ///< Least seconds between two keyframes forced by RequestKeyframe; a request closer to the previous one is covered by it.
+        bool rebase_pts = true; ///< In VFR mode, start the timeline at the first frame written. Encoders fed from one capture turn it off to share its timeline.
+        std::string codec; ///< Encoder name: libx264, libvpx (VP8) or libvpx-vp9. Empty for the one preset_file names, else libx264.
+        std::string preset_file; ///< ffpreset file of encoder options. Empty for none with libx264, the bundled one for the frame size with libvpx.
+        std::string options; ///< Encoder options as key=value pairs separated by ':', over the preset file's, e.g. "deadline=realtime:cpu-used=8".
+    };
+
+    /**
+     * @struct LatencyStats
+     * @brief Time from a frame entering Write to its packet leaving the encoder, conversion included.
+     */
+    struct LatencyStats
+    {
+        uint64_t frames = 0; ///< Packets measured.
+        double average_ms = 0.0; ///< Average delay.
+        double p50_ms = 0.0; ///< Median delay, to 0.1 ms.
+        double p95_ms = 0.0; ///< 95th percentile delay, to 0.1 ms.
+        double max_ms = 0.0; ///< Largest delay.
+        double average_frames = 0.0; ///< Average number of later frames sent before the packet came out (B-frames, lookahead, frame threads).
+    };
+
+    /**
+     * @struct SinkStats
+     * @brief Counters of one attached sink.
+     */
+    struct SinkStats
+    {
+        std::string name; ///< PacketSink::Name.
+        uint64_t packets = 0; ///< Packets written.
+        uint64_t bytes = 0; ///< Payload bytes written.
+        uint64_t skipped = 0; ///< Packets before the sink's first keyframe.
+    };
+
+    EncoderCore() = default;
+    EncoderCore(const EncoderCore&) = delete;
+    EncoderCore& operator=(const EncoderCore&) = delete;
+
+    /**
+     * @brief Destructor that flushes the encoder and closes every sink.
+     */
+    ~EncoderCore();
+
+    /**
+     * @brief Attaches a sink. On an open core the sink is opened at once.
+     *
+     * @param sink The sink.
+     * @return false if the sink could not be opened, in which case it is not attached.
+     */
+    bool AddSink(const std::shared_ptr<PacketSink> &sink);
+
+    /**
+     * @brief Closes and detaches a sink, waiting for a write in progress to finish.
+     *
+     * @return true if the sink was attached.
+     */
+    bool RemoveSink(const std::shared_ptr<PacketSink> &sink);
+
+    /**
+     * @brief Opens the encoder, then every attached sink. On failure the sinks are closed and detached.
+     *
+     * @param params The encoding parameters.
+     * @return true if the encoder and all the sinks were opened, false otherwise.
+     */
+    bool Open(const Params &params);
+
+    /**
+     * @brief Flushes the encoder, prints the counters of each sink, then closes and detaches every sink.
+     */
+    void Close();
+
+    /**
+     * @brief Encodes a picture of raw input in Params::src_format at the encoder size.
+     *
+     * RGB24 input for a YUV420P encoder goes through the vectorised ColorConvert kernel instead of libswscale.
+     *
+     * @param data The input frame data.
+     * @return true if the frame was encoded and its packets written, false otherwise.
+     */
+    bool Write(const unsigned char *data);
+
+    /**
+     * @brief Encodes a decoded frame.
+     *
+     * When the frame already has the encoder's pixel format and size it is passed to the encoder by reference,
+     * without any copy or colour conversion. Otherwise it is converted from its own pixel format, in parallel
+     * horizontal slices (see Params::scale_threads).
+     * With Params::vfr the frame's pts and time_base are carried into the packets, so frames the
+     * camera skipped or that were dropped under load leave a gap instead of shifting the timeline.
+     *
+     * @param frame The frame to encode.
+     * @return true if the frame was encoded and its packets written, false otherwise.
+     */
+    bool Write(const AVFrame *frame);
+
+    /**
+     * @brief Changes the bitrate of the running encoder from the next frame written. Safe to call from any thread.
+     *
+     * Sets the target rate and, on an encoder opened with Params::max_bitrate, the VBV cap and buffer, which is
+     * what limits a crf encode. libx264 reconfigures on the fly; x264 cannot turn VBV on after opening, so an
+     * encoder meant to be steered is opened with a cap. Other encoders may keep their opening rate.
+     *
+     * @param bitrate Bits per second.
+     * @return false if the bitrate is 0.
+     */
+    bool SetBitrate(uint32_t bitrate);
+
+    /**
+     * @brief Changes the crf of the running encoder from the next frame written. Safe to call from any thread.
+     *
+     * Only libx264 acts on it while running, libvpx keeps its opening crf.
+     *
+     * @param crf Constant Rate Factor (0–51 for x264).
+     * @return false if crf is above 63, out of range for every encoder.
+     */
+    bool SetCrf(uint32_t crf);
+
+    /**
+     * @brief Asks for an IDR frame at an instant of the timeline. Safe to call from any thread.
+     *
+     * The keyframe is forced on the first frame at or after the instant. Encoders fed from the same capture
+     * put it on the same frame when they are given the same instant, one no encoder has reached yet, such as
+     * just after the newest captured frame. A request less than Params::keyframe_request_spacing after the
+     * previous one is covered by it and ignored; the decision only depends on the instants asked for, so all
+     * those encoders make it alike. Lets a live stream keep a long GOP and still start new or lost clients quickly.
+     *
+     * @param at Instant in microseconds on the encoder's timeline, as EncodedFragment::startTime.
+     * @return false if the request was covered by the previous one.
+     */
+    bool RequestKeyframe(int64_t at);
+
+    /**
+     * @brief Checks if the encoder is open.
+     */
+    bool IsOpen() const;
+
+    /**
+     * @brief The open codec context, nullptr when closed.
+     */
+    const AVCodecContext *CodecContext() const;
+
+    /**
+     * @brief Reads the encoder threading from the environment.
+     *
+     * ENCODE_THREADS sets Params::threads and ENCODE_THREADING is "auto", "frame" or "slice".
+     */
+    static void ThreadingFromEnvironment(Params &params);
+
+    /**
+     * @brief Reads the encoder choice from the environment into the parameters.
+     *
+     * ENCODE_CODEC is h264, vp8, vp9 or an encoder name, ENCODE_PRESET_FILE an ffpreset file and ENCODE_OPTIONS
+     * key=value pairs separated by ':'.
+     */
+    static void CodecFromEnvironment(Params &params);
+
+    /**
+     * @brief Counters of every attached sink.
+     */
+    std::vector<SinkStats> GetStats() const;
+
+    /**
+     * @brief Input-to-packet delay since Open. Kept after Close, until the next Open.
+     */
+    LatencyStats GetLatency() const;
+
+private:
+    /**
+     * @brief Receives the packets the encoder has ready and writes each one to every sink.
+     */
+    bool FlushPackets();
+
+    /**
+     * @brief Computes the codec timestamp of the next frame.
+     *
+     * In VFR mode the frame's own pts is rebased to the first frame and rescaled to the codec time base.
+     * Frames without a timestamp, and every frame in CFR mode, are numbered at the nominal frame rate.
+     * The result is kept strictly increasing, as the encoder requires.
+     *
+     * @param frame The frame to stamp, or nullptr for raw input.
+     * @return The pts in codec time base units.
+     */
+    int64_t NextPts(const AVFrame *frame);
+
+    /**
+     * @brief Forces an IDR frame on the first frame of each Params::keyframe_interval, and where RequestKeyframe asked for one.
+     *
+     * The interval is counted on the timeline rather than in frames, so encoders fed from the same capture
+     * put their keyframes on the same frames even when one of them drops frames.
+     */
+    void ForceKeyframe(AVFrame *frame);
+
+    /**
+     * @brief Notes when the frame with the given pts entered Write.
+     */
+    void MarkInput(int64_t pts, std::chrono::steady_clock::time_point input);
+
+    /**
+     * @brief Measures the delay of the frame a packet belongs to.
+     */
+    void MarkOutput(const AVPacket *packet);
+
+    /**
+     * @brief Hands the rate changes asked for by SetBitrate and SetCrf to the encoder, on the encoding thread.
+     */
+    void ApplyRate();
+
+    /**
+     * @brief Frees the codec, frames and conversion contexts.
+     */
+    void FreeContext();
+
+    struct InFlight
+    {
+        int64_t pts; ///< Codec pts of the frame.
+        std::chrono::steady_clock::time_point input; ///< When the frame entered Write.
+        uint32_t index; ///< Frame index.
+    };
+
+    struct Latency
+    {
+        uint64_t frames = 0; ///< Packets measured.
+        double total_ms = 0.0; ///< Sum of the delays.
+        double max_ms = 0.0; ///< Largest delay.
+        uint64_t total_frames = 0; ///< Sum of the frames sent while waiting.
+        std::vector<uint32_t> histogram; ///< Delays in 0.1 ms buckets, the last one for everything above.
+    };
+
+    struct Attached
+    {
+        std::shared_ptr<PacketSink> sink; ///< The sink.
+        bool started = false; ///< Whether the sink got its first keyframe.
+        SinkStats stats; ///< Counters.
+    };
+
+    /**
+     * @struct Context
+     * @brief FFmpeg state of the open encoder.
+     */
+    struct Context
+    {
+        AVCodecContext *codec_context = nullptr; ///< The encoder.
+        const AVCodec *codec = nullptr; ///< The codec.
+        AVFrame *frame = nullptr; ///< Frame raw and converted input is written to.
+        SwsContext *sws_context = nullptr; ///< Conversion of raw input, unless rgb_kernel.
+        bool rgb_kernel = false; ///< Raw input is converted by ColorConvert instead of sws_context.
+        AVFrame *input_frame = nullptr; ///< Reference to an AVFrame input that needs no conversion.
+        AVPacket *packet = nullptr; ///< Packet received from the encoder.
+        uint32_t frame_index = 0; ///< Index of the current frame.
+        bool vfr = false; ///< Whether AVFrame timestamps are used.
+        int64_t first_pts = AV_NOPTS_VALUE; ///< Source pts of the first frame, in source time base units.
+        int64_t last_pts = AV_NOPTS_VALUE; ///< Codec pts of the last frame sent to the encoder.
+        bool rebase_pts = true; ///< Whether the timeline starts at the first frame.
+        double keyframe_interval = 0.0; ///< Seconds between forced keyframes, 0 for none.
+        int64_t keyframe_slot = AV_NOPTS_VALUE; ///< Interval of the last forced keyframe.
+        bool intra_refresh = false; ///< libx264 intra refresh is on, whose refresh points are flagged as keyframes.
+    };
+
+    std::atomic<bool> mIsOpen{ false }; ///< Indicates whether the encoder is open.
+    std::atomic<uint32_t> mPendingBitrate{ 0 }; ///< Bitrate asked for by SetBitrate, 0 for no change.
+    std::atomic<int> mPendingCrf{ -1 }; ///< crf asked for by SetCrf, -1 for no change.
+    std::atomic<bool> mKeyframeRequested{ false }; ///< Whether mKeyframeRequests holds an instant.
+    std::mutex mRequestMutex; ///< Guards mKeyframeRequests, mLastRequestAt and mRequestSpacing.
+    std::deque<int64_t> mKeyframeRequests; ///< Instants asked for by RequestKeyframe and not reached yet, in microseconds.
+    int64_t mLastRequestAt = AV_NOPTS_VALUE; ///< Instant of the last accepted keyframe request.
+    int64_t mRequestSpacing = 500000; ///< Params::keyframe_request_spacing in microseconds.
+    Context mContext = {}; ///< FFmpeg state.
+    FrameConverter mConverter; ///< Slice-threaded conversion of AVFrame input in another format or size.
+    mutable std::mutex mSinksMutex; ///< Guards mSinks.
+    std::vector<Attached> mSinks; ///< Attached sinks.
+    std::deque<InFlight> mInFlight; ///< Frames sent to the encoder whose packet is not out yet.
+    mutable std::mutex mLatencyMutex; ///< Guards mLatency.
+    Latency mLatency; ///< Input-to-packet delay since Open.
+};
+
+#endif // ENCODERCORE_HPP
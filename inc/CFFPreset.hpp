@@ -0,0 +1,66 @@
+#pragma once
+#ifndef FFPRESET_HPP
+#define FFPRESET_HPP
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/dict.h>
+}
+
+/**
+ * @class FFPreset
+ * @brief Encoder options read from an ffmpeg .ffpreset file, such as the presets/libvpx-*.ffpreset ones.
+ *
+ * A preset is a list of key=value lines, '#' starting a comment. The vcodec line names the encoder the
+ * preset was written for; every other line is an AVCodecContext or encoder private option, with the ffmpeg
+ * command line spelling vprofile accepted for profile.
+ */
+class FFPreset
+{
+public:
+    typedef std::pair<std::string, std::string> Option;
+
+    /**
+     * @brief Reads a preset file. Malformed lines are reported and skipped.
+     *
+     * @param path The .ffpreset file.
+     * @return true if the file could be read, false otherwise.
+     */
+    bool Load(const std::string &path);
+
+    /**
+     * @brief Adds the options to a dictionary for av_opt_set_dict2, later entries overriding earlier ones.
+     *
+     * A profile is only carried over to the encoder the preset names, since profile numbers mean different
+     * things per codec (VP9 profile 1 is 4:4:4 chroma, VP8 profile 1 a simpler loop filter).
+     *
+     * @param encoder Name of the encoder the options are for, e.g. "libvpx-vp9".
+     * @param options The dictionary to add to.
+     */
+    void AddTo(const std::string &encoder, AVDictionary **options) const;
+
+    const std::string& Path() const { return mPath; } ///< File the preset was read from, empty if none was.
+    const std::string& Encoder() const { return mEncoder; } ///< Encoder of the vcodec line, empty if none.
+    const std::vector<Option>& Options() const { return mOptions; } ///< Options in file order, vcodec excluded.
+
+    /**
+     * @brief Path of the bundled libvpx preset closest to a frame size and rate.
+     *
+     * @param height Frame height.
+     * @param fps Frame rate.
+     * @return presets/libvpx-360p, -720p, -720p50_60, -1080p or -1080p50_60.ffpreset.
+     */
+    static std::string Bundled(uint32_t height, double fps);
+
+private:
+    std::string mPath; ///< Preset file.
+    std::string mEncoder; ///< Encoder named by vcodec.
+    std::vector<Option> mOptions; ///< Options in file order.
+};
+
+#endif // FFPRESET_HPP
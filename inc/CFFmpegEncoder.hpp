@@ -5,8 +5,9 @@ extern "C" {
 #include <libavcodec/packet.h>
 #include <libavutil/frame.h>
 #include <stdint.h>
-#include <libavutil\pixfmt.h>
+#include <libavutil/pixfmt.h>
 }
+#include <CEncoderCore.hpp>
 
 
 /**
@@ -14,29 +15,16 @@ extern "C" {
  * @brief Class responsible for encoding video frames using FFmpeg.
  *
  * This class provides functionalities to initialize the encoder, encode video frames, and manage resources.
+ * It is an EncoderCore with a MuxerSink writing the output file; more sinks can be attached to Core() to
+ * stream or dump the same packets without a second encode.
  */
 class FFmpegEncoder
 {
 public:
     /**
-     * @struct Params
-     * @brief Structure to hold encoding parameters.
-     *
-     * This structure contains various parameters required for encoding, such as resolution, frame rate, bitrate, and pixel formats.
+     * @brief Encoding parameters: resolution, frame rate, bitrate, and pixel formats.
      */
-    struct Params
-    {
-        uint32_t width; ///< Width of the video frame.
-        uint32_t height; ///< Height of the video frame.
-        double fps; ///< Frames per second.
-        uint32_t bitrate; ///< Bitrate for encoding.
-        const char *preset; ///< Preset for encoding quality and speed.
-
-        uint32_t crf; ///< Constant Rate Factor (0–51).
-
-        enum AVPixelFormat src_format; ///< Source pixel format.
-        enum AVPixelFormat dst_format; ///< Destination pixel format.
-    };
+    typedef EncoderCore::Params Params;
     
     /**
      * @brief Default constructor for FFmpegEncoder.
@@ -61,11 +49,11 @@ public:
     ~FFmpegEncoder();
 
     /**
-     * @brief Opens the encoder and sets up the necessary FFmpeg structures for encoding video.
+     * @brief Opens the encoder and the output file.
      *
-     * This method allocates the output format context, finds and sets up the H.264 encoder, creates a new stream for the video,
-     * allocates and configures the codec context with parameters like bitrate, resolution, frame rate, and pixel format,
-     * initializes the frame and conversion context, and opens the output file and writes the header.
+     * This method attaches a MuxerSink for the file, with the container guessed from its name, and opens the
+     * encoder core, which sets up the encoder (H.264, or VP8/VP9 per Params::codec), the conversion of the input
+     * and then the file header. VP8 needs a .webm file name; VP9 goes in .webm or .mp4.
      *
      * @param filename The name of the output file.
      * @param params The encoding parameters.
@@ -76,16 +64,14 @@ public:
     /**
      * @brief Closes the encoder and releases all allocated resources.
      *
-     * This method sends a null frame to flush the encoder, writes the trailer to finalize the file, closes the output file,
-     * and frees the conversion context, frame, codec context, and format context.
+     * This method flushes the encoder, writes the trailer to finalize the file and closes every sink.
      */
     void Close();
 
     /**
      * @brief Encodes a frame of video data.
      *
-     * This method makes the frame writable, converts the input data to the desired pixel format, sends the frame to the encoder,
-     * and flushes the encoded packets to the output file.
+     * RGB24 input for a YUV420P encoder goes through the vectorised ColorConvert kernel instead of libswscale.
      *
      * @param data The input frame data.
      * @return true if the frame was successfully encoded, false otherwise.
@@ -93,42 +79,28 @@ public:
     bool Write(const unsigned char *data);
 
     /**
-     * @brief Checks if the encoder is currently open.
+     * @brief Encodes a decoded frame.
      *
-     * @return true if the encoder is open, false otherwise.
+     * Frames that already have the encoder's pixel format and size are passed by reference without conversion.
+     * With Params::vfr the frame's pts and time_base are carried into the output file (see EncoderCore::Write).
+     *
+     * @param frame The frame to encode.
+     * @return true if the frame was successfully encoded, false otherwise.
      */
-    bool IsOpen() const;
+    bool Write(const AVFrame *frame);
 
-private:
     /**
-     * @brief Flushes the encoded packets from the encoder to the output file.
-     *
-     * This method receives encoded packets from the encoder, rescales the packet timestamps, writes the packets to the output file,
-     * and unreferences the packet to free its resources.
+     * @brief Checks if the encoder is currently open.
      *
-     * @return true if the packets were successfully flushed, false otherwise.
+     * @return true if the encoder is open, false otherwise.
      */
-    bool FlushPackets();
-
-private:
-    bool mIsOpen = false; ///< Indicates whether the encoder is open.
+    bool IsOpen() const;
 
     /**
-     * @struct Context
-     * @brief Structure to hold FFmpeg context information.
-     *
-     * This structure contains pointers to various FFmpeg contexts and the frame index.
+     * @brief The shared encoder, to attach more sinks to.
      */
-    struct Context
-    {
-        struct AVFormatContext *format_context = nullptr; /*Pointer to the format context.*/
-        struct AVStream *stream = nullptr; /*Pointer to the stream */
-        struct AVCodecContext *codec_context = nullptr; /* Pointer to the codec context.*/
-        struct AVFrame *frame = nullptr; /*Pointer to the frame.*/
-        struct SwsContext *sws_context = nullptr; /*Pointer to the software scaling context.*/
-        const struct AVCodec *codec = nullptr; ///< Pointer to the codec.      
-        uint32_t frame_index = 0; ///< Index of the current frame.
-    };
+    EncoderCore &Core();
 
-    Context mContext = {}; ///< Instance of the Context structure.
+private:
+    EncoderCore mCore; ///< Encoder and its sinks.
 };
@@ -0,0 +1,74 @@
+#pragma once
+#ifndef FRAGMENTPOOL_HPP
+#define FRAGMENTPOOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+/**
+ * @class FragmentPool
+ * @brief Pool of reference-counted buffers for muxer output, sized from the fragments it has seen.
+ *
+ * Buffers are twice the running average fragment size, rounded up to 4 KiB, so a typical fragment is
+ * written once into a buffer that already fits and is never copied again. When the average drifts out of
+ * range the pool is replaced by one of the new size; buffers of the old pool stay valid until released.
+ * A fragment that outgrows its buffer is moved to a bigger, unpooled one, which is counted in Grown().
+ * Only the encoding thread may call the pool; buffers may be released on any thread.
+ */
+class FragmentPool
+{
+public:
+    FragmentPool() = default;
+    FragmentPool(const FragmentPool&) = delete;
+    FragmentPool& operator=(const FragmentPool&) = delete;
+
+    /**
+     * @brief Destructor that releases the pool. Buffers in flight stay valid.
+     */
+    ~FragmentPool();
+
+    /**
+     * @brief Takes a buffer of BufferSize() bytes.
+     *
+     * @return The buffer, or nullptr if it could not be allocated.
+     */
+    AVBufferRef* Acquire();
+
+    /**
+     * @brief Makes room for more bytes in a buffer taken from Acquire, moving them to a bigger buffer if needed.
+     *
+     * @param buffer The buffer, replaced when it grows.
+     * @param size Bytes that must fit.
+     * @return false if the buffer could not grow.
+     */
+    bool Reserve(AVBufferRef** buffer, size_t size);
+
+    /**
+     * @brief Feeds the size of a finished fragment into the running average, resizing the pool when needed.
+     */
+    void Record(size_t size);
+
+    /**
+     * @brief Releases the pool and forgets the average.
+     */
+    void Reset();
+
+    size_t BufferSize() const; ///< Size of the pooled buffers.
+    size_t AverageSize() const; ///< Running average fragment size.
+    uint64_t Grown() const; ///< Times a buffer had to grow because a fragment did not fit.
+    uint64_t Resizes() const; ///< Times the pool was replaced by one of another size.
+
+private:
+    AVBufferPool* mPool = nullptr; ///< Current pool.
+    size_t mBufferSize = 64 * 1024; ///< Size of the buffers of mPool, or of the first pool.
+    double mAverage = 0.0; ///< Exponential moving average of the fragment sizes.
+    uint64_t mCount = 0; ///< Fragments recorded.
+    uint64_t mGrown = 0; ///< Buffer growths.
+    uint64_t mResizes = 0; ///< Pool replacements.
+};
+
+#endif // FRAGMENTPOOL_HPP
@@ -0,0 +1,133 @@
+#pragma once
+#ifndef FRAMEBUS_HPP
+#define FRAMEBUS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+}
+#include <CObserver.hpp>
+#include <CVideoFrame.hpp>
+#include <CThreadSafeQueue.hpp>
+#include <CFrameConverter.hpp>
+
+/**
+ * @class FrameBus
+ * @brief Delivers captured frames to any number of observers, each on its own thread.
+ *
+ * Publish only hands a frame reference to every subscriber's mailbox and returns, so a slow observer
+ * (a GDI repaint, a network preview) never holds up capture or the other observers. A mailbox keeps
+ * the latest frame only: a frame the observer has not picked up yet is replaced by the newer one and
+ * counted as skipped. Each subscriber may ask for its own pixel format and size; the conversion runs on
+ * that subscriber's thread with its own FrameConverter.
+ */
+class FrameBus
+{
+public:
+    /**
+     * @struct Params
+     * @brief What a subscriber wants to receive.
+     */
+    struct Params
+    {
+        std::string name = "observer"; ///< Name used in the statistics.
+        AVPixelFormat format = AV_PIX_FMT_NONE; ///< Pixel format to convert to, AV_PIX_FMT_NONE for frames as published.
+        int width = 0; ///< Width to scale to when a format is set, 0 for the published width.
+        int height = 0; ///< Height to scale to when a format is set, 0 for the published height.
+        std::function<bool(int)> accepts; ///< Formats the observer takes as they are, besides format. May be empty.
+        int scale_threads = 1; ///< Slice threads of the subscriber's converter, 0 for one per core.
+    };
+
+    /**
+     * @struct Stats
+     * @brief Delivery counters of one subscriber.
+     */
+    struct Stats
+    {
+        std::string name; ///< Params::name of the subscriber.
+        uint64_t published = 0; ///< Frames handed to the mailbox.
+        uint64_t delivered = 0; ///< Frames passed to Observer::update.
+        uint64_t skipped = 0; ///< Frames replaced in the mailbox before delivery, or that could not be converted.
+    };
+
+    FrameBus() = default;
+    FrameBus(const FrameBus&) = delete;
+    FrameBus& operator=(const FrameBus&) = delete;
+
+    /**
+     * @brief Destructor that stops every delivery thread.
+     */
+    ~FrameBus();
+
+    /**
+     * @brief Adds an observer and starts its delivery thread. An observer that is already subscribed is
+     *        subscribed again with the new parameters.
+     *
+     * @param observer The observer, which must stay alive until it is unsubscribed.
+     * @param params The format, size and name of the subscription.
+     */
+    void Subscribe(Observer* observer, const Params& params);
+
+    /**
+     * @brief Removes an observer, waiting for a delivery in progress to finish. Must not be called from
+     *        the observer's own update.
+     *
+     * @return true if the observer was subscribed.
+     */
+    bool Unsubscribe(Observer* observer);
+
+    /**
+     * @brief Removes every observer.
+     */
+    void Clear();
+
+    /**
+     * @brief Checks if any observer is subscribed, so publishers can skip work nobody will see.
+     */
+    bool HasSubscribers() const;
+
+    /**
+     * @brief Hands a frame to every subscriber without waiting for any of them.
+     */
+    void Publish(const VideoFrame& frame);
+
+    /**
+     * @brief Counters of every current subscriber.
+     */
+    std::vector<Stats> GetStats() const;
+
+    /**
+     * @brief Prints one line of counters per subscriber.
+     */
+    void Report(std::ostream& out) const;
+
+private:
+    struct Subscriber
+    {
+        Observer* observer = nullptr; ///< Receives the frames.
+        Params params; ///< Requested format and size.
+        ThreadSafeQueue<VideoFrame> mailbox{ 1, ThreadSafeQueue<VideoFrame>::OverflowPolicy::DropOldest }; ///< Latest undelivered frame.
+        FrameConverter converter; ///< Conversion to the requested format and size, used on the delivery thread only.
+        std::atomic<uint64_t> delivered{ 0 }; ///< Frames passed to the observer.
+        std::atomic<uint64_t> failed{ 0 }; ///< Frames that could not be converted.
+        std::thread thread; ///< Delivery thread.
+    };
+
+    static void Deliver(Subscriber& subscriber);
+    static bool NeedsConversion(const Subscriber& subscriber, const VideoFrame& frame);
+    static void Stop(Subscriber& subscriber);
+
+    mutable std::mutex mMutex; ///< Guards mSubscribers.
+    std::vector<std::unique_ptr<Subscriber>> mSubscribers; ///< Current subscribers.
+};
+
+#endif // FRAMEBUS_HPP
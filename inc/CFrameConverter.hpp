@@ -0,0 +1,110 @@
+#pragma once
+#ifndef FRAMECONVERTER_HPP
+#define FRAMECONVERTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+#include <CFramePool.hpp>
+
+struct SwsContext;
+
+/**
+ * @class FrameConverter
+ * @brief Converts frames to one target pixel format and size, splitting each frame into slices
+ *        that libswscale scales in parallel.
+ *
+ * The conversion context is created with the "threads" option and driven through sws_scale_frame, so
+ * libswscale cuts the picture into horizontal slices and runs them on its own worker pool. The
+ * context is rebuilt only when the input format or size changes. Converted frames can come from a
+ * fixed FramePool, so a converter running as its own pipeline stage does no per-frame allocation.
+ * RGB24 input converted to YUV420P at the same size skips libswscale and goes through ColorConvert.
+ */
+class FrameConverter
+{
+public:
+    /**
+     * @struct Params
+     * @brief Target layout and scaler settings.
+     */
+    struct Params
+    {
+        AVPixelFormat format = AV_PIX_FMT_YUV420P; ///< Target pixel format.
+        int width = 0; ///< Target width, 0 for the input width.
+        int height = 0; ///< Target height, 0 for the input height.
+        int flags = 0; ///< SWS_* scaler flags, 0 for SWS_BICUBIC.
+        int threads = 0; ///< Slice threads, 0 for one per core (at most 8), 1 for none.
+        size_t pool_size = 8; ///< Converted frames that may be in flight, for Convert(const AVFrame*); 0 for the default.
+        bool huge_pages = false; ///< Back the frame pool with huge pages when possible.
+    };
+
+    FrameConverter() = default;
+    FrameConverter(const FrameConverter&) = delete;
+    FrameConverter& operator=(const FrameConverter&) = delete;
+
+    /**
+     * @brief Destructor that frees the conversion context and the frame pool.
+     */
+    ~FrameConverter();
+
+    /**
+     * @brief Sets the target layout. The context and pool are rebuilt on the next conversion.
+     */
+    void SetParams(const Params& params);
+
+    /**
+     * @brief Checks if a frame already has the target format and size.
+     */
+    bool Matches(const AVFrame* frame) const;
+
+    /**
+     * @brief Converts a frame into a new frame taken from the pool.
+     *
+     * @param frame The frame to convert. Its properties (pts, time base...) are copied.
+     * @return The converted frame, or nullptr on error or when every pooled frame is in use. Free it with av_frame_free.
+     */
+    AVFrame* Convert(const AVFrame* frame);
+
+    /**
+     * @brief Converts a frame into a caller provided frame that already has the target format, size and buffers.
+     *
+     * @param frame The frame to convert.
+     * @param output The frame that receives the picture. Must be writable.
+     * @return true on success, false otherwise.
+     */
+    bool Convert(const AVFrame* frame, AVFrame* output);
+
+    /**
+     * @brief Number of frames Convert(const AVFrame*) dropped because the pool was empty.
+     */
+    uint64_t DroppedFrames() const;
+
+    /**
+     * @brief Frees the conversion context and the pool. Frames in flight stay valid.
+     */
+    void Reset();
+
+    /**
+     * @brief Reads the slice thread count from SCALER_THREADS (0 or unset for automatic).
+     */
+    static int ThreadsFromEnvironment();
+
+private:
+    SwsContext* GetContext(const AVFrame* frame);
+    int TargetWidth(const AVFrame* frame) const;
+    int TargetHeight(const AVFrame* frame) const;
+
+    Params mParams; ///< Target layout and scaler settings.
+    SwsContext* mContext = nullptr; ///< Conversion context for the current input layout.
+    int mSourceFormat = AV_PIX_FMT_NONE; ///< Input format mContext was built for.
+    int mSourceWidth = 0; ///< Input width mContext was built for.
+    int mSourceHeight = 0; ///< Input height mContext was built for.
+    FramePool mPool; ///< Pool of converted frames.
+    uint64_t mDroppedBefore = 0; ///< Drops counted by pools that were replaced.
+};
+
+#endif // FRAMECONVERTER_HPP
@@ -0,0 +1,114 @@
+#pragma once
+#ifndef FRAMEPOOL_HPP
+#define FRAMEPOOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+struct AVCodecContext;
+
+/**
+ * @class FramePool
+ * @brief Fixed slab of preallocated, aligned frame buffers for one resolution and pixel format.
+ *
+ * All N buffers are carved out of a single allocation (optionally backed by huge pages) when the pool is
+ * initialized. Acquire hands out reference-counted AVFrames whose buffer goes back to the pool when the
+ * last reference is dropped, on whatever thread that happens. Handing out and taking back are lock-free,
+ * so steady-state capture does no large heap allocation and memory use has a hard upper limit: when all
+ * buffers are in flight, Acquire fails and the caller drops the frame.
+ *
+ * The slab stays alive until the pool is destroyed and every buffer has been returned, so frames may
+ * outlive the pool object.
+ */
+class FramePool
+{
+public:
+    /**
+     * @struct Params
+     * @brief Layout of the pooled frames.
+     */
+    struct Params
+    {
+        AVPixelFormat format = AV_PIX_FMT_NONE; ///< Pixel format of the frames.
+        int width = 0; ///< Width of the frames.
+        int height = 0; ///< Height of the frames.
+        int padded_width = 0; ///< Allocated width, at least width (0 for width). Decoders need aligned dimensions.
+        int padded_height = 0; ///< Allocated height, at least height (0 for height).
+        size_t count = 8; ///< Number of buffers in the slab.
+        bool huge_pages = false; ///< Back the slab with huge/large pages when the system allows it.
+    };
+
+    FramePool() = default;
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    /**
+     * @brief Destructor that releases the slab once all outstanding frames are freed.
+     */
+    ~FramePool();
+
+    /**
+     * @brief Allocates the slab. A pool that was initialized before is released first.
+     *
+     * @param params The frame layout and number of buffers.
+     * @return true if the slab was allocated, false otherwise.
+     */
+    bool Init(const Params& params);
+
+    /**
+     * @brief Releases this pool's hold on the slab. Frames still in flight stay valid.
+     */
+    void Destroy();
+
+    /**
+     * @brief Checks if the pool has been initialized.
+     */
+    bool IsInitialized() const { return mSlab != nullptr; }
+
+    /**
+     * @brief Checks if the pool hands out frames of the given format and size.
+     */
+    bool Matches(AVPixelFormat format, int width, int height) const;
+
+    /**
+     * @brief Takes a buffer from the pool.
+     *
+     * @return A frame of the pool's format and size, or nullptr if every buffer is in use. Free it with av_frame_free.
+     */
+    AVFrame* Acquire();
+
+    /**
+     * @brief Attaches a pooled buffer to a frame allocated by the caller.
+     *
+     * The frame's format, width and height are set from the pool, its data pointers and linesizes point into the buffer.
+     *
+     * @param frame The frame to fill. It must not hold any buffer.
+     * @return true on success, false if every buffer is in use.
+     */
+    bool Acquire(AVFrame* frame);
+
+    size_t Capacity() const; ///< Number of buffers in the slab.
+    size_t Available() const; ///< Number of buffers currently free.
+    uint64_t Exhausted() const; ///< Number of Acquire calls that failed because the pool was empty.
+    bool UsesHugePages() const; ///< Whether the slab got reserved huge/large pages; transparent huge pages, only asked for, do not count.
+
+    /**
+     * @brief AVCodecContext::get_buffer2 callback that decodes into the pool set as the context's opaque.
+     *
+     * Frames the pool does not match fall back to the default allocator. When the pool is empty the decoder
+     * gets ENOMEM.
+     */
+    static int GetBuffer2(AVCodecContext* context, AVFrame* frame, int flags);
+
+private:
+    struct Slab;
+
+    Slab* mSlab = nullptr; ///< Shared with the frames in flight, freed with the last reference.
+};
+
+#endif // FRAMEPOOL_HPP
@@ -0,0 +1,260 @@
+#pragma once
+#ifndef FRAMESOURCE_HPP
+#define FRAMESOURCE_HPP
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+#include <CFramePool.hpp>
+
+/**
+ * @class FrameSource
+ * @brief Base class for everything that can feed decoded video frames into the capture pipeline.
+ *
+ * A frame source opens an ffmpeg input (capture device, media file or lavfi graph), picks the
+ * first video stream, decodes it and hands out one AVFrame per call to ReadFrame. Backends only
+ * describe how the input is opened; demuxing, decoding and pacing are shared.
+ */
+class FrameSource
+{
+public:
+    /**
+     * @brief How fast frames are handed out.
+     *
+     * RealTime throttles non-live inputs (files, synthetic sources) to their timestamps so they behave
+     * like a camera. AsFastAsPossible returns frames as soon as they are decoded, which is what load
+     * tests want. Capture devices are always paced by the device itself.
+     */
+    enum class Pacing
+    {
+        RealTime,
+        AsFastAsPossible
+    };
+
+    /**
+     * @brief How the decoder spreads work over threads.
+     *
+     * Frame threading decodes several frames at once and adds one frame of latency per extra thread.
+     * Slice threading splits each frame and adds no latency, but only helps codecs that code slices
+     * (MJPEG decodes restart intervals in parallel). Auto lets the decoder pick from what it supports.
+     */
+    enum class DecodeThreading
+    {
+        Auto,
+        Frame,
+        Slice
+    };
+
+    /**
+     * @struct Params
+     * @brief Parameters for opening a frame source.
+     */
+    struct Params
+    {
+        std::string url; ///< Device name, file path or lavfi graph. Empty selects the backend default.
+        uint32_t width = 1280; ///< Requested frame width (ignored by file replay).
+        uint32_t height = 720; ///< Requested frame height (ignored by file replay).
+        double fps = 30.0; ///< Requested frame rate (ignored by file replay).
+        Pacing pacing = Pacing::RealTime; ///< Frame pacing mode.
+        bool loop = false; ///< Rewind to the start at end of input instead of stopping.
+        uint64_t max_frames = 0; ///< Stop after this many frames, 0 for no limit.
+        size_t frame_pool_size = 8; ///< Decoded frames that may be in flight at once, 0 to let the decoder allocate.
+        bool huge_pages = false; ///< Back the frame pool with huge pages when possible.
+        int decode_threads = 0; ///< Decoder threads, 0 for one per core.
+        DecodeThreading decode_threading = DecodeThreading::Auto; ///< Decoder threading mode.
+    };
+
+    virtual ~FrameSource();
+
+    /**
+     * @brief Open the input and the decoder for its first video stream.
+     *
+     * @param params The source parameters.
+     * @return true if the source was successfully opened, false otherwise.
+     */
+    bool Open(const Params& params);
+
+    /**
+     * @brief Close the decoder and the input and release all resources.
+     */
+    void Close();
+
+    /**
+     * @brief Decode the next video frame.
+     *
+     * Corrupted packets are skipped. The frame pts is continuous across loops of a file source.
+     *
+     * @param frame Frame that receives the decoded picture. It is unreferenced first.
+     * @return true if a frame was decoded, false at end of input, after max_frames or on error.
+     */
+    bool ReadFrame(AVFrame* frame);
+
+    /**
+     * @brief Checks if the source is currently open.
+     *
+     * @return true if the source is open, false otherwise.
+     */
+    bool IsOpen() const;
+
+    /**
+     * @brief Time base of the pts of the frames returned by ReadFrame.
+     */
+    AVRational TimeBase() const;
+
+    /**
+     * @brief Number of frames skipped because every pooled frame was still in use downstream.
+     */
+    uint64_t DroppedFrames() const;
+
+    /**
+     * @brief Number of frames the device or decoder lost, estimated from gaps between frame timestamps.
+     *
+     * A gap counts as missed frames when it is more than one and a half nominal frame durations long.
+     * Frames skipped for an empty pool are left out, DroppedFrames counts them.
+     */
+    uint64_t MissedFrames() const;
+
+    /**
+     * @brief Time the capture thread spent in the decoder for the last returned frame, in milliseconds.
+     */
+    double LastDecodeTime() const;
+
+    /**
+     * @brief Average time spent in the decoder per returned frame, in milliseconds.
+     */
+    double AverageDecodeTime() const;
+
+    /**
+     * @brief Short backend name used in log output.
+     */
+    virtual const char* Name() const = 0;
+
+    /**
+     * @brief Create a source backend by name.
+     *
+     * @param kind "webcam", "file" or "testsrc".
+     * @return The backend, or nullptr if the name is unknown.
+     */
+    static std::unique_ptr<FrameSource> Create(const std::string& kind);
+
+    /**
+     * @brief Read the source selection from the environment.
+     *
+     * FRAME_SOURCE selects the backend (default "webcam"), FRAME_SOURCE_URL the input,
+     * FRAME_SOURCE_PACING is "realtime" or "fast", FRAME_SOURCE_LOOP is 0 or 1,
+     * FRAME_SOURCE_MAX_FRAMES limits the number of frames, FRAME_POOL_SIZE sets the number of pooled
+     * frames and FRAME_POOL_HUGE_PAGES is 0 or 1. DECODE_THREADS sets the number of decoder threads
+     * and DECODE_THREADING is "auto", "frame" or "slice".
+     *
+     * @param kind Receives the backend name.
+     * @param params Receives the source parameters. Width, height and fps are left untouched.
+     */
+    static void FromEnvironment(std::string& kind, Params& params);
+
+protected:
+    /**
+     * @brief Input format to open the url with, or nullptr to probe it.
+     */
+    virtual const AVInputFormat* InputFormat() const = 0;
+
+    /**
+     * @brief Url passed to avformat_open_input.
+     */
+    virtual std::string InputUrl(const Params& params) const = 0;
+
+    /**
+     * @brief Add backend specific demuxer options.
+     */
+    virtual void InputOptions(AVDictionary** options, const Params& params) const;
+
+    /**
+     * @brief Whether the input delivers frames in real time by itself.
+     */
+    virtual bool IsLive() const;
+
+    /**
+     * @brief Whether the input can be rewound for looping.
+     */
+    virtual bool IsSeekable() const;
+
+private:
+    bool Rewind();
+    void Pace(int64_t pts);
+    void InitFramePool(const AVCodec* decoder);
+    void InitThreading(const AVCodec* decoder);
+
+    Params mParams; ///< Parameters the source was opened with.
+    bool mIsOpen = false; ///< Indicates whether the source is open.
+    AVFormatContext* mFormatContext = nullptr; ///< Demuxer context.
+    AVCodecContext* mDecoderContext = nullptr; ///< Decoder context of the video stream.
+    AVPacket* mPacket = nullptr; ///< Packet reused for every read.
+    int mStreamIndex = -1; ///< Index of the decoded video stream.
+    uint64_t mFramesRead = 0; ///< Number of frames returned so far.
+    int64_t mStartPts = AV_NOPTS_VALUE; ///< Output pts of the first returned frame.
+    int64_t mLastPts = AV_NOPTS_VALUE; ///< Output pts of the last returned frame.
+    int64_t mLastDuration = 0; ///< Duration of the last returned frame.
+    int64_t mPtsOffset = 0; ///< Added to the pts to keep them increasing across loops.
+    std::chrono::steady_clock::time_point mStartTime; ///< Wall clock time of the first frame.
+    FramePool mFramePool; ///< Fixed pool the decoder allocates frames from, when supported.
+    uint64_t mFramesDropped = 0; ///< Packets skipped because the frame pool was empty.
+    uint64_t mDroppedSinceFrame = 0; ///< Of those, the ones skipped since the last frame returned.
+    int64_t mFrameDuration = 0; ///< Nominal frame duration in stream time base units, 0 if unknown.
+    uint64_t mFramesMissed = 0; ///< Frames missing from the timestamp sequence.
+    std::chrono::steady_clock::duration mDecodeTime{}; ///< Decoder time spent on the frame being decoded.
+    std::chrono::steady_clock::duration mLastDecodeTime{}; ///< Decoder time spent on the last returned frame.
+    std::chrono::steady_clock::duration mTotalDecodeTime{}; ///< Decoder time spent on all returned frames.
+};
+
+/**
+ * @class WebcamFrameSource
+ * @brief Capture device backend (dshow on Windows, v4l2 on Linux, avfoundation on macOS).
+ */
+class WebcamFrameSource : public FrameSource
+{
+public:
+    const char* Name() const override { return "webcam"; }
+
+protected:
+    const AVInputFormat* InputFormat() const override;
+    std::string InputUrl(const Params& params) const override;
+    void InputOptions(AVDictionary** options, const Params& params) const override;
+    bool IsLive() const override { return true; }
+    bool IsSeekable() const override { return false; }
+};
+
+/**
+ * @class FileFrameSource
+ * @brief Replays a media file, optionally in a loop.
+ */
+class FileFrameSource : public FrameSource
+{
+public:
+    const char* Name() const override { return "file"; }
+
+protected:
+    const AVInputFormat* InputFormat() const override { return nullptr; }
+    std::string InputUrl(const Params& params) const override;
+};
+
+/**
+ * @class SyntheticFrameSource
+ * @brief Generates frames with the lavfi testsrc filter, no hardware or media required.
+ */
+class SyntheticFrameSource : public FrameSource
+{
+public:
+    const char* Name() const override { return "testsrc"; }
+
+protected:
+    const AVInputFormat* InputFormat() const override;
+    std::string InputUrl(const Params& params) const override;
+    bool IsSeekable() const override { return false; }
+};
+
+#endif // FRAMESOURCE_HPP
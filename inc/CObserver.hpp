@@ -2,10 +2,19 @@
 #ifndef OBSERVER_HPP
 #define OBSERVER_HPP
 
+#include <CVideoFrame.hpp>
+
 class Observer
 {
 public:
-    virtual void update(unsigned char* data, uint32_t width, uint32_t height) = 0;
+    /**
+     * @brief Called with every captured frame, in RGB24 or in a YUV format ColorConvert::ToBGRPreview handles.
+     *
+     * The frame handle may be copied and kept after the call returns; it stays valid until the last copy is gone.
+     *
+     * @param frame The captured frame.
+     */
+    virtual void update(const VideoFrame& frame) = 0;
     virtual ~Observer() = default;
 
 };
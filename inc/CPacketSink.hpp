@@ -0,0 +1,246 @@
+#pragma once
+#ifndef PACKETSINK_HPP
+#define PACKETSINK_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+#include <CSpscRingBuffer.hpp>
+#include <CEncodedFragment.hpp>
+#include <CFragmentPool.hpp>
+
+/**
+ * @class PacketSink
+ * @brief Destination for the encoded packets of an EncoderCore.
+ *
+ * The core opens each sink with its codec context once the encoder is open, so the extradata (SPS/PPS)
+ * is known, then hands every packet to every sink on the encoding thread. Packets are passed by const
+ * pointer with timestamps in the codec time base; a sink that keeps or changes one takes its own reference.
+ */
+class PacketSink
+{
+public:
+    virtual ~PacketSink() = default;
+
+    /**
+     * @brief Prepares the sink for the packets of an open encoder.
+     *
+     * @param codec The open codec context. Its parameters and time base stay valid until Close.
+     * @return true if the sink is ready, false otherwise.
+     */
+    virtual bool Open(const AVCodecContext *codec) = 0;
+
+    /**
+     * @brief Writes one encoded packet.
+     *
+     * @param packet The packet, with timestamps in the codec time base.
+     * @return true if the packet was written, false otherwise.
+     */
+    virtual bool Write(const AVPacket *packet) = 0;
+
+    /**
+     * @brief Finishes the output (trailer, last fragment...) and releases it. Safe to call more than once.
+     */
+    virtual void Close() = 0;
+
+    /**
+     * @brief Name used in messages and statistics.
+     */
+    virtual std::string Name() const = 0;
+
+    /**
+     * @brief Creates the sink matching a target.
+     *
+     * A path ending in .h264 or .264 gives an AnnexBSink. A udp://, tcp:// or srt:// URL gives an MPEG-TS
+     * MuxerSink and an rtmp:// URL an FLV one. Anything else is a MuxerSink with the container guessed
+     * from the file name.
+     *
+     * @param target File path or URL.
+     * @return The sink, not opened yet.
+     */
+    static std::shared_ptr<PacketSink> Create(const std::string &target);
+};
+
+/**
+ * @class MuxerSink
+ * @brief Muxes the packets into a container with libavformat, to a file or to any URL libavformat can open.
+ */
+class MuxerSink : public PacketSink
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param url Output file or URL (udp://, tcp://...).
+     * @param format Container short name, empty to guess it from the url.
+     * @param options Muxer options as key=value pairs separated by ':', e.g. "movflags=faststart".
+     */
+    explicit MuxerSink(const std::string &url, const std::string &format = std::string(),
+                       const std::string &options = std::string());
+    ~MuxerSink() override;
+
+    bool Open(const AVCodecContext *codec) override;
+    bool Write(const AVPacket *packet) override;
+    void Close() override;
+    std::string Name() const override;
+
+private:
+    std::string mUrl; ///< Output file or URL.
+    std::string mFormat; ///< Container short name, empty to guess.
+    std::string mOptions; ///< Muxer options.
+    AVFormatContext *mFormatContext = nullptr; ///< Output context.
+    AVStream *mStream = nullptr; ///< The video stream.
+    AVPacket *mPacket = nullptr; ///< Reference handed to the muxer for each packet.
+    AVRational mCodecTimeBase = { 0, 1 }; ///< Time base of the packets written to the sink.
+    bool mHeaderWritten = false; ///< Whether the trailer must be written on Close.
+};
+
+/**
+ * @class FragmentSink
+ * @brief Muxes the packets into one long-lived fragmented MP4 stream and queues it, cut into pieces, for a sender thread.
+ *
+ * The muxer is set up once per stream. Its header (ftyp and an empty moov) is the init segment, queued
+ * first and kept in InitSegment(). Every later piece is one moof/mdat fragment, cut once it holds
+ * Params::frames_per_fragment frames or Params::fragment_duration_ms of video, and always before a keyframe
+ * so each fragment starts on one when the target is a whole GOP or more. The muxer's AVIO write callback
+ * copies its output straight into a reference-counted buffer from a FragmentPool, one pool for fragments
+ * that start with a keyframe and one for the others since their sizes differ by an order of magnitude.
+ * From there the buffer travels to the socket layer as an EncodedFragment, without further copies.
+ * Pieces wait in a bounded lock-free queue that blocks the encoder when the sender is 256 behind.
+ */
+class FragmentSink : public PacketSink
+{
+public:
+    /**
+     * @struct Params
+     * @brief When to cut a fragment. With both targets 0, fragments hold one GOP.
+     */
+    struct Params
+    {
+        int frames_per_fragment = 1; ///< Frames per fragment, 0 for no frame target. 1 gives the lowest latency.
+        int fragment_duration_ms = 0; ///< Video duration per fragment in milliseconds, 0 for no duration target.
+    };
+
+    FragmentSink() = default;
+
+    /**
+     * @brief Constructor with fragment targets.
+     */
+    explicit FragmentSink(const Params &params);
+    ~FragmentSink() override;
+
+    /**
+     * @brief Sets the fragment targets used from the next Open.
+     */
+    void SetParams(const Params &params);
+
+    bool Open(const AVCodecContext *codec) override;
+    bool Write(const AVPacket *packet) override;
+    void Close() override;
+    std::string Name() const override;
+
+    /**
+     * @brief Gets the next piece of the stream (the init segment first, then fragments), waiting until one is available.
+     *
+     * @return false once the sink is closed and drained.
+     */
+    bool Pop(EncodedFragment &fragment);
+
+    /**
+     * @brief Gets the next piece if one is ready, without waiting. Must be called from the consumer thread.
+     */
+    bool TryPop(EncodedFragment &fragment);
+
+    /**
+     * @brief Checks if no piece is waiting.
+     */
+    bool Empty() const;
+
+    /**
+     * @brief The ftyp and moov boxes of the current stream, set by Open and unchanged until the next one.
+     */
+    const EncodedFragment &InitSegment() const;
+
+    /**
+     * @brief The codecs parameter of the stream's MIME type for Media Source Extensions, e.g. "avc1.64001f" or
+     *        "vp09.00.31.08", set by Open.
+     */
+    const std::string &Codec() const;
+
+private:
+    /**
+     * @brief AVIO write callback, appends the muxer output to mPendingBuffer.
+     */
+    static int WriteOutput(void *opaque, const uint8_t *buf, int buf_size);
+
+    /**
+     * @brief Hands the muxer output since the last cut over to a fragment and records its size.
+     */
+    EncodedFragment TakePending(bool init);
+
+    /**
+     * @brief Makes the muxer write the fragment of the frames written so far and queues it.
+     */
+    bool FlushFragment();
+
+    Params mParams; ///< Fragment targets.
+    AVFormatContext *mFormatContext = nullptr; ///< The fMP4 muxer, alive from Open to Close.
+    AVStream *mStream = nullptr; ///< The video stream.
+    AVPacket *mPacket = nullptr; ///< Reference handed to the muxer for each packet.
+    AVRational mCodecTimeBase = { 0, 1 }; ///< Time base of the packets written to the sink.
+    bool mHeaderWritten = false; ///< Whether the init segment was written.
+    AVBufferRef *mPendingBuffer = nullptr; ///< Muxer output since the last cut.
+    size_t mPendingSize = 0; ///< Bytes of mPendingBuffer in use.
+    bool mPendingInit = false; ///< The header is being written.
+    bool mPendingKeyframe = false; ///< The fragment being built starts with a keyframe.
+    int64_t mPendingStartTime = AV_NOPTS_VALUE; ///< Time of the first frame of the fragment being built, in microseconds.
+    FragmentPool mKeyframePool; ///< Buffers for fragments that start with a keyframe.
+    FragmentPool mDeltaPool; ///< Buffers for the other fragments.
+    uint64_t mFragmentCount = 0; ///< Fragments queued since Open.
+    std::string mCodec; ///< MSE codecs parameter of the stream.
+    EncodedFragment mInitSegment; ///< Header of the current stream.
+    int mFragmentFrames = 0; ///< Frames in the fragment being built.
+    int64_t mFragmentDuration = 0; ///< Duration of the fragment being built, in codec time base units.
+    uint64_t mFragmentsDropped = 0; ///< Pieces dropped since Open because mFragments was full.
+    /// Pieces for the consumer. Often drained by the encoding thread itself after each Write, so a full ring drops
+    /// rather than blocks: Open queues one piece (the init segment), each Write and Close at most one fragment.
+    SpscRingBuffer<EncodedFragment> mFragments{ 256, SpscRingBuffer<EncodedFragment>::OverflowPolicy::DropNewest };
+};
+
+/**
+ * @class AnnexBSink
+ * @brief Dumps the raw H.264 elementary stream with start codes, as a .h264 file players and analysers read.
+ *
+ * When the encoder keeps SPS/PPS in its extradata (global header, as MP4 needs), they are written again
+ * before every keyframe, so the dump can be played or cut from any keyframe.
+ */
+class AnnexBSink : public PacketSink
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param path Output file.
+     */
+    explicit AnnexBSink(const std::string &path);
+    ~AnnexBSink() override;
+
+    bool Open(const AVCodecContext *codec) override;
+    bool Write(const AVPacket *packet) override;
+    void Close() override;
+    std::string Name() const override;
+
+private:
+    std::string mPath; ///< Output file.
+    std::ofstream mFile; ///< The open output.
+    std::vector<uint8_t> mHeaders; ///< SPS/PPS in Annex-B form, written before each keyframe.
+};
+
+#endif // PACKETSINK_HPP
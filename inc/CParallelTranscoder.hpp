@@ -0,0 +1,151 @@
+#pragma once
+#ifndef PARALLELTRANSCODER_HPP
+#define PARALLELTRANSCODER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+#include <CEncoderCore.hpp>
+
+/**
+ * @class ParallelTranscoder
+ * @brief Re-encodes a recording by cutting it at keyframes and encoding the pieces on several threads.
+ *
+ * A first pass reads the packet index only (no decoding) and groups whole GOPs into chunks of about the
+ * same number of frames, several per worker so a slow chunk does not leave the other workers idle at the
+ * end. Each worker has its own demuxer and decoder: it seeks to the keyframe a chunk starts on, decodes up
+ * to the next chunk's keyframe and encodes the frames with its own EncoderCore, which starts the chunk
+ * with an IDR frame. The calling thread muxes the chunks in order as they complete. Frames keep their
+ * source timestamps, so the chunks join without gaps or overlaps. Workers stay at most two chunks each
+ * ahead of the muxer, which bounds the memory held by encoded chunks waiting for their turn.
+ *
+ * The chunks must come out with the same codec headers (SPS/PPS), which they do since every chunk is
+ * encoded with the same parameters; Run fails if one does not.
+ */
+class ParallelTranscoder
+{
+public:
+    /**
+     * @struct Params
+     * @brief Transcoding parameters.
+     */
+    struct Params
+    {
+        EncoderCore::Params encoder = EncoderCore::Params(); ///< Output encoding. Width and height 0 keep the input size, fps 0 the input rate.
+        int workers = 0; ///< Worker threads, 0 for one per core.
+        int chunks_per_worker = 4; ///< Chunks to aim for per worker, to balance the load.
+        std::string format; ///< Output container short name, empty to guess it from the output name.
+    };
+
+    /**
+     * @struct Stats
+     * @brief Figures of the last Run.
+     */
+    struct Stats
+    {
+        int workers = 0; ///< Worker threads used.
+        size_t chunks = 0; ///< Chunks the input was cut into.
+        uint64_t frames = 0; ///< Frames encoded.
+        uint64_t bytes = 0; ///< Encoded bytes written.
+        double seconds = 0.0; ///< Wall time, index pass included.
+    };
+
+    ParallelTranscoder() = default;
+    ParallelTranscoder(const ParallelTranscoder&) = delete;
+    ParallelTranscoder& operator=(const ParallelTranscoder&) = delete;
+
+    /**
+     * @brief Transcodes the video stream of a file.
+     *
+     * @param input File to read, e.g. a recording made by FFmpegEncoder.
+     * @param output File to write.
+     * @param params Encoding and threading parameters.
+     * @return true if the whole file was transcoded, false otherwise.
+     */
+    bool Run(const std::string &input, const std::string &output, const Params &params);
+
+    /**
+     * @brief Figures of the last Run.
+     */
+    Stats GetStats() const;
+
+private:
+    /**
+     * @struct Chunk
+     * @brief A run of whole GOPs and, once encoded, its packets.
+     */
+    struct Chunk
+    {
+        int64_t start = AV_NOPTS_VALUE; ///< Timestamp of the keyframe the chunk starts on, in stream time base units.
+        int64_t end = AV_NOPTS_VALUE; ///< Timestamp of the next chunk's keyframe, AV_NOPTS_VALUE for the last chunk.
+        uint64_t frames = 0; ///< Frames encoded.
+        std::vector<AVPacket*> packets; ///< Encoded packets, timestamps in time_base.
+        AVCodecParameters *codecpar = nullptr; ///< Parameters of the chunk's encoder, extradata included.
+        AVRational time_base = { 0, 1 }; ///< Time base of the packets.
+        AVRational framerate = { 0, 1 }; ///< Nominal frame rate of the encoder.
+        bool done = false; ///< Set by the worker when the chunk is encoded or failed.
+        bool ok = false; ///< Whether the chunk was encoded.
+    };
+
+    /**
+     * @struct Input
+     * @brief A demuxer and decoder of the input, one per worker.
+     */
+    struct Input
+    {
+        AVFormatContext *format_context = nullptr; ///< Demuxer.
+        AVCodecContext *decoder = nullptr; ///< Single threaded decoder, the parallelism is across chunks.
+        int stream_index = -1; ///< The video stream.
+        AVPacket *packet = nullptr; ///< Packet read.
+        AVFrame *frame = nullptr; ///< Frame decoded.
+    };
+
+    /**
+     * @brief Opens the input and its video decoder.
+     */
+    static bool OpenInput(const std::string &input, Input &in);
+
+    /**
+     * @brief Releases a demuxer and decoder.
+     */
+    static void CloseInput(Input &in);
+
+    /**
+     * @brief Reads the packet index and cuts the video stream into chunks of whole GOPs.
+     */
+    bool BuildChunks(Input &in, int workers, int chunks_per_worker);
+
+    /**
+     * @brief Worker thread: takes the next chunk until none is left or a chunk failed.
+     */
+    void WorkerLoop(const std::string &input);
+
+    /**
+     * @brief Decodes and encodes one chunk with the worker's input.
+     */
+    bool EncodeChunk(Input &in, Chunk &chunk);
+
+    /**
+     * @brief Releases the packets and parameters of a chunk.
+     */
+    static void FreeChunk(Chunk &chunk);
+
+    EncoderCore::Params mEncoderParams = EncoderCore::Params(); ///< Encoding of every chunk, sizes and rate resolved.
+    std::vector<Chunk> mChunks; ///< Chunks in file order.
+    size_t mNextChunk = 0; ///< Next chunk a worker takes.
+    size_t mWritten = 0; ///< Chunks muxed so far.
+    size_t mWindow = 0; ///< How far ahead of the muxer workers may run, in chunks.
+    bool mFailed = false; ///< A chunk or the muxer failed, workers stop.
+    std::mutex mMutex; ///< Guards the chunk bookkeeping above.
+    std::condition_variable mChanged; ///< Signalled when a chunk is done or muxed.
+    Stats mStats; ///< Figures of the last Run.
+};
+
+#endif // PARALLELTRANSCODER_HPP
@@ -0,0 +1,515 @@
+#pragma once
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <CThreadSafeQueue.hpp>
+#include <CSpscRingBuffer.hpp>
+
+/**
+ * @brief Whether a queue type may be popped from several threads at once.
+ *
+ * Stages with more than one worker thread need a multi-consumer queue.
+ */
+template <typename Queue>
+struct QueueTraits {
+    static const bool multi_consumer = true;
+};
+
+template <typename T>
+struct QueueTraits<SpscRingBuffer<T>> {
+    static const bool multi_consumer = false;
+};
+
+/**
+ * @class PipelineStage
+ * @brief Base class of a stage in a Pipeline.
+ *
+ * A stage runs on its own thread(s), or inline on the thread of the stage that feeds it. Stages are
+ * connected output to input; closing the graph flows downstream: a source stops, its consumers drain
+ * their queues, run their finish step and stop in turn.
+ */
+class PipelineStage {
+public:
+    /**
+     * @brief Where a stage with an input runs.
+     */
+    enum class Threading {
+        Dedicated, ///< Own worker thread(s) fed through the stage's input queue.
+        Inline ///< Directly on the producer's thread, no queue. For cheap steps.
+    };
+
+    /**
+     * @struct Stats
+     * @brief Throughput and queue figures of a stage.
+     */
+    struct Stats {
+        std::string name; ///< Stage name.
+        uint64_t processed = 0; ///< Items consumed (for sources: produce calls that emitted something).
+        uint64_t emitted = 0; ///< Items passed to the connected stages.
+        uint64_t dropped = 0; ///< Items the input queue dropped because it was full.
+        size_t queue_depth = 0; ///< Items currently waiting in the input queue.
+        size_t queue_high_water = 0; ///< Most items ever waiting in the input queue.
+        double busy_seconds = 0.0; ///< Time spent in the stage's processing function.
+        double elapsed_seconds = 0.0; ///< Time from start until the stage finished (or until now).
+    };
+
+    explicit PipelineStage(std::string name) : mName(std::move(name)) {}
+    PipelineStage(const PipelineStage&) = delete;
+    PipelineStage& operator=(const PipelineStage&) = delete;
+    virtual ~PipelineStage() = default;
+
+    /**
+     * @brief Name used in reports.
+     */
+    const std::string& Name() const { return mName; }
+
+    /**
+     * @brief Starts the stage's threads.
+     */
+    virtual void Start() = 0;
+
+    /**
+     * @brief Waits for the stage's threads to finish.
+     */
+    virtual void Join() = 0;
+
+    /**
+     * @brief Asks the stage to stop. Sources stop producing; other stages finish once their input is drained.
+     */
+    void RequestStop() { mStopRequested.store(true); }
+
+    /**
+     * @brief Current throughput and queue figures.
+     */
+    virtual Stats GetStats() const = 0;
+
+protected:
+    void MarkStarted() {
+        mStartTime = std::chrono::steady_clock::now();
+        mRunning.store(true);
+    }
+
+    void MarkFinished() {
+        mEndTime = std::chrono::steady_clock::now();
+        mRunning.store(false);
+    }
+
+    // Fills the counters shared by every stage type.
+    Stats BaseStats() const {
+        Stats stats;
+        stats.name = mName;
+        stats.processed = mProcessed.load();
+        stats.emitted = mEmitted.load();
+        stats.busy_seconds = std::chrono::duration<double>(std::chrono::nanoseconds(mBusyNanoseconds.load())).count();
+        if (mStartTime != std::chrono::steady_clock::time_point()) {
+            auto end = mRunning.load() ? std::chrono::steady_clock::now() : mEndTime;
+            stats.elapsed_seconds = std::chrono::duration<double>(end - mStartTime).count();
+        }
+        return stats;
+    }
+
+    // Times one call of the stage's processing function.
+    template <typename Function>
+    void Timed(Function&& function) {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        mBusyNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    std::atomic<bool> mStopRequested{false}; ///< Set by RequestStop.
+    std::atomic<uint64_t> mProcessed{0}; ///< Items consumed.
+    std::atomic<uint64_t> mEmitted{0}; ///< Items passed downstream.
+    std::atomic<int64_t> mBusyNanoseconds{0}; ///< Time spent processing.
+
+private:
+    std::string mName; ///< Stage name.
+    std::atomic<bool> mRunning{false}; ///< Between MarkStarted and MarkFinished.
+    std::chrono::steady_clock::time_point mStartTime; ///< Time the stage started.
+    std::chrono::steady_clock::time_point mEndTime; ///< Time the stage finished.
+};
+
+/**
+ * @class StageInput
+ * @brief The receiving end of a connection between two stages.
+ */
+template <typename In>
+class StageInput {
+public:
+    virtual ~StageInput() = default;
+
+    /**
+     * @brief Hands an item to the stage.
+     *
+     * @return false if the stage dropped it or is closed.
+     */
+    virtual bool Push(In value) = 0;
+
+    /**
+     * @brief Registers one more producer. The input closes when all of them are done.
+     */
+    virtual void AddProducer() = 0;
+
+    /**
+     * @brief Called by each producer when it will not push any more.
+     */
+    virtual void ProducerDone() = 0;
+};
+
+/**
+ * @class StageOutput
+ * @brief The sending end of a stage, fans items out to every connected input.
+ *
+ * With several consumers every one but the last receives a copy, so Out should be cheap to copy
+ * (VideoFrame copies only add a reference).
+ */
+template <typename Out>
+class StageOutput {
+public:
+    explicit StageOutput(std::atomic<uint64_t>& emitted) : mEmitted(emitted) {}
+
+    /**
+     * @brief Connects this output to a stage input.
+     */
+    void Connect(StageInput<Out>& input) {
+        mConsumers.push_back(&input);
+        input.AddProducer();
+    }
+
+    /**
+     * @brief Passes an item to the connected stages.
+     */
+    void Push(Out value) {
+        if (mConsumers.empty())
+            return;
+        for (size_t i = 0; i + 1 < mConsumers.size(); i++)
+            mConsumers[i]->Push(value);
+        mConsumers.back()->Push(std::move(value));
+        mEmitted.fetch_add(1);
+    }
+
+    /**
+     * @brief Tells every connected stage that no more items will come.
+     */
+    void Done() {
+        for (StageInput<Out>* consumer : mConsumers)
+            consumer->ProducerDone();
+    }
+
+private:
+    std::vector<StageInput<Out>*> mConsumers; ///< Connected inputs, not owned.
+    std::atomic<uint64_t>& mEmitted; ///< Emitted counter of the owning stage.
+};
+
+/**
+ * @class SourceStage
+ * @brief Stage without input that produces items on its own thread, e.g. capture.
+ *
+ * The produce function is called in a loop until it returns false or the stage is asked to stop.
+ */
+template <typename Out>
+class SourceStage : public PipelineStage {
+public:
+    using Produce = std::function<bool(StageOutput<Out>&)>; ///< Emits zero or more items, false to stop.
+    using Finish = std::function<void(StageOutput<Out>&)>; ///< Runs once after the last produce call.
+
+    SourceStage(std::string name, Produce produce, Finish finish = Finish())
+        : PipelineStage(std::move(name)), mProduce(std::move(produce)), mFinish(std::move(finish)), mOutput(mEmitted) {}
+
+    ~SourceStage() override { Join(); }
+
+    StageOutput<Out>& Output() { return mOutput; }
+
+    void Start() override {
+        MarkStarted();
+        mThread = std::thread([this]() {
+            bool more = true;
+            while (more && !mStopRequested.load()) {
+                uint64_t emitted = mEmitted.load();
+                Timed([&]() { more = mProduce(mOutput); });
+                if (mEmitted.load() != emitted)
+                    mProcessed.fetch_add(1);
+            }
+            if (mFinish)
+                mFinish(mOutput);
+            mOutput.Done();
+            MarkFinished();
+        });
+    }
+
+    void Join() override {
+        if (mThread.joinable())
+            mThread.join();
+    }
+
+    Stats GetStats() const override { return BaseStats(); }
+
+private:
+    Produce mProduce; ///< Produces items.
+    Finish mFinish; ///< Optional finish step.
+    StageOutput<Out> mOutput; ///< Connected consumers.
+    std::thread mThread; ///< Producer thread.
+};
+
+/**
+ * @class QueuedStage
+ * @brief Common part of the stages that have an input: the queue, the workers and the shutdown.
+ */
+template <typename In, typename Queue>
+class QueuedStage : public PipelineStage, public StageInput<In> {
+public:
+    /**
+     * @struct Params
+     * @brief Queue and threading of the stage.
+     */
+    struct Params {
+        size_t capacity = 0; ///< Input queue capacity, 0 for unbounded (ThreadSafeQueue only).
+        typename Queue::OverflowPolicy policy = Queue::OverflowPolicy::Block; ///< What a full input queue does.
+        Threading threading = Threading::Dedicated; ///< Own thread(s) or inline on the producer's thread.
+        int workers = 1; ///< Worker threads, more than one needs a multi-consumer queue and gives up ordering.
+    };
+
+    QueuedStage(std::string name, const Params& params)
+        : PipelineStage(std::move(name)), mParams(params),
+          mQueue(params.capacity ? params.capacity : DefaultCapacity(), params.policy) {
+        if (mParams.workers < 1 || !QueueTraits<Queue>::multi_consumer)
+            mParams.workers = 1;
+    }
+
+    ~QueuedStage() override { Join(); }
+
+    bool Push(In value) override {
+        if (mParams.threading == Threading::Inline) {
+            std::lock_guard<std::mutex> lock(mInlineMutex);
+            Consume(value);
+            return true;
+        }
+        return mQueue.push(std::move(value));
+    }
+
+    void AddProducer() override { mProducers.fetch_add(1); }
+
+    void ProducerDone() override {
+        if (mProducers.fetch_sub(1) != 1)
+            return;
+        if (mParams.threading == Threading::Inline) {
+            std::lock_guard<std::mutex> lock(mInlineMutex);
+            Finished();
+            MarkFinished();
+        } else {
+            mQueue.close();
+        }
+    }
+
+    void Start() override {
+        MarkStarted();
+        if (mParams.threading == Threading::Inline)
+            return;
+        if (mProducers.load() == 0)
+            mQueue.close(); // nothing is connected, finish right away
+        mActiveWorkers.store(mParams.workers);
+        for (int i = 0; i < mParams.workers; i++) {
+            mThreads.emplace_back([this]() {
+                In value;
+                while (mQueue.pop(value))
+                    Consume(value);
+                // The last worker out runs the finish step.
+                if (mActiveWorkers.fetch_sub(1) == 1) {
+                    Finished();
+                    MarkFinished();
+                }
+            });
+        }
+    }
+
+    void Join() override {
+        for (std::thread& thread : mThreads) {
+            if (thread.joinable())
+                thread.join();
+        }
+        mThreads.clear();
+    }
+
+    Stats GetStats() const override {
+        Stats stats = BaseStats();
+        auto queueStats = mQueue.stats();
+        stats.dropped = queueStats.dropped;
+        stats.queue_high_water = queueStats.high_water;
+        stats.queue_depth = mQueue.size();
+        return stats;
+    }
+
+protected:
+    // Processes one item, on a worker or on the producer's thread.
+    virtual void Consume(In& value) = 0;
+
+    // Runs once after the last item.
+    virtual void Finished() = 0;
+
+private:
+    static size_t DefaultCapacity() { return QueueTraits<Queue>::multi_consumer ? 0 : 64; }
+
+    Params mParams; ///< Queue and threading parameters.
+    mutable Queue mQueue; ///< Input queue, unused when inline. Mutable for the stats snapshot.
+    std::mutex mInlineMutex; ///< Serializes inline calls from several producers.
+    std::atomic<int> mProducers{0}; ///< Connected producers that are not done yet.
+    std::atomic<int> mActiveWorkers{0}; ///< Workers still running.
+    std::vector<std::thread> mThreads; ///< Worker threads.
+};
+
+/**
+ * @class TransformStage
+ * @brief Stage that turns each input item into zero or more output items, e.g. convert or encode.
+ */
+template <typename In, typename Out, typename Queue = ThreadSafeQueue<In>>
+class TransformStage : public QueuedStage<In, Queue> {
+public:
+    using Params = typename QueuedStage<In, Queue>::Params;
+    using Process = std::function<void(In&, StageOutput<Out>&)>; ///< Emits the outputs for one input.
+    using Finish = std::function<void(StageOutput<Out>&)>; ///< Emits whatever is left after the last input.
+
+    TransformStage(std::string name, Process process, Finish finish = Finish(), const Params& params = Params())
+        : QueuedStage<In, Queue>(std::move(name), params), mProcess(std::move(process)), mFinish(std::move(finish)),
+          mOutput(this->mEmitted) {}
+
+    // Workers must stop before the members they use go away.
+    ~TransformStage() override { this->Join(); }
+
+    StageOutput<Out>& Output() { return mOutput; }
+
+protected:
+    void Consume(In& value) override {
+        this->Timed([&]() { mProcess(value, mOutput); });
+        this->mProcessed.fetch_add(1);
+    }
+
+    void Finished() override {
+        if (mFinish)
+            mFinish(mOutput);
+        mOutput.Done();
+    }
+
+private:
+    Process mProcess; ///< Per item processing.
+    Finish mFinish; ///< Optional finish step.
+    StageOutput<Out> mOutput; ///< Connected consumers.
+};
+
+/**
+ * @class SinkStage
+ * @brief Stage that consumes items without passing anything on, e.g. send or record.
+ */
+template <typename In, typename Queue = ThreadSafeQueue<In>>
+class SinkStage : public QueuedStage<In, Queue> {
+public:
+    using Params = typename QueuedStage<In, Queue>::Params;
+    using Process = std::function<void(In&)>; ///< Consumes one item.
+    using Finish = std::function<void()>; ///< Runs once after the last item.
+
+    SinkStage(std::string name, Process process, Finish finish = Finish(), const Params& params = Params())
+        : QueuedStage<In, Queue>(std::move(name), params), mProcess(std::move(process)), mFinish(std::move(finish)) {}
+
+    // Workers must stop before the members they use go away.
+    ~SinkStage() override { this->Join(); }
+
+protected:
+    void Consume(In& value) override {
+        this->Timed([&]() { mProcess(value); });
+        this->mProcessed.fetch_add(1);
+    }
+
+    void Finished() override {
+        if (mFinish)
+            mFinish();
+    }
+
+private:
+    Process mProcess; ///< Per item processing.
+    Finish mFinish; ///< Optional finish step.
+};
+
+/**
+ * @class Pipeline
+ * @brief Owns a graph of stages, starts them, stops them and reports on them.
+ *
+ * @code
+ * Pipeline pipeline;
+ * auto& capture = pipeline.Add<SourceStage<VideoFrame>>("capture", produce);
+ * auto& encode = pipeline.Add<SinkStage<VideoFrame>>("encode", write, close, params);
+ * pipeline.Connect(capture, encode);
+ * pipeline.Start();
+ * pipeline.Wait();
+ * pipeline.Report(std::cout);
+ * @endcode
+ */
+class Pipeline {
+public:
+    Pipeline() = default;
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    /**
+     * @brief Stops and joins every stage.
+     */
+    ~Pipeline();
+
+    /**
+     * @brief Creates a stage owned by the pipeline.
+     *
+     * @return The new stage, valid for the pipeline's lifetime.
+     */
+    template <typename Stage, typename... Args>
+    Stage& Add(Args&&... args) {
+        std::unique_ptr<Stage> stage(new Stage(std::forward<Args>(args)...));
+        Stage& ref = *stage;
+        mStages.push_back(std::move(stage));
+        return ref;
+    }
+
+    /**
+     * @brief Feeds the output of one stage into the input of another. Connect everything before Start.
+     */
+    template <typename From, typename To>
+    void Connect(From& from, To& to) {
+        from.Output().Connect(to);
+    }
+
+    /**
+     * @brief Starts every stage, consumers first.
+     */
+    void Start();
+
+    /**
+     * @brief Asks every stage to stop. The graph then drains and finishes on its own.
+     */
+    void Stop();
+
+    /**
+     * @brief Waits until every stage has finished.
+     */
+    void Wait();
+
+    /**
+     * @brief Current figures of every stage, in the order they were added.
+     */
+    std::vector<PipelineStage::Stats> GetStats() const;
+
+    /**
+     * @brief Prints throughput, busy share and queue figures of every stage.
+     */
+    void Report(std::ostream& out) const;
+
+private:
+    std::vector<std::unique_ptr<PipelineStage>> mStages; ///< Stages in the order they were added.
+};
+
+#endif // PIPELINE_HPP
@@ -0,0 +1,90 @@
+#pragma once
+#ifndef RATECONTROLLER_HPP
+#define RATECONTROLLER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @class RateController
+ * @brief Steers the bitrate of a live encoder from how far behind its consumers are.
+ *
+ * Two signals mean the stream is more than the path can carry: the bytes waiting in the send buffer of
+ * the slowest client, counted in seconds of video at the current bitrate, and the encoded fragments
+ * waiting for the sender thread. When either is past its limit the bitrate is cut by Params::decrease,
+ * again after each Params::hold_seconds for as long as the backlog is not shrinking. After
+ * Params::increase_after_seconds without congestion it goes back up in small steps, so the rate settles
+ * just under what the link carries (additive increase, multiplicative decrease).
+ * Not thread safe: call it from the thread that sends the fragments.
+ */
+class RateController
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * @struct Params
+     * @brief Limits and thresholds.
+     */
+    struct Params
+    {
+        uint32_t min_bitrate = 100000; ///< Lowest bitrate in bits per second.
+        uint32_t max_bitrate = 2000000; ///< Highest bitrate in bits per second.
+        double max_backlog_seconds = 0.5; ///< Client backlog, in seconds at the current bitrate, that counts as congestion.
+        double calm_backlog_seconds = 0.1; ///< Client backlog under which the link counts as keeping up.
+        size_t max_queue_depth = 8; ///< Fragments waiting for the sender that count as congestion.
+        double decrease = 0.75; ///< Factor applied to the bitrate on congestion.
+        double increase = 0.05; ///< Share of max_bitrate added at each step up.
+        double hold_seconds = 1.0; ///< Least time between two changes, for the last one to show in the backlog.
+        double increase_after_seconds = 3.0; ///< Time without congestion before the next step up.
+    };
+
+    /**
+     * @brief Constructor with the default limits.
+     *
+     * @param bitrate Starting bitrate in bits per second, clamped to the limits.
+     */
+    explicit RateController(uint32_t bitrate);
+
+    /**
+     * @brief Constructor.
+     *
+     * @param bitrate Starting bitrate in bits per second, clamped to the limits.
+     * @param params Limits and thresholds.
+     */
+    RateController(uint32_t bitrate, const Params &params);
+
+    /**
+     * @brief Starts over at a bitrate.
+     */
+    void Reset(uint32_t bitrate, Clock::time_point now);
+
+    /**
+     * @brief Feeds the current backlogs and returns the bitrate the encoder should use.
+     *
+     * @param now Current time.
+     * @param backlog Bytes waiting in the send buffer of the slowest client.
+     * @param queue_depth Encoded fragments waiting for the sender.
+     * @return The new bitrate, or the current one.
+     */
+    uint32_t Update(Clock::time_point now, size_t backlog, size_t queue_depth);
+
+    uint32_t Bitrate() const { return mBitrate; } ///< Current bitrate.
+    uint64_t Changes() const { return mChanges; } ///< Bitrate changes since Reset.
+
+private:
+    /**
+     * @brief Moves to a bitrate within the limits and restarts the hold period.
+     */
+    void ChangeTo(double bitrate, Clock::time_point now);
+
+    Params mParams; ///< Limits and thresholds.
+    uint32_t mBitrate = 0; ///< Current bitrate.
+    Clock::time_point mChangeTime; ///< Last change, or Reset.
+    Clock::time_point mCalmSince; ///< Since when the link keeps up.
+    size_t mChangeBacklog = 0; ///< Client backlog at the last change.
+    uint64_t mChanges = 0; ///< Bitrate changes.
+};
+
+#endif // RATECONTROLLER_HPP
@@ -0,0 +1,53 @@
+#pragma once
+#ifndef RENDITION_HPP
+#define RENDITION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <CEncodedFragment.hpp>
+
+/**
+ * @struct Rendition
+ * @brief One tier of the live ABR ladder: a size and a bitrate the capture is encoded at.
+ */
+struct Rendition
+{
+    uint32_t width = 1280; ///< Frame width.
+    uint32_t height = 720; ///< Frame height.
+    uint32_t bitrate = 400000; ///< Bitrate in bits per second.
+
+    /**
+     * @brief Short name for logs and stage names, e.g. "720p".
+     */
+    std::string Name() const;
+
+    /**
+     * @brief Parses a ladder such as "1920x1080@4000,1280x720@1500,640x360@400" (bitrates in kbit/s).
+     *
+     * The tiers are sorted by bitrate, lowest first, so tier 0 is always the safest one. Malformed
+     * entries are reported and skipped.
+     *
+     * @param ladder Comma separated WIDTHxHEIGHT@KBPS entries.
+     * @return The tiers, empty if none could be read.
+     */
+    static std::vector<Rendition> Parse(const std::string &ladder);
+
+    /**
+     * @brief Reads the ladder from LIVE_RENDITIONS, falling back to a single 1280x720 tier at 400 kbit/s.
+     */
+    static std::vector<Rendition> FromEnvironment();
+};
+
+/**
+ * @struct RenditionFragment
+ * @brief A piece of one tier's fMP4 stream, on its way from that tier's encoder to the socket.
+ */
+struct RenditionFragment
+{
+    size_t tier = 0; ///< Index of the tier in the ladder.
+    EncodedFragment fragment; ///< The init segment or moof/mdat fragment.
+};
+
+#endif // RENDITION_HPP
@@ -0,0 +1,302 @@
+#ifndef SPSCRINGBUFFER_HPP
+#define SPSCRINGBUFFER_HPP
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <condition_variable>
+/**
+ * @class SpscRingBuffer
+ * @brief Lock-free ring buffer for exactly one producer thread and one consumer thread.
+ *
+ * push and pop only touch two atomic indices, each on its own cache line, and each side keeps a cached
+ * copy of the other side's index so the shared line is read only when the ring looks full or empty.
+ * Blocking calls spin briefly, then yield, then sleep on a condition variable; the mutex is only taken
+ * by a thread that is about to sleep or by the other side when it sees a sleeper.
+ *
+ * The interface mirrors ThreadSafeQueue so the two can be swapped for a single producer/consumer
+ * hand-off. Dropping the oldest element is not offered: only the consumer may remove elements.
+ *
+ * @tparam T The type of elements stored in the ring. Must be default constructible and movable;
+ *           popped slots are reset to T() so resources are released at pop time.
+ */
+template <typename T>
+class SpscRingBuffer {
+public:
+    /**
+     * @brief What push does when the ring is full.
+     */
+    enum class OverflowPolicy {
+        Block, ///< Wait until the consumer makes room (or the ring is closed).
+        DropNewest ///< Discard the pushed element.
+    };
+
+    /**
+     * @struct Stats
+     * @brief Counters kept since the ring was created.
+     */
+    struct Stats {
+        uint64_t pushed = 0; ///< Elements accepted by push.
+        uint64_t popped = 0; ///< Elements handed to the consumer.
+        uint64_t dropped = 0; ///< Elements discarded because the ring was full.
+        size_t high_water = 0; ///< Largest number of elements queued at once, as seen by the producer (an upper bound).
+    };
+
+    /**
+     * @brief Creates a ring.
+     *
+     * @param capacity Minimum number of elements the ring holds, rounded up to a power of two.
+     * @param policy What push does when the ring is full.
+     */
+    explicit SpscRingBuffer(size_t capacity, OverflowPolicy policy = OverflowPolicy::Block)
+        : policy_(policy) {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    SpscRingBuffer(const SpscRingBuffer&) = delete;
+    SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+    /**
+     * @brief Pushes a value. Producer thread only.
+     *
+     * @param value The value to be pushed into the ring.
+     * @return true if the value was queued, false if it was dropped or the ring is closed.
+     */
+    bool push(T value) {
+        const uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head - producer_tail_ > mask_) {
+            producer_tail_ = tail_.load(std::memory_order_acquire);
+            if (head - producer_tail_ > mask_) {
+                if (policy_ == OverflowPolicy::DropNewest) {
+                    dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    return false;
+                }
+                wait([&] {
+                    producer_tail_ = tail_.load(std::memory_order_acquire);
+                    return closed_.load(std::memory_order_acquire) || head - producer_tail_ <= mask_;
+                });
+            }
+        }
+        if (closed_.load(std::memory_order_acquire))
+            return false;
+
+        slots_[head & mask_] = std::move(value);
+        head_.store(head + 1, std::memory_order_release);
+        wake();
+
+        size_t queued = static_cast<size_t>(head + 1 - producer_tail_);
+        if (queued > high_water_.load(std::memory_order_relaxed))
+            high_water_.store(queued, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief Pops a value if one is queued, without waiting. Consumer thread only.
+     *
+     * @param value Reference to the variable where the popped value will be stored.
+     * @return true if a value was popped.
+     */
+    bool try_pop(T& value) {
+        const uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == consumer_head_) {
+            consumer_head_ = head_.load(std::memory_order_acquire);
+            if (tail == consumer_head_)
+                return false;
+        }
+
+        T& slot = slots_[tail & mask_];
+        value = std::move(slot);
+        slot = T();
+        tail_.store(tail + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    /**
+     * @brief Pops a value, waiting until one is queued or the ring is closed. Consumer thread only.
+     *
+     * @param value Reference to the variable where the popped value will be stored.
+     * @return true if a value was popped, false if the ring is closed and empty.
+     */
+    bool pop(T& value) {
+        while (!try_pop(value)) {
+            if (closed_.load(std::memory_order_acquire))
+                return try_pop(value);
+            wait([this] { return readable(); });
+        }
+        return true;
+    }
+
+    /**
+     * @brief Pops a value, waiting at most the given time for one to arrive. Consumer thread only.
+     *
+     * @param value Reference to the variable where the popped value will be stored.
+     * @param timeout Longest time to wait.
+     * @return true if a value was popped, false on timeout or if the ring is closed and empty.
+     */
+    template <typename Rep, typename Period>
+    bool pop_for(T& value, const std::chrono::duration<Rep, Period>& timeout) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!try_pop(value)) {
+            if (closed_.load(std::memory_order_acquire))
+                return try_pop(value);
+            if (!wait([this] { return readable(); }, deadline))
+                return try_pop(value);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Pops up to max_count values, waiting until at least one is queued. Consumer thread only.
+     *
+     * @param values Receives the popped values, appended in queue order.
+     * @param max_count Largest number of values to pop.
+     * @return Number of values popped, 0 if the ring is closed and empty.
+     */
+    size_t pop_n(std::vector<T>& values, size_t max_count) {
+        if (!max_count)
+            return 0;
+        T value;
+        if (!pop(value))
+            return 0;
+        values.push_back(std::move(value));
+        size_t count = 1;
+        while (count < max_count && try_pop(value)) {
+            values.push_back(std::move(value));
+            count++;
+        }
+        return count;
+    }
+
+    /**
+     * @brief Closes the ring and wakes a waiting producer or consumer.
+     *
+     * Elements already queued can still be popped. Safe to call from any thread.
+     */
+    void close() {
+        closed_.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        wait_cv_.notify_all();
+    }
+
+    /**
+     * @brief Opens a closed ring again. Only while neither side is using it.
+     */
+    void reopen() {
+        closed_.store(false, std::memory_order_release);
+    }
+
+    /**
+     * @brief Checks if the ring has been closed.
+     */
+    bool closed() const {
+        return closed_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Checks if the ring is empty. Exact only when called by the consumer.
+     */
+    bool empty() const {
+        return size() == 0;
+    }
+
+    /**
+     * @brief Number of queued elements, a snapshot when called from a third thread.
+     */
+    size_t size() const {
+        const uint64_t tail = tail_.load(std::memory_order_acquire);
+        return static_cast<size_t>(head_.load(std::memory_order_acquire) - tail);
+    }
+
+    /**
+     * @brief Number of elements the ring holds.
+     */
+    size_t capacity() const {
+        return mask_ + 1;
+    }
+
+    /**
+     * @brief Snapshot of the push/pop/drop counters.
+     */
+    Stats stats() const {
+        Stats stats;
+        stats.popped = tail_.load(std::memory_order_acquire);
+        stats.pushed = head_.load(std::memory_order_acquire);
+        stats.dropped = dropped_.load(std::memory_order_relaxed);
+        stats.high_water = high_water_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    bool readable() {
+        consumer_head_ = head_.load(std::memory_order_acquire);
+        return closed_.load(std::memory_order_acquire) || consumer_head_ != tail_.load(std::memory_order_relaxed);
+    }
+
+    // Spins, then yields, then sleeps until ready() holds or the deadline passes. Returns ready().
+    template <typename Ready>
+    bool wait(Ready ready, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max()) {
+        for (int i = 0; i < kSpinCount; i++) {
+            if (ready())
+                return true;
+        }
+        for (int i = 0; i < kYieldCount; i++) {
+            if (ready())
+                return true;
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock(wait_mutex_);
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in wake()
+        bool result = ready();
+        while (!result && std::chrono::steady_clock::now() < deadline) {
+            // The timeout only bounds a missed wake-up, wake() normally ends the wait.
+            auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+            wait_cv_.wait_until(lock, until < deadline ? until : deadline);
+            result = ready();
+        }
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+        return result;
+    }
+
+    // Called after publishing an index: wakes the other side if it went to sleep.
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(wait_mutex_);
+            wait_cv_.notify_all();
+        }
+    }
+
+    static constexpr int kSpinCount = 256; ///< Busy checks before yielding.
+    static constexpr int kYieldCount = 16; ///< Yielding checks before sleeping.
+    static constexpr size_t kCacheLine = 64; ///< Alignment of the producer, consumer and shared fields.
+
+    // Each side's fields start a cache line of their own, so the producer and consumer never write to the
+    // same line; the ring's own alignment keeps neighbouring objects off them too.
+    alignas(kCacheLine) std::atomic<uint64_t> head_{0}; ///< Next slot to write, written by the producer.
+    uint64_t producer_tail_ = 0; ///< Producer's cached copy of tail_.
+    std::atomic<uint64_t> dropped_{0}; ///< Elements dropped by push, written by the producer.
+    std::atomic<size_t> high_water_{0}; ///< Largest queue size seen by push, written by the producer.
+
+    alignas(kCacheLine) std::atomic<uint64_t> tail_{0}; ///< Next slot to read, written by the consumer.
+    uint64_t consumer_head_ = 0; ///< Consumer's cached copy of head_.
+
+    alignas(kCacheLine) std::atomic<bool> closed_{false}; ///< Set by close().
+    std::atomic<int> waiters_{0}; ///< Threads sleeping on wait_cv_.
+    std::mutex wait_mutex_; ///< Only taken to sleep or to wake a sleeper.
+    std::condition_variable wait_cv_; ///< Sleeping producer or consumer.
+
+    std::vector<T> slots_; ///< Ring storage, a power of two in size.
+    size_t mask_ = 0; ///< Capacity minus one.
+    OverflowPolicy policy_ = OverflowPolicy::Block; ///< What push does when the ring is full.
+};
+#endif
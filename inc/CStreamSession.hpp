@@ -0,0 +1,142 @@
+#pragma once
+#ifndef STREAMSESSION_HPP
+#define STREAMSESSION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <CAbrController.hpp>
+#include <CEncodedFragment.hpp>
+#include <CRendition.hpp>
+
+/**
+ * @struct TierCache
+ * @brief What a session joining or switching to a tier needs: the tier's init segment and its fragments since the last keyframe.
+ */
+struct TierCache
+{
+    Rendition rendition; ///< Size and bitrate.
+    EncodedFragment init; ///< Init segment of the tier's stream.
+    std::vector<EncodedFragment> gop; ///< Fragments since the tier's last keyframe, starting with it.
+
+    /**
+     * @brief Keeps a piece of the tier's stream. A GOP longer than the cache is dropped whole, since a
+     * session started from its head would miss the tail; sessions then wait for the next keyframe.
+     *
+     * @param fragment The init segment or fragment.
+     */
+    void Add(const EncodedFragment &fragment);
+
+    /**
+     * @brief Whether a session can start on the tier right away.
+     *
+     * @param resume_time Earliest keyframe time to start from, AV_NOPTS_VALUE for any.
+     */
+    bool CanStart(int64_t resume_time) const;
+};
+
+/**
+ * @class StreamSession
+ * @brief Per-connection state of a client served from the rendition ladder.
+ *
+ * A session starts by replaying its tier's cache: the init segment, then the fragments since the last
+ * keyframe, after which it follows the live stream. A late joiner so starts at once, from the keyframe
+ * the encoder already produced, instead of waiting for the next one. At a keyframe of its tier the
+ * session can move to the target tier picked by its AbrController or pinned by the client, replaying
+ * the target's cache from the keyframe of the same instant.
+ * Not thread safe: the socket calls it under its lock.
+ */
+class StreamSession
+{
+public:
+    /**
+     * @class Transport
+     * @brief Where a session writes to, a websocket connection in VideoStreamSocket.
+     */
+    class Transport
+    {
+    public:
+        virtual ~Transport() = default;
+
+        /**
+         * @brief Sends a fragment.
+         *
+         * @param fragment The init segment or fragment.
+         * @param buffered Receives the bytes still waiting in the connection's buffer.
+         * @return false if the connection is gone.
+         */
+        virtual bool Send(const EncodedFragment &fragment, size_t &buffered) = 0;
+    };
+
+    /**
+     * @brief Constructor. The session starts on the lowest tier, with its controller picking the next.
+     *
+     * @param bitrates Bitrate of each tier in bits per second, lowest first.
+     */
+    explicit StreamSession(const std::vector<uint32_t> &bitrates);
+
+    /**
+     * @brief Starts the session from its tier's cache if it holds an init segment and a keyframe.
+     *
+     * @param tiers The ladder's caches.
+     * @param transport The session's connection.
+     * @return false if the connection is gone.
+     */
+    bool Start(const std::vector<TierCache> &tiers, Transport &transport);
+
+    /**
+     * @brief Handles a fragment of one tier, after the tier's cache took it.
+     *
+     * @param tiers The ladder's caches.
+     * @param tier Index of the fragment's tier.
+     * @param fragment The fragment.
+     * @param transport The session's connection.
+     * @return false if the connection is gone.
+     */
+    bool Deliver(const std::vector<TierCache> &tiers, size_t tier, const EncodedFragment &fragment, Transport &transport);
+
+    /**
+     * @brief Pins the session to a tier, taken at its next keyframe or right away before the session started.
+     *
+     * @param tier Index of the tier, clamped to the ladder.
+     * @param tiers Number of tiers.
+     */
+    void SetTier(size_t tier, size_t tiers);
+
+    /**
+     * @brief Hands the tier choice back to the controller.
+     */
+    void SetAutomatic(AbrController::Clock::time_point now);
+
+    /**
+     * @brief Starts the session over at its tier's next keyframe, with the init segment first, for a client that lost the stream.
+     */
+    void Resync();
+
+    size_t Tier() const { return mTier; } ///< Tier the session is served from.
+    bool Started() const { return mStarted; } ///< Whether the session got its tier's init segment and a keyframe.
+    size_t Buffered() const { return mBuffered; } ///< Bytes waiting in the connection's buffer after the last send.
+
+private:
+    /**
+     * @brief Sends a tier's init segment and cached GOP, then marks the session started.
+     */
+    bool CatchUp(const TierCache &cache, Transport &transport);
+
+    /**
+     * @brief Sends a fragment and lets the controller pick the next tier.
+     */
+    bool Send(const EncodedFragment &fragment, Transport &transport);
+
+    size_t mTier = 0; ///< Tier the session is served from.
+    size_t mTarget = 0; ///< Tier to move to at the next keyframe.
+    bool mStarted = false; ///< Whether the session got the init segment and a keyframe of its tier.
+    bool mAutomatic = true; ///< Whether mAbr picks the target.
+    int64_t mResumeTime = AV_NOPTS_VALUE; ///< Earliest keyframe to start from after a switch or resync, in microseconds.
+    int64_t mLastTime = AV_NOPTS_VALUE; ///< Start time of the last fragment sent.
+    uint64_t mBytesSent = 0; ///< Bytes handed to the connection.
+    size_t mBuffered = 0; ///< Bytes waiting in the connection's buffer after the last send.
+    AbrController mAbr; ///< Throughput based tier selection.
+};
+
+#endif // STREAMSESSION_HPP
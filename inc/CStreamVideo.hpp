@@ -4,6 +4,10 @@
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
 
 
 extern "C"{
@@ -12,13 +16,15 @@ extern "C"{
 }
 #include <CThreadSafeQueue.hpp>
 #include<CObserver.hpp>
+#include <CFrameSource.hpp>
+#include <CCaptureSession.hpp>
+#include <CVideoFrame.hpp>
+#include <CPipeline.hpp>
+#include <CFrameConverter.hpp>
+#include <CFrameBus.hpp>
+#include <CEncoderCore.hpp>
 
 
-struct Box {
-    uint32_t size;
-    std::string type;
-    std::vector<uint8_t> data;
-};
 class VideoCaptureGUI;
 
 
@@ -32,24 +38,72 @@ class VideoCaptureGUI;
 class videoStream
 {
     /**
-     * @brief Open and initialize the camera using ffmpeg APIs.
+     * @brief Open and initialize the configured frame source using ffmpeg APIs.
      *
-     * This method sets up the camera for capturing video frames.
-     * @return true if the camera was successfully initialized, false otherwise.
+     * This method creates the frame source selected with setFrameSource (the webcam by default)
+     * and sets it up for capturing video frames.
+     * @return true if the source was successfully initialized, false otherwise.
      */
     bool initializeCamera();
 
     /**
-     * @brief Capture a single frame of video data.
+     * @brief Capture a single decoded frame for the encoder.
+     *
+     * In native capture mode the decoded frame is returned by reference in the camera's own pixel format,
+     * so the encoder can take it without any conversion when the formats match. In RGB mode the frame is
+     * converted to RGB24 into a pooled buffer first. The handle carries the capture time and the pts in
+     * the frame source time base. When the source reaches its end, recording is stopped.
+     *
+     * @return The captured frame, or an empty handle when capture stopped.
+     */
+    VideoFrame getFrame();
+
+    /**
+     * @brief Publish a captured frame to the observers. Each one gets it converted to what it subscribed with.
+     *
+     * @param frame The captured frame.
+     */
+    void previewFrame(const VideoFrame& frame);
+
+    /**
+     * @brief Adds the capture stage to a pipeline.
+     *
+     * The stage reads frames with getFrame, previews them and passes them on until recording stops or the
+     * source ends, then releases the camera.
+     *
+     * @param pipeline The pipeline to add the stage to.
+     * @return The capture stage, to connect consumers to.
+     */
+    SourceStage<VideoFrame>& addCaptureStage(Pipeline& pipeline);
+
+    /**
+     * @brief Adds a stage that converts captured frames to the encoder's format and size.
      *
-     * After initializing the camera, this method allocates memory for a frame, reads the frame data,
-     * stores it in a char buffer, and returns the buffer containing the single frame data.
+     * Running the conversion as its own stage lets frame N+1 be converted while frame N is encoded. The
+     * conversion itself is split into slices over SCALER_THREADS threads. Frames that already match are
+     * passed through untouched.
      *
-     * @param width Reference to an integer where the frame width will be stored.
-     * @param height Reference to an integer where the frame height will be stored.
-     * @return A char buffer containing the frame data.
+     * @param pipeline The pipeline to add the stage to.
+     * @param format Encoder pixel format.
+     * @param width Encoder width.
+     * @param height Encoder height.
+     * @param name Stage name in the pipeline report.
+     * @return The convert stage.
+     */
+    TransformStage<VideoFrame, VideoFrame>& addConvertStage(Pipeline& pipeline, AVPixelFormat format, int width, int height,
+                                                           const std::string& name = "convert");
+
+    /**
+     * @brief Attaches the EXTRA_SINKS targets to an open encoder, so they get the same packets without a second encode.
+     *
+     * @param core The encoder to attach the sinks to.
+     */
+    void addExtraSinks(EncoderCore& core);
+
+    /**
+     * @brief Input queue parameters for stages fed with captured frames (FRAME_QUEUE_SIZE, FRAME_QUEUE_POLICY).
      */
-    unsigned char* getFrameData(int& width, int& height);
+    QueuedStage<VideoFrame, ThreadSafeQueue<VideoFrame>>::Params frameStageParams() const;
 
     /**
      * @brief Listen for a key press to control the exit or end of life of the program.
@@ -64,16 +118,12 @@ class videoStream
      * This method releases any resources that were allocated for the camera.
      */
     void cleanupCamera();
-    /**
-        @brief Function to filter atoms from a given packet
-        @param packet: A vector containing the atoms to be filtered
-        @return: A vector containing the filtered atoms
-     */
-    std::vector<uint8_t> filterAtoms(const std::vector<uint8_t>& packet);
 
 public:
 
     std::atomic<bool> m_recording{false}; ///< boolean to indicate recording status
+    std::atomic<uint64_t> m_framesCaptured{0}; ///< number of frames captured since construction
+    std::atomic<int64_t> m_lastCaptureTime{AV_NOPTS_VALUE}; ///< Timestamp of the newest captured frame in microseconds, the encoders' timeline.
     /**
      * @brief Constructor for the videoStream class.
      *
@@ -95,29 +145,67 @@ public:
     /**
      * @brief Sets the observer for the video stream.
      * 
-     * This function assigns an observer to the video stream, which will be notified of various events.
+     * This function subscribes an observer to the captured frames, in RGB24 or in a YUV format
+     * ColorConvert::ToBGRPreview handles. It is called on its own thread with the latest frame.
      * 
      * @param observer A pointer to the Observer object to be set.
      */
-    void setObserver(Observer* observer) {
-    m_observer = observer;
+    void setObserver(Observer* observer);
+
+    /**
+     * @brief Subscribes an observer to the captured frames with its own format and size.
+     *
+     * @param observer The observer, which must stay alive until removeObserver.
+     * @param params The format, size and name of the subscription.
+     */
+    void addObserver(Observer* observer, const FrameBus::Params& params) {
+        m_frameBus.Subscribe(observer, params);
+    }
+
+    /**
+     * @brief Unsubscribes an observer, waiting for a delivery in progress to finish.
+     */
+    void removeObserver(Observer* observer) {
+        m_frameBus.Unsubscribe(observer);
+    }
+
+    /**
+     * @brief Selects the frame source used by the next capture.
+     *
+     * By default the source is read from the environment (see FrameSource::FromEnvironment),
+     * which falls back to the webcam.
+     *
+     * @param kind Frame source backend, "webcam", "file" or "testsrc".
+     * @param params Parameters the source is opened with.
+     */
+    void setFrameSource(const std::string& kind, const FrameSource::Params& params) {
+        m_frameSourceKind = kind;
+        m_frameSourceParams = params;
+    }
+
+    /**
+     * @brief Selects between native and RGB capture.
+     *
+     * Native capture (the default, CAPTURE_FORMAT=native) hands decoded frames to the encoder as they are
+     * and only produces RGB for the preview observer. RGB capture (CAPTURE_FORMAT=rgb) converts every
+     * frame to RGB24 before encoding.
+     *
+     * @param native true for native capture, false for RGB capture.
+     */
+    void setNativeCapture(bool native) {
+        m_nativeCapture = native;
     }
 
     /**
-     * @brief Notifies the observer with the provided video frame data.
+     * @brief Notifies the observers with the provided video frame.
      *
-     * This function is called to update the observer with new video frame data.
-     * If an observer is registered, it will call the observer's update method
-     * with the provided frame data, width, and height.
+     * The frame is published on the frame bus and this call returns at once; every observer is updated
+     * on its own thread, with the frame converted to the format and size it subscribed with.
      *
-     * @param data Pointer to the video frame data.
-     * @param width Width of the video frame.
-     * @param height Height of the video frame.
+     * @param frame The video frame.
      */
-    void notifyObserver(unsigned char* data, uint32_t width, uint32_t height) {
-        if (m_observer) {
-            m_observer->update(data, width, height);
-        }
+    void notifyObserver(const VideoFrame& frame) {
+        m_frameBus.Publish(frame);
     }
 
     /**
@@ -142,6 +230,8 @@ public:
      *
      * This function captures live video data, processes it, and transmits the video feed to a connected client.
      * It handles the entire process of capturing, encoding, and sending the video stream.
+     * With several tiers in LIVE_RENDITIONS, each captured frame is scaled once per tier and every tier is
+     * encoded on its own thread, with keyframes forced at the same instants so clients can switch between them.
      *
      * @return void
      */
@@ -155,11 +245,17 @@ public:
      */
     ~videoStream();
     private:
-    bool m_initialization_sent = false; ///< boolean to check if initialization is sent already.
-    AVFormatContext* m_formatContext{nullptr}; ///< Pointer variable for video format context.
-    AVCodecContext* m_decoderContext{nullptr}; ///< Pointer variable for decoder format context.
-    int m_videoStreamIndex = 0; ///< Integer for video stream index.
-    Observer *m_observer = nullptr;  ///< @brief Pointer to an Observer object.
+    std::string m_frameSourceKind; ///< Name of the frame source backend.
+    FrameSource::Params m_frameSourceParams; ///< Parameters for opening the frame source.
+    std::unique_ptr<FrameSource> m_frameSource; ///< Frame source frames are captured from.
+    AVFrame* m_decodedFrame{nullptr}; ///< Frame reused for every decoded picture.
+    int64_t m_captureOrigin = AV_NOPTS_VALUE; ///< pts of the first captured frame; frames are stamped from it so every encoder shares one timeline.
+    CaptureSession m_captureSession; ///< Cached conversion contexts and pooled RGB buffers.
+    bool m_nativeCapture = true; ///< Pass decoded frames to the encoder without the RGB round trip.
+    size_t m_frameQueueSize = 4; ///< Frames that may wait for the encoder before the overflow policy applies.
+    ThreadSafeQueue<VideoFrame>::OverflowPolicy m_frameQueuePolicy = ThreadSafeQueue<VideoFrame>::OverflowPolicy::DropOldest; ///< What capture does when the encoder falls behind.
+    FrameBus m_frameBus; ///< Delivers captured frames to the observers.
+    std::vector<std::string> m_extraSinks; ///< Targets (file, .h264 dump or URL) every encoder also writes to.
 
 };
 #endif
\ No newline at end of file
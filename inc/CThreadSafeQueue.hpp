@@ -1,8 +1,12 @@
-
 #ifndef THREADSAFEQUEUE_HPP
 #define THREADSAFEQUEUE_HPP
 #include <queue>
 #include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <condition_variable>
 /**
  * @class ThreadSafeQueue
  * @brief A thread-safe queue implementation using a mutex and condition variable.
@@ -10,40 +14,173 @@
  * This class provides a thread-safe queue that allows multiple threads to push and pop elements
  * concurrently. It ensures that access to the queue is synchronized using a mutex and condition variable.
  *
+ * The queue can be bounded: once it holds capacity elements, push either blocks, drops the oldest
+ * element or drops the new one, depending on the overflow policy. close() wakes every waiting thread;
+ * after it, push fails and pop drains the remaining elements and then returns false.
+ *
  * @tparam T The type of elements stored in the queue.
  */
 
 template <typename T>
 class ThreadSafeQueue {
 public:
+    /**
+     * @brief What push does when a bounded queue is full.
+     */
+    enum class OverflowPolicy {
+        Block, ///< Wait until a consumer makes room (or the queue is closed).
+        DropOldest, ///< Discard the front element to make room, keeps latency low.
+        DropNewest ///< Discard the pushed element, keeps what is already queued.
+    };
+
+    /**
+     * @struct Stats
+     * @brief Counters kept since the queue was created.
+     */
+    struct Stats {
+        uint64_t pushed = 0; ///< Elements accepted by push.
+        uint64_t popped = 0; ///< Elements handed to consumers.
+        uint64_t dropped = 0; ///< Elements discarded because the queue was full.
+        size_t high_water = 0; ///< Largest number of elements queued at once.
+    };
+
+    /**
+     * @brief Creates a queue.
+     *
+     * @param capacity Maximum number of queued elements, 0 for unbounded.
+     * @param policy What push does when the queue is full.
+     */
+    explicit ThreadSafeQueue(size_t capacity = 0, OverflowPolicy policy = OverflowPolicy::Block)
+        : capacity_(capacity), policy_(policy) {}
+
     /**
      * @brief Pushes a value into the queue.
      *
      * This method locks the mutex, pushes the value into the queue, and notifies one waiting thread.
+     * When the queue is full the overflow policy decides whether to wait, drop the oldest element or
+     * drop this one.
      *
      * @param value The value to be pushed into the queue.
+     * @return true if the value was queued, false if it was dropped or the queue is closed.
      */
-    void push(T value) {
-        std::lock_guard<std::mutex> lock(mutex_);
+    bool push(T value) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (closed_)
+            return false;
+
+        if (capacity_ && queue_.size() >= capacity_) {
+            switch (policy_) {
+            case OverflowPolicy::Block:
+                not_full_.wait(lock, [this] { return closed_ || queue_.size() < capacity_; });
+                if (closed_)
+                    return false;
+                break;
+            case OverflowPolicy::DropOldest:
+                queue_.pop();
+                stats_.dropped++;
+                break;
+            case OverflowPolicy::DropNewest:
+                stats_.dropped++;
+                return false;
+            }
+        }
+
         queue_.push(std::move(value));
+        stats_.pushed++;
+        if (queue_.size() > stats_.high_water)
+            stats_.high_water = queue_.size();
         cond_var_.notify_one();
+        return true;
     }
 
     /**
      * @brief Pops a value from the queue.
      *
-     * This method locks the mutex and waits until the queue is not empty. It then pops the front value
-     * from the queue and assigns it to the provided reference.
+     * This method locks the mutex and waits until the queue is not empty or closed. It then pops the front
+     * value from the queue and assigns it to the provided reference.
      *
      * @param value Reference to the variable where the popped value will be stored.
-     * @return true if a value was successfully popped from the queue.
+     * @return true if a value was popped, false if the queue is closed and empty.
      */
     bool pop(T& value) {
         std::unique_lock<std::mutex> lock(mutex_);
-        cond_var_.wait(lock, [this] { return !queue_.empty(); });
-        value = std::move(queue_.front());
-        queue_.pop();
-        return true;
+        cond_var_.wait(lock, [this] { return closed_ || !queue_.empty(); });
+        return take(value);
+    }
+
+    /**
+     * @brief Pops a value if one is queued, without waiting.
+     *
+     * @param value Reference to the variable where the popped value will be stored.
+     * @return true if a value was popped.
+     */
+    bool try_pop(T& value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return take(value);
+    }
+
+    /**
+     * @brief Pops a value, waiting at most the given time for one to arrive.
+     *
+     * @param value Reference to the variable where the popped value will be stored.
+     * @param timeout Longest time to wait.
+     * @return true if a value was popped, false on timeout or if the queue is closed and empty.
+     */
+    template <typename Rep, typename Period>
+    bool pop_for(T& value, const std::chrono::duration<Rep, Period>& timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_var_.wait_for(lock, timeout, [this] { return closed_ || !queue_.empty(); });
+        return take(value);
+    }
+
+    /**
+     * @brief Pops up to max_count values in one go, waiting until at least one is queued.
+     *
+     * @param values Receives the popped values, appended in queue order.
+     * @param max_count Largest number of values to pop.
+     * @return Number of values popped, 0 if the queue is closed and empty.
+     */
+    size_t pop_n(std::vector<T>& values, size_t max_count) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_var_.wait(lock, [this] { return closed_ || !queue_.empty(); });
+        size_t count = 0;
+        while (count < max_count && !queue_.empty()) {
+            values.push_back(std::move(queue_.front()));
+            queue_.pop();
+            count++;
+        }
+        stats_.popped += count;
+        if (count)
+            not_full_.notify_all();
+        return count;
+    }
+
+    /**
+     * @brief Closes the queue and wakes every waiting producer and consumer.
+     *
+     * Elements already queued can still be popped.
+     */
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        cond_var_.notify_all();
+        not_full_.notify_all();
+    }
+
+    /**
+     * @brief Opens a closed queue again so it can be reused.
+     */
+    void reopen() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = false;
+    }
+
+    /**
+     * @brief Checks if the queue has been closed.
+     */
+    bool closed() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return closed_;
     }
 
     /**
@@ -58,6 +195,22 @@ public:
         return queue_.empty();
     }
 
+    /**
+     * @brief Number of queued elements.
+     */
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queue_.size();
+    }
+
+    /**
+     * @brief Snapshot of the push/pop/drop counters.
+     */
+    Stats stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
     /**
      * @brief Accesses the front element of the queue.
      *
@@ -71,8 +224,24 @@ public:
     }
 
 private:
+    // Pops the front element with the mutex held, returns false if there is none.
+    bool take(T& value) {
+        if (queue_.empty())
+            return false;
+        value = std::move(queue_.front());
+        queue_.pop();
+        stats_.popped++;
+        not_full_.notify_one();
+        return true;
+    }
+
     std::queue<T> queue_; ///< The underlying queue storing the elements.
     std::mutex mutex_; ///< Mutex for synchronizing access to the queue.
-    std::condition_variable cond_var_; ///< Condition variable for notifying waiting threads.
+    std::condition_variable cond_var_; ///< Condition variable for notifying waiting consumers.
+    std::condition_variable not_full_; ///< Condition variable for producers waiting for room.
+    size_t capacity_ = 0; ///< Maximum number of queued elements, 0 for unbounded.
+    OverflowPolicy policy_ = OverflowPolicy::Block; ///< What push does when the queue is full.
+    bool closed_ = false; ///< Set by close(), wakes all waiters.
+    Stats stats_; ///< Push/pop/drop counters.
 };
-#endif
\ No newline at end of file
+#endif
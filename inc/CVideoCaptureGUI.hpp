@@ -2,6 +2,7 @@
 #include<windows.h>
 #include<thread>
 #include<vector>
+#include <CObserver.hpp>
 
 #ifndef VIDEOCAPTUREGUI_HPP
 #define VIDEOCAPTUREGUI_HPP
@@ -41,9 +42,18 @@ public:
      *
      * @param nCmdShow Specifies how the window is to be shown.
      */
-    void update(unsigned char* update , uint32_t width, uint32_t height) override;
     void Show(int nCmdShow);
 
+    /**
+     * @brief Draws a captured frame in the preview window.
+     *
+     * Called on the frame bus delivery thread, with the latest frame only. YUV frames are converted to BGR
+     * at the size of the preview window in one pass (see ColorConvert::ToBGRPreview) and drawn unscaled.
+     *
+     * @param frame The captured frame, in its capture format or in RGB24.
+     */
+    void update(const VideoFrame& frame) override;
+
      /**
      * @brief Window procedure for handling messages.
      *
@@ -67,7 +77,7 @@ public:
      * @param width Width of the frame.
      * @param height Height of the frame.
      */
-    void RenderFrame(HWND hWnd, unsigned char* data, int width, int height);
+    void RenderFrame(HWND hWnd, const unsigned char* data, int width, int height);
     void DecodeAndRenderFrame(HWND hWnd, const std::vector<uint8_t>& encodedData, int width, int height);
 
     /**
@@ -119,6 +129,10 @@ private:
     HWND hPlayButton; ///< Handle to the play button.
     videoStream* m_videoStreamPtr{nullptr}; ///< Pointer to the video stream object.
     HWND hWebSocketButton; ///< Handle to the start websocket button.
+    std::vector<unsigned char> m_previewRows; ///< DIB rows of the picture being drawn.
+
+    void fitPreview(HWND hWnd, int width, int height, int& x, int& y, int& destWidth, int& destHeight);
+    void drawPreview(HWND hWnd, const unsigned char* bgr, int x, int y, int width, int height);
     
     
 };
@@ -0,0 +1,85 @@
+#pragma once
+#ifndef VIDEOFRAME_HPP
+#define VIDEOFRAME_HPP
+
+#include <chrono>
+#include <cstdint>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#include <libavutil/rational.h>
+}
+
+/**
+ * @class VideoFrame
+ * @brief Reference-counted handle to a captured video frame.
+ *
+ * The handle wraps an AVFrame whose pixel buffers are reference counted by ffmpeg. Copying a VideoFrame
+ * adds a reference to the same buffers instead of copying pixels, so one captured frame can be handed
+ * to the preview, the recorder and the live encoder at the same time. The buffers are released when the
+ * last handle goes away, on whichever thread that happens.
+ */
+class VideoFrame
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Creates an empty handle.
+     */
+    VideoFrame() = default;
+
+    /**
+     * @brief Takes ownership of an AVFrame.
+     *
+     * @param frame The frame to adopt. It is freed with av_frame_free when the handle is destroyed.
+     * @param captureTime Time the frame was captured.
+     */
+    VideoFrame(AVFrame* frame, Clock::time_point captureTime);
+
+    /**
+     * @brief Creates a new reference to an existing AVFrame without taking ownership of it.
+     *
+     * @param frame The frame to reference.
+     * @param captureTime Time the frame was captured.
+     * @return The new handle, empty if the reference could not be created.
+     */
+    static VideoFrame Reference(const AVFrame* frame, Clock::time_point captureTime);
+
+    VideoFrame(const VideoFrame& other);
+    VideoFrame(VideoFrame&& other) noexcept;
+    VideoFrame& operator=(const VideoFrame& other);
+    VideoFrame& operator=(VideoFrame&& other) noexcept;
+    ~VideoFrame();
+
+    /**
+     * @brief Drops this handle's reference.
+     */
+    void reset();
+
+    /**
+     * @brief Checks if the handle refers to a frame.
+     */
+    explicit operator bool() const { return mFrame != nullptr; }
+
+    /**
+     * @brief The underlying AVFrame, for passing to ffmpeg APIs. Owned by the handle.
+     */
+    const AVFrame* get() const { return mFrame; }
+
+    AVPixelFormat format() const { return static_cast<AVPixelFormat>(mFrame->format); } ///< Pixel format.
+    int width() const { return mFrame->width; } ///< Width in pixels.
+    int height() const { return mFrame->height; } ///< Height in pixels.
+    const uint8_t* data(int plane = 0) const { return mFrame->data[plane]; } ///< Pointer to a plane.
+    int stride(int plane = 0) const { return mFrame->linesize[plane]; } ///< Bytes per row of a plane.
+    int64_t pts() const { return mFrame->pts; } ///< Presentation timestamp in timeBase() units.
+    AVRational timeBase() const { return mFrame->time_base; } ///< Time base of pts().
+    Clock::time_point captureTime() const { return mCaptureTime; } ///< Time the frame was captured.
+
+private:
+    AVFrame* mFrame = nullptr; ///< Owned frame, its buffers are shared with the other handles.
+    Clock::time_point mCaptureTime; ///< Time the frame was captured.
+};
+
+#endif // VIDEOFRAME_HPP
@@ -1,9 +1,12 @@
 #ifndef VIDEOSTREAMENCODER_HPP
 #define VIDEOSTREAMENCODER_HPP
 
+#include <memory>
+#include <string>
 #include <vector>
-#include <thread>
-#include <CThreadSafeQueue.hpp>
+#include <CEncoderCore.hpp>
+#include <CPacketSink.hpp>
+#include <CEncodedFragment.hpp>
 
 
 /**
@@ -11,6 +14,8 @@
  * @brief Class for encoding video streams.
  *
  * This class handles the encoding of video streams, providing methods to open, write, and close the encoder.
+ * It is an EncoderCore with a FragmentSink that muxes the packets into one fMP4 stream for the sender;
+ * more sinks can be attached to Core() to record the same packets without a second encode.
  */
 class VideoStreamEncoder {
 public:
@@ -26,20 +31,13 @@ public:
 
     /**
      * @struct Params
-     * @brief Parameters for configuring the video encoder.
-     *
-     * This structure holds the configuration parameters for the video encoder, including frame dimensions, frame rate, bitrate, and pixel formats.
+     * @brief Parameters for configuring the video encoder: frame dimensions, frame rate, bitrate, pixel formats
+     *        and how the fMP4 stream is cut into fragments.
      */
-    struct Params
+    struct Params : EncoderCore::Params
     {
-        uint32_t width; ///< Width of the video frame.
-        uint32_t height; ///< Height of the video frame.
-        double fps; ///< Frames per second.
-        uint32_t bitrate; ///< Bitrate for encoding.
-        const char *preset; ///< Preset for encoding quality and speed.
-        uint32_t crf; ///< Constant Rate Factor (0–51).
-        enum AVPixelFormat src_format; ///< Source pixel format.
-        enum AVPixelFormat dst_format; ///< Destination pixel format.
+        int frames_per_fragment = 1; ///< Frames per fMP4 fragment, 0 for no frame target.
+        int fragment_duration_ms = 0; ///< Video duration per fMP4 fragment in milliseconds, 0 for no duration target.
     };
 
     /**
@@ -58,62 +56,97 @@ public:
     /**
      * @brief Write raw video data to the encoder.
      *
+     * RGB24 input for a YUV420P encoder goes through the vectorised ColorConvert kernel instead of libswscale.
+     *
      * @param data Pointer to the raw video data.
      * @return True if the data was successfully written, false otherwise.
      */
     bool Write(const unsigned char *data);
 
     /**
-     * @brief Get the encoded video frame.
+     * @brief Write a decoded frame to the encoder.
+     *
+     * Frames that already have the encoder's pixel format and size are passed by reference without conversion.
+     * With Params::vfr the frame's pts and time_base are carried through to the fragments.
      *
-     * @param frame Vector to store the encoded frame data.
-     * @return True if the frame was successfully retrieved, false otherwise.
+     * @param frame The frame to encode.
+     * @return True if the frame was successfully written, false otherwise.
      */
-    bool getEncodedFrame(std::vector<uint8_t>& frame);
+    bool Write(const AVFrame *frame);
 
     /**
-     * @brief Check if the encoded frames queue is empty.
+     * @brief Change the bitrate while the stream runs, from the next frame written. Safe to call from any thread.
      *
-     * @return True if the queue is empty, false otherwise.
+     * Open with Params::max_bitrate set for the change to cap a crf encode (see EncoderCore::SetBitrate).
+     *
+     * @param bitrate Bits per second.
+     * @return False if the bitrate is 0.
      */
-    bool isencodedFramesQueueEmpty();
+    bool SetBitrate(uint32_t bitrate);
+
+    /**
+     * @brief Change the crf while the stream runs, from the next frame written. Safe to call from any thread.
+     *
+     * @param crf Constant Rate Factor.
+     * @return False if the crf is out of range.
+     */
+    bool SetCrf(uint32_t crf);
+
+    /**
+     * @brief Ask for an IDR frame at an instant of the timeline, for a client that joins or lost the stream. Safe to call from any thread.
+     *
+     * Rate limited: a request within Params::keyframe_request_spacing of the previous one is ignored (see EncoderCore::RequestKeyframe).
+     *
+     * @param at Instant in microseconds on the encoder's timeline; the keyframe goes on the first frame at or after it.
+     * @return False if the request was covered by the previous one.
+     */
+    bool RequestKeyframe(int64_t at);
 
-private:
     /**
-     * @brief Flush the remaining packets in the encoder.
+     * @brief Get the next piece of the fMP4 stream, waiting until one is available.
      *
-     * @return True if the packets were successfully flushed, false otherwise.
+     * The first piece after Open is the init segment (ftyp and moov), every later one a moof/mdat fragment.
+     *
+     * @param frame Receives a reference to the piece, no bytes are copied.
+     * @return True if the frame was successfully retrieved, false once the encoder is closed and drained.
      */
-    bool FlushPackets();
+    bool getEncodedFrame(EncodedFragment& frame);
 
     /**
-     * @brief Remux the video data.
+     * @brief Get the next piece of the fMP4 stream if one is ready, without waiting.
+     *
+     * Must be called from the thread that consumes the encoded frames.
      *
-     * @param data Pointer to the video data.
-     * @param size Size of the video data.
-     * @return True if the data was successfully remuxed, false otherwise.
+     * @param frame Receives a reference to the piece, no bytes are copied.
+     * @return True if a frame was retrieved.
      */
-    bool remuxVideo(uint8_t* data, int size);
+    bool tryGetEncodedFrame(EncodedFragment& frame);
 
     /**
-     * @struct Context
-     * @brief Internal context for the video encoder.
+     * @brief Check if the encoded frames queue is empty.
      *
-     * This structure holds the internal context for the video encoder, including format and codec contexts, stream, and frame information.
-     */
-    struct Context {
-        AVFormatContext *format_context = nullptr;
-        AVCodecContext *codec_context = nullptr;
-        AVStream *stream = nullptr;
-        const AVCodec *codec = nullptr;
-        AVFrame *frame = nullptr;
-        SwsContext *sws_context = nullptr;
-        int frame_index = 0;
-    } mContext;
-
-    bool mIsOpen = false; ///< Flag indicating if the encoder is open.
-    ThreadSafeQueue<std::vector<uint8_t>> encodedFramesQueue; ///< Queue for storing encoded frames.
-    std::vector<uint8_t> m_initSegment; ///< Initial segment of the encoded video.
+     * @return True if the queue is empty, false otherwise.
+     */
+    bool isencodedFramesQueueEmpty();
+
+    /**
+     * @brief The init segment of the current stream, valid from Open to the next Open.
+     */
+    const EncodedFragment& InitSegment() const;
+
+    /**
+     * @brief The codecs parameter of the stream's MIME type for the browser, e.g. "vp09.00.31.08", valid from Open.
+     */
+    const std::string& Codec() const;
+
+    /**
+     * @brief The shared encoder, to attach more sinks to.
+     */
+    EncoderCore& Core();
+
+private:
+    EncoderCore mCore; ///< Encoder and its sinks.
+    std::shared_ptr<FragmentSink> mFragments; ///< fMP4 stream from the encoder thread to the sender thread. Drops pieces when the sender is 256 behind.
 };
 
-#endif // VIDEOSTREAMENCODER_HPP
\ No newline at end of file
+#endif // VIDEOSTREAMENCODER_HPP
@@ -1,11 +1,17 @@
 #ifndef VIDEOSTREAMSOCKET_HPP
 #define VIDEOSTREAMSOCKET_HPP
 
-#include <set>
+#include <map>
+#include <string>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
+#include <CRendition.hpp>
+#include <CEncodedFragment.hpp>
+#include <CStreamSession.hpp>
 
 typedef websocketpp::server<websocketpp::config::asio> server;
 
@@ -14,6 +20,12 @@ typedef websocketpp::server<websocketpp::config::asio> server;
  * @brief Class for handling video streaming over WebSocket.
  *
  * This class manages WebSocket connections and handles the transmission of video data to connected clients.
+ * With a rendition ladder every client is served one tier of it through its own StreamSession. A client
+ * starts on the lowest tier as soon as it connects, from the tier's cached init segment and fragments since
+ * the last keyframe, and is moved between tiers at keyframes by its session's AbrController, or pinned to a
+ * tier with the "tier N" command ("tier auto" hands it back to the controller). A client that lost the stream
+ * sends "resync" to start over at the next keyframe; joins and resyncs ask the encoders for one through the
+ * keyframe handler, so the stream can keep a long GOP.
  */
 class VideoStreamSocket {
 public:
@@ -33,13 +45,53 @@ public:
     void run(uint16_t port);
 
     /**
-     * @brief Send video data to all connected clients.
+     * @brief Stop the WebSocket server so run returns.
      *
-     * This method sends the provided video data to all clients currently connected to the WebSocket server.
+     * Stops accepting connections, closes the open ones and stops the server's event loop. Safe to call from
+     * another thread than run, also before run started.
+     */
+    void stop();
+
+    /**
+     * @brief Set the rendition ladder clients are served from. Call before run.
+     *
+     * @param renditions The tiers, lowest bitrate first, as Rendition::Parse returns them.
+     */
+    void set_renditions(const std::vector<Rendition>& renditions);
+
+    /**
+     * @brief Set the codecs parameter of the stream's MIME type, sent to each client as "codec X" when it connects. Call before run.
+     *
+     * @param codec E.g. "avc1.64001f" or "vp09.00.31.08", as VideoStreamEncoder::Codec returns it.
+     */
+    void set_codec(const std::string& codec);
+
+    /**
+     * @brief Set what asks the encoders for a keyframe, called when a client connects or sends "resync". Call before run.
+     *
+     * @param handler E.g. a call to VideoStreamEncoder::RequestKeyframe on every tier; it must return quickly.
+     */
+    void set_keyframe_handler(std::function<void()> handler);
+
+    /**
+     * @brief Route a piece of one tier's fMP4 stream to the clients on that tier.
+     *
+     * Init segments and the fragments since the last keyframe are kept for the clients that join or switch
+     * later. A switch happens when the client's tier reaches a keyframe: the new tier takes over from its fragment of the same instant, which the keyframes
+     * of all tiers share. Must be called from a single thread.
+     *
+     * @param tier Index of the tier in the ladder.
+     * @param fragment The init segment or fragment.
+     */
+    void send_fragment(size_t tier, const EncodedFragment& fragment);
+
+    /**
+     * @brief Bytes waiting in the send buffer of the most backed up client of a tier, as of its last fragment.
      *
-     * @param data A vector containing the video data to be sent.
+     * @param tier Index of the tier in the ladder.
+     * @return The backlog in bytes, 0 without clients on the tier.
      */
-    void send_video_data(const std::vector<uint8_t>& data);
+    size_t max_buffered(size_t tier);
     bool m_client_connected = false; ///< boolean to check if client is connected already
     std::mutex m_mutex;
     std::condition_variable m_cv;
@@ -75,7 +127,11 @@ private:
     
 
     server m_server; ///< The WebSocket server instance.
-    std::set<websocketpp::connection_hdl, std::owner_less<websocketpp::connection_hdl>> m_connections; ///< Set of active connections.
+    std::map<websocketpp::connection_hdl, StreamSession, std::owner_less<websocketpp::connection_hdl>> m_connections; ///< Active connections and their sessions.
+    std::vector<TierCache> m_tiers; ///< The rendition ladder, lowest bitrate first.
+    std::vector<uint32_t> m_bitrates; ///< Bitrate of each tier.
+    std::string m_codec = "avc1.64001e"; ///< MIME codecs parameter of the tiers.
+    std::function<void()> m_keyframe_handler; ///< Asks the encoders for a keyframe, may be empty.
 
 
 };
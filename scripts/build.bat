@@ -1 +1 @@
-cl /EHsc /Zi /D_WIN32_WINNT=0x0601 /I"C:\Users\164293\scoop\apps\OpenSSL\current\include" /I"C:\Users\164293\OneDrive - Arrow Electronics, Inc\Desktop\projects\ffmpeg\inc" /I"C:/Users/164293/asio/asio/include" /I"C:\Users\164293\OneDrive - Arrow Electronics, Inc\Desktop\projects\ffmpeg\include"  /I"C:\Users\164293\scoop\apps\boost\current" /I"C:/Users/164293/websocketpp" src\CFFmpegEncoder.cpp src\CStreamVideo.cpp src\CVideoCaptureGUI.cpp src\CVideoStreamEncoder.cpp src\CVideoStreamSocket.cpp src\CWebSocketServer.cpp /Fo"exe\\" /Fe"exe\\StreamingApp.exe" /link /DEBUG /SUBSYSTEM:WINDOWS /LIBPATH:"C:\Users\164293\OneDrive - Arrow Electronics, Inc\Desktop\projects\ffmpeg\lib" /LIBPATH:"C:\Users\164293\scoop\apps\boost\current\lib" /LIBPATH:"C:\Users\164293\scoop\apps\OpenSSL\current\lib\VC\x64\MDd" libavformat.dll.a libavcodec.dll.a libavutil.dll.a libswscale.dll.a libavdevice.dll.a Shell32.lib User32.lib Gdi32.lib ws2_32.lib libcrypto.lib
\ No newline at end of file
+cl /EHsc /Zi /D_WIN32_WINNT=0x0601 /I"C:\Users\164293\scoop\apps\OpenSSL\current\include" /I"C:\Users\164293\OneDrive - Arrow Electronics, Inc\Desktop\projects\ffmpeg\inc" /I"C:/Users/164293/asio/asio/include" /I"C:\Users\164293\OneDrive - Arrow Electronics, Inc\Desktop\projects\ffmpeg\include"  /I"C:\Users\164293\scoop\apps\boost\current" /I"C:/Users/164293/websocketpp" src\CFFmpegEncoder.cpp src\CStreamVideo.cpp src\CVideoCaptureGUI.cpp src\CVideoStreamEncoder.cpp src\CVideoStreamSocket.cpp src\CWebSocketServer.cpp src\CFrameSource.cpp src\CCaptureSession.cpp src\CVideoFrame.cpp src\CFramePool.cpp src\CPipeline.cpp src\CFrameConverter.cpp src\CColorConvert.cpp src\CFrameBus.cpp src\CEncoderCore.cpp src\CPacketSink.cpp src\CEncodedFragment.cpp src\CFragmentPool.cpp src\CRendition.cpp src\CAbrController.cpp src\CParallelTranscoder.cpp src\CFFPreset.cpp src\CRateController.cpp src\CStreamSession.cpp /Fo"exe\\" /Fe"exe\\StreamingApp.exe" /link /DEBUG /SUBSYSTEM:WINDOWS /LIBPATH:"C:\Users\164293\OneDrive - Arrow Electronics, Inc\Desktop\projects\ffmpeg\lib" /LIBPATH:"C:\Users\164293\scoop\apps\boost\current\lib" /LIBPATH:"C:\Users\164293\scoop\apps\OpenSSL\current\lib\VC\x64\MDd" libavformat.dll.a libavcodec.dll.a libavutil.dll.a libswscale.dll.a libavdevice.dll.a Shell32.lib User32.lib Gdi32.lib ws2_32.lib libcrypto.lib
\ No newline at end of file
@@ -0,0 +1,12 @@
+#!/bin/sh
+# Headless build for Linux servers: no GUI, frames come from the FRAME_SOURCE selected at runtime.
+# Needs the ffmpeg development packages and websocketpp/asio (set WEBSOCKETPP_DIR if not installed system wide).
+set -e
+cd "$(dirname "$0")/.."
+mkdir -p exe
+g++ -std=c++17 -O2 -g -Iinc ${WEBSOCKETPP_DIR:+-I"$WEBSOCKETPP_DIR"} \
+    src/CFFmpegEncoder.cpp src/CStreamVideo.cpp src/CVideoStreamEncoder.cpp src/CVideoStreamSocket.cpp \
+    src/CFrameSource.cpp src/CCaptureSession.cpp src/CVideoFrame.cpp src/CFramePool.cpp src/CPipeline.cpp src/CFrameConverter.cpp src/CColorConvert.cpp src/CFrameBus.cpp src/CEncoderCore.cpp src/CPacketSink.cpp src/CEncodedFragment.cpp src/CFragmentPool.cpp src/CRendition.cpp src/CAbrController.cpp src/CParallelTranscoder.cpp src/CFFPreset.cpp src/CRateController.cpp src/CStreamSession.cpp \
+    src/CHeadlessRunner.cpp \
+    -o exe/StreamingAppHeadless \
+    $(pkg-config --cflags --libs libavformat libavcodec libavutil libswscale libavdevice) -lpthread
@@ -14,3 +14,47 @@ set WEBSOCKET_MAGIC_STRING=258EAFA5-E914-47DA-95CA-C5AB0DC85B11
 set MUXED_FILE_PATH=output/muxed_output.fmp4
 set FILE_PATH=output/output.mp4
 
+rem Frame source: webcam, file (FRAME_SOURCE_URL=path) or testsrc; pacing realtime or fast
+set FRAME_SOURCE=webcam
+set FRAME_SOURCE_PACING=realtime
+rem Capture colour conversion quality: fast, bilinear, bicubic or lanczos
+set SCALER_QUALITY=lanczos
+rem native passes decoded frames straight to the encoder, rgb converts every frame to RGB24 first
+set CAPTURE_FORMAT=native
+
+rem Frames in flight between capture and the encoders; 1 backs them with huge pages
+set FRAME_POOL_SIZE=8
+set FRAME_POOL_HUGE_PAGES=0
+rem Camera decoder threads (0 = one per core) and threading mode: auto, frame or slice
+set DECODE_THREADS=0
+set DECODE_THREADING=auto
+rem Frames waiting for the encoder and overflow policy: drop-oldest, drop-newest or block
+set FRAME_QUEUE_SIZE=4
+set FRAME_QUEUE_POLICY=drop-oldest
+rem Slice threads for the conversion to the encoder format (0 = one per core)
+set SCALER_THREADS=0
+rem RGB24 to YUV420P kernel: auto, scalar, sse4.1, avx2, avx512 or swscale
+set COLOR_CONVERT=auto
+rem Extra outputs for the same encode, comma separated: .mp4/.mkv files, .h264 Annex-B dumps, udp:// tcp:// srt:// (MPEG-TS) or rtmp:// URLs
+set EXTRA_SINKS=
+rem Live fMP4 fragments: frames per fragment (1 = lowest latency) and/or milliseconds per fragment, both 0 for one per GOP
+set FMP4_FRAGMENT_FRAMES=1
+set FMP4_FRAGMENT_MS=0
+rem Live encoder profile: empty for the default, low-latency for no B-frames/lookahead and sliced threads; intra refresh 1 replaces IDR frames
+set LIVE_PROFILE=
+set LIVE_INTRA_REFRESH=0
+rem Encoder threads (empty = encoder default) and threading: auto, frame or slice
+set ENCODE_THREADS=
+set ENCODE_THREADING=auto
+rem Live ABR ladder, WIDTHxHEIGHT@KBPS comma separated (empty = one 1280x720@400 tier), and seconds between the aligned keyframes
+set LIVE_RENDITIONS=
+set LIVE_KEYFRAME_INTERVAL=1
+rem Encoder: h264, vp8 or vp9 (empty = h264), ffpreset file (empty = the bundled presets\libvpx-* one for the size with VP8/VP9) and key=value:key=value encoder options
+set ENCODE_CODEC=
+set ENCODE_PRESET_FILE=
+set ENCODE_OPTIONS=
+rem Live bitrate limits in kbit/s for a single tier, steered from the client backlog (LIVE_MAX_BITRATE empty for 2000 or the tier's bitrate if higher, 0 keeps it fixed)
+set LIVE_MIN_BITRATE=100
+set LIVE_MAX_BITRATE=
+rem Live frames between keyframes; joining and resyncing clients ask for one, so it can be long (empty for 4 seconds)
+set LIVE_GOP_SIZE=
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <CAbrController.hpp>
+
+namespace {
+
+constexpr double kThroughputWeight = 0.5; // weight of the newest window in the smoothed throughput
+
+double Seconds(AbrController::Clock::duration duration)
+{
+    return std::chrono::duration<double>(duration).count();
+}
+
+}
+
+
+AbrController::AbrController(const std::vector<uint32_t> &bitrates)
+    : AbrController(bitrates, Params())
+{
+}
+
+AbrController::AbrController(const std::vector<uint32_t> &bitrates, const Params &params)
+    : mBitrates(bitrates), mParams(params), mProbeAfter(params.probe_after_seconds)
+{
+    if (mBitrates.empty())
+        mBitrates.push_back(1);
+}
+
+void AbrController::Reset(size_t tier, Clock::time_point now)
+{
+    mTier = std::min(tier, mBitrates.size() - 1);
+    mThroughput = 0.0;
+    mWindowStart = now;
+    mWindowDelivered = 0;
+    mWindowBuffered = 0;
+    mBacklogGrowing = false;
+    mSwitchTime = now;
+    mCalmSince = now;
+    mProbing = false;
+    mProbeAfter = mParams.probe_after_seconds;
+    mSwitches = 0;
+}
+
+size_t AbrController::Update(Clock::time_point now, uint64_t bytes_sent, size_t buffered)
+{
+    uint64_t delivered = bytes_sent > buffered ? bytes_sent - buffered : 0;
+    double elapsed = Seconds(now - mWindowStart);
+    if (elapsed >= mParams.window_seconds)
+    {
+        double rate = (delivered - std::min(delivered, mWindowDelivered)) * 8.0 / elapsed;
+        mThroughput = mThroughput > 0.0 ? mThroughput + (rate - mThroughput) * kThroughputWeight : rate;
+        // Only a window spent entirely on the current tier says whether it fits.
+        mBacklogGrowing = buffered > mWindowBuffered && mWindowStart >= mSwitchTime;
+        mWindowStart = now;
+        mWindowDelivered = delivered;
+        mWindowBuffered = buffered;
+    }
+
+    double backlog = buffered * 8.0 / std::max<uint32_t>(mBitrates[mTier], 1);
+    double since_switch = Seconds(now - mSwitchTime);
+
+    // A backlog that shrinks is one the link is already catching up with, like the one a higher tier left behind.
+    if (backlog > mParams.max_backlog_seconds && mBacklogGrowing && mTier > 0 &&
+        since_switch >= mParams.window_seconds)
+    {
+        // A failed probe goes back to the tier that held. Otherwise the link got worse: take what fits in it.
+        size_t tier = mTier - 1;
+        if (mProbing)
+            mProbeAfter = std::min(mProbeAfter * 2.0, mParams.max_probe_after_seconds);
+        else
+        {
+            while (tier > 0 && mBitrates[tier] > mThroughput * mParams.headroom)
+                tier--;
+        }
+        mProbing = false;
+        SwitchTo(tier, now);
+        return mTier;
+    }
+
+    if (mProbing && since_switch >= mParams.probe_after_seconds)
+    {
+        // The probe held: the next one may come as soon as the first.
+        mProbing = false;
+        mProbeAfter = mParams.probe_after_seconds;
+    }
+
+    if (backlog > mParams.calm_backlog_seconds)
+    {
+        mCalmSince = now;
+    }
+    else if (mTier + 1 < mBitrates.size() && Seconds(now - mCalmSince) >= mProbeAfter)
+    {
+        SwitchTo(mTier + 1, now);
+        mProbing = true;
+    }
+    return mTier;
+}
+
+void AbrController::SwitchTo(size_t tier, Clock::time_point now)
+{
+    mTier = tier;
+    mSwitchTime = now;
+    mCalmSince = now;
+    mBacklogGrowing = false;
+    mSwitches++;
+}
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+extern "C" {
+#include <libswscale/swscale.h>
+#include <libavutil/opt.h>
+}
+#include <CCaptureSession.hpp>
+
+
+CaptureSession::~CaptureSession()
+{
+    Reset();
+}
+
+void CaptureSession::SetScalerQuality(ScalerQuality quality)
+{
+    if (quality == mQuality)
+        return;
+
+    mQuality = quality;
+    for (auto& entry : mContexts)
+        sws_freeContext(entry.second);
+    mContexts.clear();
+}
+
+void CaptureSession::SetPoolSize(size_t count, bool hugePages)
+{
+    mPoolSize = count ? count : 1;
+    mHugePages = hugePages;
+}
+
+AVFrame* CaptureSession::ConvertToRGBFrame(const AVFrame* frame)
+{
+    SwsContext* swsCtx = GetContext(static_cast<AVPixelFormat>(frame->format), frame->width, frame->height);
+    if (!swsCtx)
+        return nullptr;
+
+    if (!mPool.Matches(AV_PIX_FMT_RGB24, frame->width, frame->height))
+    {
+        mDroppedBefore += mPool.Exhausted();
+        FramePool::Params params;
+        params.format = AV_PIX_FMT_RGB24;
+        params.width = frame->width;
+        params.height = frame->height;
+        params.count = mPoolSize;
+        params.huge_pages = mHugePages;
+        if (!mPool.Init(params))
+        {
+            std::cerr << "Could not allocate RGB frame pool\n";
+            return nullptr;
+        }
+    }
+
+    AVFrame* rgbFrame = mPool.Acquire();
+    if (!rgbFrame)
+        return nullptr; // every pooled frame is still queued, drop this one
+
+    av_frame_copy_props(rgbFrame, frame);
+    sws_scale(swsCtx, frame->data, frame->linesize, 0, frame->height, rgbFrame->data, rgbFrame->linesize);
+    return rgbFrame;
+}
+
+uint64_t CaptureSession::DroppedFrames() const
+{
+    return mDroppedBefore + mPool.Exhausted();
+}
+
+void CaptureSession::Reset()
+{
+    for (auto& entry : mContexts)
+        sws_freeContext(entry.second);
+    mContexts.clear();
+
+    mDroppedBefore += mPool.Exhausted();
+    mPool.Destroy();
+}
+
+CaptureSession::ScalerQuality CaptureSession::QualityFromEnvironment()
+{
+    const char* env_quality = std::getenv("SCALER_QUALITY");
+    if (!env_quality)
+        return ScalerQuality::Lanczos;
+
+    std::string quality = env_quality;
+    if (quality == "fast")
+        return ScalerQuality::Fast;
+    if (quality == "bilinear")
+        return ScalerQuality::Bilinear;
+    if (quality == "bicubic")
+        return ScalerQuality::Bicubic;
+    return ScalerQuality::Lanczos;
+}
+
+SwsContext* CaptureSession::GetContext(AVPixelFormat format, int width, int height)
+{
+    auto key = std::make_tuple(static_cast<int>(format), width, height);
+    auto it = mContexts.find(key);
+    if (it != mContexts.end())
+        return it->second;
+
+    int flags = SWS_LANCZOS;
+    switch (mQuality)
+    {
+    case ScalerQuality::Fast:
+        flags = SWS_FAST_BILINEAR;
+        break;
+    case ScalerQuality::Bilinear:
+        flags = SWS_BILINEAR;
+        break;
+    case ScalerQuality::Bicubic:
+        flags = SWS_BICUBIC;
+        break;
+    case ScalerQuality::Lanczos:
+        flags = SWS_LANCZOS;
+        break;
+    }
+
+    SwsContext* swsCtx = sws_getContext(
+        width, height, format, // Source dimensions and format
+        width, height, AV_PIX_FMT_RGB24, // Destination dimensions and format
+        flags, nullptr, nullptr, nullptr
+    );
+    if (!swsCtx)
+    {
+        std::cerr << "Could not initialize sws context\n";
+        return nullptr;
+    }
+    // Set color range
+    av_opt_set_int(swsCtx, "src_range", 1, 0); // Full range for source
+    av_opt_set_int(swsCtx, "dst_range", 1, 0); // Full range for destination
+
+    mContexts.emplace(key, swsCtx);
+    return swsCtx;
+}
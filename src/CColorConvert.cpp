@@ -0,0 +1,723 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <CColorConvert.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define COLORCONVERT_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC accepts any intrinsic in any function, GCC and Clang need the instruction set on the function.
+#if defined(COLORCONVERT_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+
+namespace
+{
+// BT.601 limited range in 8.8 fixed point. The chroma offset 32896 is 128 * 256 + 128, which keeps every
+// intermediate in [0, 65535] so the vector kernels can work on unsigned 16-bit lanes.
+inline uint8_t LumaOf(int r, int g, int b)
+{
+    return static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+inline uint8_t BlueDiffOf(int r, int g, int b)
+{
+    return static_cast<uint8_t>((112 * b - 38 * r - 74 * g + 32896) >> 8);
+}
+
+inline uint8_t RedDiffOf(int r, int g, int b)
+{
+    return static_cast<uint8_t>((112 * r - 94 * g - 18 * b + 32896) >> 8);
+}
+
+// Converts columns [start, width) of a pair of rows. For the last row of an odd height both rows are the same.
+void RowPairScalar(const uint8_t* src0, const uint8_t* src1, uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v,
+                   int start, int width)
+{
+    for (int x = start; x < width; x += 2)
+    {
+        const int x1 = x + 1 < width ? x + 1 : x;
+        const uint8_t* p00 = src0 + 3 * x;
+        const uint8_t* p01 = src0 + 3 * x1;
+        const uint8_t* p10 = src1 + 3 * x;
+        const uint8_t* p11 = src1 + 3 * x1;
+
+        y0[x] = LumaOf(p00[0], p00[1], p00[2]);
+        y1[x] = LumaOf(p10[0], p10[1], p10[2]);
+        if (x + 1 < width)
+        {
+            y0[x1] = LumaOf(p01[0], p01[1], p01[2]);
+            y1[x1] = LumaOf(p11[0], p11[1], p11[2]);
+        }
+
+        const int r = (p00[0] + p01[0] + p10[0] + p11[0] + 2) >> 2;
+        const int g = (p00[1] + p01[1] + p10[1] + p11[1] + 2) >> 2;
+        const int b = (p00[2] + p01[2] + p10[2] + p11[2] + 2) >> 2;
+        u[x / 2] = BlueDiffOf(r, g, b);
+        v[x / 2] = RedDiffOf(r, g, b);
+    }
+}
+
+// BT.601 YUV to RGB in 10.6 fixed point, so the vector kernels fit in signed 16-bit lanes. Their saturating
+// adds only saturate where the result is clamped to 255 anyway, so they match the scalar code exactly.
+struct YuvMatrix
+{
+    short black; ///< Luma of black.
+    short luma; ///< Luma gain.
+    short blue_u; ///< U contribution to blue.
+    short green_u; ///< U contribution to green, subtracted.
+    short green_v; ///< V contribution to green, subtracted.
+    short red_v; ///< V contribution to red.
+};
+
+const YuvMatrix kLimitedRange = { 16, 74, 129, 25, 52, 102 };
+const YuvMatrix kFullRange = { 0, 64, 113, 22, 46, 90 };
+
+inline uint8_t Clamp8(int x)
+{
+    return static_cast<uint8_t>(x < 0 ? 0 : x > 255 ? 255 : x);
+}
+
+void YuvRowToBgrScalar(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* bgr, int start, int width,
+                       const YuvMatrix& m)
+{
+    for (int x = start; x < width; x++)
+    {
+        const int c = m.luma * (y[x] - m.black);
+        const int d = u[x] - 128;
+        const int e = v[x] - 128;
+        bgr[3 * x] = Clamp8((c + m.blue_u * d + 32) >> 6);
+        bgr[3 * x + 1] = Clamp8((c - m.green_u * d - m.green_v * e + 32) >> 6);
+        bgr[3 * x + 2] = Clamp8((c + m.red_v * e + 32) >> 6);
+    }
+}
+
+// Vector kernels convert as many whole blocks of a row pair as fit and return the first column left over.
+typedef int (*RowPairKernel)(const uint8_t* src0, const uint8_t* src1, uint8_t* y0, uint8_t* y1,
+                             uint8_t* u, uint8_t* v, int width);
+
+// Same for one row of gathered Y, U and V samples converted to BGR24.
+typedef int (*BgrRowKernel)(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* bgr, int width,
+                            const YuvMatrix& m);
+
+#ifdef COLORCONVERT_X86
+// Splits 16 packed RGB24 pixels (48 bytes) into one register per channel.
+TARGET_SSE41 inline void Deinterleave16(const uint8_t* src, __m128i& r, __m128i& g, __m128i& b)
+{
+    const __m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    const __m128i c1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+    const __m128i c2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+
+    r = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(c0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(c1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(c2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    g = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(c0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(c1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(c2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    b = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(c0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(c1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(c2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+// SSE4.1: 16 pixels per step, 8 lanes of 16 bits per operation.
+TARGET_SSE41 inline __m128i Luma8(__m128i r, __m128i g, __m128i b)
+{
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+    y = _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(y, _mm_set1_epi16(16));
+}
+
+// Sum of each horizontal pair over both rows, 8 pixels of each row in, 4 sums out as 32-bit lanes.
+TARGET_SSE41 inline __m128i BlockSums4(__m128i row0, __m128i row1)
+{
+    return _mm_madd_epi16(_mm_add_epi16(row0, row1), _mm_set1_epi16(1));
+}
+
+TARGET_SSE41 inline __m128i Average8(__m128i sums_lo, __m128i sums_hi)
+{
+    return _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(sums_lo, sums_hi), _mm_set1_epi16(2)), 2);
+}
+
+TARGET_SSE41 inline __m128i ChromaOf8(__m128i a, __m128i b, __m128i c, short ka, short kb, short kc)
+{
+    __m128i x = _mm_sub_epi16(_mm_mullo_epi16(a, _mm_set1_epi16(ka)), _mm_mullo_epi16(b, _mm_set1_epi16(kb)));
+    x = _mm_sub_epi16(x, _mm_mullo_epi16(c, _mm_set1_epi16(kc)));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_set1_epi16(static_cast<short>(32896))), 8);
+}
+
+TARGET_SSE41 int RowPairSSE41(const uint8_t* src0, const uint8_t* src1, uint8_t* y0, uint8_t* y1,
+                              uint8_t* u, uint8_t* v, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i r0, g0, b0, r1, g1, b1;
+        Deinterleave16(src0 + 3 * x, r0, g0, b0);
+        Deinterleave16(src1 + 3 * x, r1, g1, b1);
+
+        const __m128i r0l = _mm_cvtepu8_epi16(r0), r0h = _mm_unpackhi_epi8(r0, zero);
+        const __m128i g0l = _mm_cvtepu8_epi16(g0), g0h = _mm_unpackhi_epi8(g0, zero);
+        const __m128i b0l = _mm_cvtepu8_epi16(b0), b0h = _mm_unpackhi_epi8(b0, zero);
+        const __m128i r1l = _mm_cvtepu8_epi16(r1), r1h = _mm_unpackhi_epi8(r1, zero);
+        const __m128i g1l = _mm_cvtepu8_epi16(g1), g1h = _mm_unpackhi_epi8(g1, zero);
+        const __m128i b1l = _mm_cvtepu8_epi16(b1), b1h = _mm_unpackhi_epi8(b1, zero);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x),
+                         _mm_packus_epi16(Luma8(r0l, g0l, b0l), Luma8(r0h, g0h, b0h)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x),
+                         _mm_packus_epi16(Luma8(r1l, g1l, b1l), Luma8(r1h, g1h, b1h)));
+
+        const __m128i r = Average8(BlockSums4(r0l, r1l), BlockSums4(r0h, r1h));
+        const __m128i g = Average8(BlockSums4(g0l, g1l), BlockSums4(g0h, g1h));
+        const __m128i b = Average8(BlockSums4(b0l, b1l), BlockSums4(b0h, b1h));
+        const __m128i uv = _mm_packus_epi16(ChromaOf8(b, r, g, 112, 38, 74), ChromaOf8(r, g, b, 112, 94, 18));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), uv);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2), _mm_srli_si128(uv, 8));
+    }
+    return x;
+}
+
+// Packs one register per channel into 16 BGR24 pixels (48 bytes).
+TARGET_SSE41 inline void Interleave16(__m128i b, __m128i g, __m128i r, uint8_t* dst)
+{
+    const __m128i c0 = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(b, _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5)),
+        _mm_shuffle_epi8(g, _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1))),
+        _mm_shuffle_epi8(r, _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1)));
+    const __m128i c1 = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1)),
+        _mm_shuffle_epi8(g, _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10))),
+        _mm_shuffle_epi8(r, _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1)));
+    const __m128i c2 = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(b, _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1)),
+        _mm_shuffle_epi8(g, _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1))),
+        _mm_shuffle_epi8(r, _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), c0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), c1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32), c2);
+}
+
+// 8 pixels of Y, U and V in 16-bit lanes to B, G and R in 16-bit lanes, before clamping.
+TARGET_SSE41 inline void YuvToBgr8(__m128i y, __m128i u, __m128i v, const YuvMatrix& m,
+                                   __m128i& b, __m128i& g, __m128i& r)
+{
+    const __m128i c = _mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(m.black)), _mm_set1_epi16(m.luma));
+    const __m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    const __m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+    const __m128i round = _mm_set1_epi16(32);
+    b = _mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(m.blue_u))), round), 6);
+    g = _mm_subs_epi16(_mm_subs_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(m.green_u))),
+                       _mm_mullo_epi16(e, _mm_set1_epi16(m.green_v)));
+    g = _mm_srai_epi16(_mm_adds_epi16(g, round), 6);
+    r = _mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(m.red_v))), round), 6);
+}
+
+TARGET_SSE41 int BgrRowSSE41(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* bgr, int width,
+                             const YuvMatrix& m)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m128i y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        const __m128i u8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x));
+        const __m128i v8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x));
+
+        __m128i bl, gl, rl, bh, gh, rh;
+        YuvToBgr8(_mm_cvtepu8_epi16(y8), _mm_cvtepu8_epi16(u8), _mm_cvtepu8_epi16(v8), m, bl, gl, rl);
+        YuvToBgr8(_mm_unpackhi_epi8(y8, zero), _mm_unpackhi_epi8(u8, zero), _mm_unpackhi_epi8(v8, zero), m, bh, gh, rh);
+        Interleave16(_mm_packus_epi16(bl, bh), _mm_packus_epi16(gl, gh), _mm_packus_epi16(rl, rh), bgr + 3 * x);
+    }
+    return x;
+}
+
+// AVX2: 32 pixels per step, 16 lanes of 16 bits per operation. Packs work within 128-bit lanes, so every
+// pack is followed by a 64-bit permute that puts the halves back in pixel order.
+TARGET_AVX2 inline __m256i Luma16(__m256i r, __m256i g, __m256i b)
+{
+    __m256i y = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(66)),
+                                 _mm256_mullo_epi16(g, _mm256_set1_epi16(129)));
+    y = _mm256_add_epi16(y, _mm256_mullo_epi16(b, _mm256_set1_epi16(25)));
+    y = _mm256_srli_epi16(_mm256_add_epi16(y, _mm256_set1_epi16(128)), 8);
+    return _mm256_add_epi16(y, _mm256_set1_epi16(16));
+}
+
+TARGET_AVX2 inline __m256i BlockSums8(__m256i row0, __m256i row1)
+{
+    return _mm256_madd_epi16(_mm256_add_epi16(row0, row1), _mm256_set1_epi16(1));
+}
+
+TARGET_AVX2 inline __m256i Average16(__m256i sums_lo, __m256i sums_hi)
+{
+    const __m256i sums = _mm256_permute4x64_epi64(_mm256_packs_epi32(sums_lo, sums_hi), 0xD8);
+    return _mm256_srli_epi16(_mm256_add_epi16(sums, _mm256_set1_epi16(2)), 2);
+}
+
+TARGET_AVX2 inline __m256i ChromaOf16(__m256i a, __m256i b, __m256i c, short ka, short kb, short kc)
+{
+    __m256i x = _mm256_sub_epi16(_mm256_mullo_epi16(a, _mm256_set1_epi16(ka)),
+                                 _mm256_mullo_epi16(b, _mm256_set1_epi16(kb)));
+    x = _mm256_sub_epi16(x, _mm256_mullo_epi16(c, _mm256_set1_epi16(kc)));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_set1_epi16(static_cast<short>(32896))), 8);
+}
+
+TARGET_AVX2 int RowPairAVX2(const uint8_t* src0, const uint8_t* src1, uint8_t* y0, uint8_t* y1,
+                            uint8_t* u, uint8_t* v, int width)
+{
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        // a: pixels x..x+15, b: pixels x+16..x+31, for row 0 and row 1.
+        __m128i r0a, g0a, b0a, r0b, g0b, b0b, r1a, g1a, b1a, r1b, g1b, b1b;
+        Deinterleave16(src0 + 3 * x, r0a, g0a, b0a);
+        Deinterleave16(src0 + 3 * x + 48, r0b, g0b, b0b);
+        Deinterleave16(src1 + 3 * x, r1a, g1a, b1a);
+        Deinterleave16(src1 + 3 * x + 48, r1b, g1b, b1b);
+
+        const __m256i R0a = _mm256_cvtepu8_epi16(r0a), R0b = _mm256_cvtepu8_epi16(r0b);
+        const __m256i G0a = _mm256_cvtepu8_epi16(g0a), G0b = _mm256_cvtepu8_epi16(g0b);
+        const __m256i B0a = _mm256_cvtepu8_epi16(b0a), B0b = _mm256_cvtepu8_epi16(b0b);
+        const __m256i R1a = _mm256_cvtepu8_epi16(r1a), R1b = _mm256_cvtepu8_epi16(r1b);
+        const __m256i G1a = _mm256_cvtepu8_epi16(g1a), G1b = _mm256_cvtepu8_epi16(g1b);
+        const __m256i B1a = _mm256_cvtepu8_epi16(b1a), B1b = _mm256_cvtepu8_epi16(b1b);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(y0 + x), _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(Luma16(R0a, G0a, B0a), Luma16(R0b, G0b, B0b)), 0xD8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(y1 + x), _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(Luma16(R1a, G1a, B1a), Luma16(R1b, G1b, B1b)), 0xD8));
+
+        const __m256i r = Average16(BlockSums8(R0a, R1a), BlockSums8(R0b, R1b));
+        const __m256i g = Average16(BlockSums8(G0a, G1a), BlockSums8(G0b, G1b));
+        const __m256i b = Average16(BlockSums8(B0a, B1a), BlockSums8(B0b, B1b));
+        const __m256i uv = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(ChromaOf16(b, r, g, 112, 38, 74), ChromaOf16(r, g, b, 112, 94, 18)), 0xD8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x / 2), _mm256_castsi256_si128(uv));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(v + x / 2), _mm256_extracti128_si256(uv, 1));
+    }
+    return x;
+}
+
+TARGET_AVX2 inline void YuvToBgr16(__m256i y, __m256i u, __m256i v, const YuvMatrix& m,
+                                   __m256i& b, __m256i& g, __m256i& r)
+{
+    const __m256i c = _mm256_mullo_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(m.black)), _mm256_set1_epi16(m.luma));
+    const __m256i d = _mm256_sub_epi16(u, _mm256_set1_epi16(128));
+    const __m256i e = _mm256_sub_epi16(v, _mm256_set1_epi16(128));
+    const __m256i round = _mm256_set1_epi16(32);
+    b = _mm256_adds_epi16(_mm256_adds_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(m.blue_u))), round);
+    g = _mm256_subs_epi16(_mm256_subs_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(m.green_u))),
+                          _mm256_mullo_epi16(e, _mm256_set1_epi16(m.green_v)));
+    g = _mm256_adds_epi16(g, round);
+    r = _mm256_adds_epi16(_mm256_adds_epi16(c, _mm256_mullo_epi16(e, _mm256_set1_epi16(m.red_v))), round);
+    b = _mm256_srai_epi16(b, 6);
+    g = _mm256_srai_epi16(g, 6);
+    r = _mm256_srai_epi16(r, 6);
+}
+
+// Clamps two halves of 16 pixels to bytes, in pixel order.
+TARGET_AVX2 inline __m256i Pack32(__m256i lo, __m256i hi)
+{
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+}
+
+TARGET_AVX2 int BgrRowAVX2(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* bgr, int width,
+                           const YuvMatrix& m)
+{
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        const __m256i y8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + x));
+        const __m256i u8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(u + x));
+        const __m256i v8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + x));
+
+        __m256i bl, gl, rl, bh, gh, rh;
+        YuvToBgr16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(y8)), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(u8)),
+                   _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v8)), m, bl, gl, rl);
+        YuvToBgr16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(y8, 1)), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(u8, 1)),
+                   _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v8, 1)), m, bh, gh, rh);
+        const __m256i b = Pack32(bl, bh), g = Pack32(gl, gh), r = Pack32(rl, rh);
+        Interleave16(_mm256_castsi256_si128(b), _mm256_castsi256_si128(g), _mm256_castsi256_si128(r), bgr + 3 * x);
+        Interleave16(_mm256_extracti128_si256(b, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(r, 1),
+                     bgr + 3 * x + 48);
+    }
+    return x;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized" // _mm512_undefined_epi32 in the GCC 12 headers
+#endif
+
+// AVX-512: 64 pixels per step, 32 lanes of 16 bits per operation, same lane fix-up as AVX2 over four lanes.
+TARGET_AVX512 inline __m512i Widen32(__m128i lo, __m128i hi)
+{
+    return _mm512_cvtepu8_epi16(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1));
+}
+
+TARGET_AVX512 inline __m512i LaneOrder(__m512i packed)
+{
+    return _mm512_permutexvar_epi64(_mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7), packed);
+}
+
+TARGET_AVX512 inline __m512i Luma32(__m512i r, __m512i g, __m512i b)
+{
+    __m512i y = _mm512_add_epi16(_mm512_mullo_epi16(r, _mm512_set1_epi16(66)),
+                                 _mm512_mullo_epi16(g, _mm512_set1_epi16(129)));
+    y = _mm512_add_epi16(y, _mm512_mullo_epi16(b, _mm512_set1_epi16(25)));
+    y = _mm512_srli_epi16(_mm512_add_epi16(y, _mm512_set1_epi16(128)), 8);
+    return _mm512_add_epi16(y, _mm512_set1_epi16(16));
+}
+
+TARGET_AVX512 inline __m512i BlockSums16(__m512i row0, __m512i row1)
+{
+    return _mm512_madd_epi16(_mm512_add_epi16(row0, row1), _mm512_set1_epi16(1));
+}
+
+TARGET_AVX512 inline __m512i Average32(__m512i sums_lo, __m512i sums_hi)
+{
+    const __m512i sums = LaneOrder(_mm512_packs_epi32(sums_lo, sums_hi));
+    return _mm512_srli_epi16(_mm512_add_epi16(sums, _mm512_set1_epi16(2)), 2);
+}
+
+TARGET_AVX512 inline __m512i ChromaOf32(__m512i a, __m512i b, __m512i c, short ka, short kb, short kc)
+{
+    __m512i x = _mm512_sub_epi16(_mm512_mullo_epi16(a, _mm512_set1_epi16(ka)),
+                                 _mm512_mullo_epi16(b, _mm512_set1_epi16(kb)));
+    x = _mm512_sub_epi16(x, _mm512_mullo_epi16(c, _mm512_set1_epi16(kc)));
+    return _mm512_srli_epi16(_mm512_add_epi16(x, _mm512_set1_epi16(static_cast<short>(32896))), 8);
+}
+
+TARGET_AVX512 int RowPairAVX512(const uint8_t* src0, const uint8_t* src1, uint8_t* y0, uint8_t* y1,
+                                uint8_t* u, uint8_t* v, int width)
+{
+    int x = 0;
+    for (; x + 64 <= width; x += 64)
+    {
+        // Four blocks of 16 pixels per row; a covers pixels x..x+31 and b pixels x+32..x+63.
+        __m128i r0[4], g0[4], b0[4], r1[4], g1[4], b1[4];
+        for (int i = 0; i < 4; i++)
+        {
+            Deinterleave16(src0 + 3 * (x + 16 * i), r0[i], g0[i], b0[i]);
+            Deinterleave16(src1 + 3 * (x + 16 * i), r1[i], g1[i], b1[i]);
+        }
+
+        const __m512i R0a = Widen32(r0[0], r0[1]), R0b = Widen32(r0[2], r0[3]);
+        const __m512i G0a = Widen32(g0[0], g0[1]), G0b = Widen32(g0[2], g0[3]);
+        const __m512i B0a = Widen32(b0[0], b0[1]), B0b = Widen32(b0[2], b0[3]);
+        const __m512i R1a = Widen32(r1[0], r1[1]), R1b = Widen32(r1[2], r1[3]);
+        const __m512i G1a = Widen32(g1[0], g1[1]), G1b = Widen32(g1[2], g1[3]);
+        const __m512i B1a = Widen32(b1[0], b1[1]), B1b = Widen32(b1[2], b1[3]);
+
+        _mm512_storeu_si512(y0 + x, LaneOrder(_mm512_packus_epi16(Luma32(R0a, G0a, B0a), Luma32(R0b, G0b, B0b))));
+        _mm512_storeu_si512(y1 + x, LaneOrder(_mm512_packus_epi16(Luma32(R1a, G1a, B1a), Luma32(R1b, G1b, B1b))));
+
+        const __m512i r = Average32(BlockSums16(R0a, R1a), BlockSums16(R0b, R1b));
+        const __m512i g = Average32(BlockSums16(G0a, G1a), BlockSums16(G0b, G1b));
+        const __m512i b = Average32(BlockSums16(B0a, B1a), BlockSums16(B0b, B1b));
+        const __m512i uv = LaneOrder(
+            _mm512_packus_epi16(ChromaOf32(b, r, g, 112, 38, 74), ChromaOf32(r, g, b, 112, 94, 18)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(u + x / 2), _mm512_castsi512_si256(uv));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(v + x / 2), _mm512_extracti64x4_epi64(uv, 1));
+    }
+    return x;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+void CpuId(int leaf, int subleaf, unsigned int regs[4])
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, leaf, subleaf);
+    for (int i = 0; i < 4; i++)
+        regs[i] = static_cast<unsigned int>(info[i]);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the operating system saves on context switches (XCR0).
+uint64_t EnabledStateMask()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int lo = 0, hi = 0;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+#endif
+}
+#endif // COLORCONVERT_X86
+
+ColorConvert::Isa DetectIsa()
+{
+#ifdef COLORCONVERT_X86
+    unsigned int regs[4];
+    CpuId(0, 0, regs);
+    const unsigned int max_leaf = regs[0];
+
+    CpuId(1, 0, regs);
+    const bool ssse3 = (regs[2] >> 9) & 1;
+    const bool sse41 = (regs[2] >> 19) & 1;
+    const bool osxsave = (regs[2] >> 27) & 1;
+    if (!ssse3 || !sse41)
+        return ColorConvert::Isa::Scalar;
+    if (!osxsave || max_leaf < 7)
+        return ColorConvert::Isa::SSE41;
+
+    const uint64_t state = EnabledStateMask();
+    CpuId(7, 0, regs);
+    const bool avx2 = (regs[1] >> 5) & 1;
+    const bool avx512 = ((regs[1] >> 16) & 1) && ((regs[1] >> 30) & 1); // AVX-512F and AVX-512BW
+    if (avx512 && (state & 0xE6) == 0xE6) // XMM, YMM, opmask and both ZMM halves
+        return ColorConvert::Isa::AVX512;
+    if (avx2 && (state & 0x6) == 0x6) // XMM and YMM
+        return ColorConvert::Isa::AVX2;
+    return ColorConvert::Isa::SSE41;
+#else
+    return ColorConvert::Isa::Scalar;
+#endif
+}
+
+ColorConvert::Isa IsaFromEnvironment(ColorConvert::Isa supported)
+{
+    const char* env_isa = std::getenv("COLOR_CONVERT");
+    std::string name = env_isa ? env_isa : "auto";
+    ColorConvert::Isa isa = supported;
+    if (name == "swscale")
+        isa = ColorConvert::Isa::None;
+    else if (name == "scalar")
+        isa = ColorConvert::Isa::Scalar;
+    else if (name == "sse4.1")
+        isa = ColorConvert::Isa::SSE41;
+    else if (name == "avx2")
+        isa = ColorConvert::Isa::AVX2;
+    else if (name == "avx512")
+        isa = ColorConvert::Isa::AVX512;
+    else if (name != "auto")
+        std::cerr << "Unknown COLOR_CONVERT " << name << ", using auto\n";
+    return isa < supported ? isa : supported;
+}
+
+std::atomic<int>& ActiveIsaStorage()
+{
+    static std::atomic<int> active(static_cast<int>(IsaFromEnvironment(ColorConvert::SupportedIsa())));
+    return active;
+}
+
+RowPairKernel KernelFor(ColorConvert::Isa isa)
+{
+    switch (isa)
+    {
+#ifdef COLORCONVERT_X86
+    case ColorConvert::Isa::SSE41:
+        return RowPairSSE41;
+    case ColorConvert::Isa::AVX2:
+        return RowPairAVX2;
+    case ColorConvert::Isa::AVX512:
+        return RowPairAVX512;
+#endif
+    default:
+        return nullptr;
+    }
+}
+BgrRowKernel BgrKernelFor(ColorConvert::Isa isa)
+{
+    switch (isa)
+    {
+#ifdef COLORCONVERT_X86
+    case ColorConvert::Isa::SSE41:
+        return BgrRowSSE41;
+    case ColorConvert::Isa::AVX2:
+    case ColorConvert::Isa::AVX512:
+        return BgrRowAVX2;
+#endif
+    default:
+        return nullptr;
+    }
+}
+} // namespace
+
+
+bool ColorConvert::CanConvert(int src_format, int dst_format)
+{
+    return src_format == AV_PIX_FMT_RGB24 && dst_format == AV_PIX_FMT_YUV420P && ActiveIsa() != Isa::None;
+}
+
+void ColorConvert::RGB24ToI420(const uint8_t* rgb, int rgb_stride, uint8_t* const dst[3], const int dst_stride[3],
+                               int width, int height)
+{
+    Isa isa = ActiveIsa();
+    RGB24ToI420(rgb, rgb_stride, dst, dst_stride, width, height, isa == Isa::None ? Isa::Scalar : isa);
+}
+
+bool ColorConvert::RGB24ToI420(const uint8_t* rgb, int rgb_stride, uint8_t* const dst[3], const int dst_stride[3],
+                               int width, int height, Isa isa)
+{
+    if (isa == Isa::None || isa > SupportedIsa())
+        return false;
+
+    RowPairKernel kernel = KernelFor(isa);
+    for (int y = 0; y < height; y += 2)
+    {
+        const bool pair = y + 1 < height;
+        const uint8_t* src0 = rgb + static_cast<ptrdiff_t>(y) * rgb_stride;
+        const uint8_t* src1 = pair ? src0 + rgb_stride : src0;
+        uint8_t* y0 = dst[0] + static_cast<ptrdiff_t>(y) * dst_stride[0];
+        uint8_t* y1 = pair ? y0 + dst_stride[0] : y0;
+        uint8_t* u = dst[1] + static_cast<ptrdiff_t>(y / 2) * dst_stride[1];
+        uint8_t* v = dst[2] + static_cast<ptrdiff_t>(y / 2) * dst_stride[2];
+
+        int done = kernel ? kernel(src0, src1, y0, y1, u, v, width) : 0;
+        RowPairScalar(src0, src1, y0, y1, u, v, done, width);
+    }
+    return true;
+}
+
+bool ColorConvert::Convert(const AVFrame* src, AVFrame* dst)
+{
+    if (!CanConvert(src->format, dst->format) || src->width != dst->width || src->height != dst->height)
+        return false;
+
+    RGB24ToI420(src->data[0], src->linesize[0], dst->data, dst->linesize, src->width, src->height);
+    return true;
+}
+
+bool ColorConvert::CanPreview(int src_format)
+{
+    switch (src_format)
+    {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+    case AV_PIX_FMT_NV12:
+        return ActiveIsa() != Isa::None;
+    default:
+        return false;
+    }
+}
+
+bool ColorConvert::ToBGRPreview(const AVFrame* src, uint8_t* bgr, int bgr_stride, int width, int height)
+{
+    Isa isa = ActiveIsa();
+    return isa != Isa::None && ToBGRPreview(src, bgr, bgr_stride, width, height, isa);
+}
+
+bool ColorConvert::ToBGRPreview(const AVFrame* src, uint8_t* bgr, int bgr_stride, int width, int height, Isa isa)
+{
+    const int format = src->format;
+    const bool planar = format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P ||
+        format == AV_PIX_FMT_YUV422P || format == AV_PIX_FMT_YUVJ422P;
+    const bool nv12 = format == AV_PIX_FMT_NV12;
+    if ((!planar && !nv12) || isa == Isa::None || isa > SupportedIsa() ||
+        width <= 0 || height <= 0 || src->width <= 0 || src->height <= 0)
+        return false;
+
+    // 4:2:2 has a chroma row for every luma row, 4:2:0 one for every two. The J formats are full range (JPEG).
+    const int chroma_shift = format == AV_PIX_FMT_YUV422P || format == AV_PIX_FMT_YUVJ422P ? 0 : 1;
+    const bool full_range = format == AV_PIX_FMT_YUVJ420P || format == AV_PIX_FMT_YUVJ422P ||
+        src->color_range == AVCOL_RANGE_JPEG;
+    const YuvMatrix& matrix = full_range ? kFullRange : kLimitedRange;
+
+    // Source column of every output column, and one row of gathered samples. Kept per thread so a
+    // preview thread converting every frame at the same size does not allocate.
+    thread_local std::vector<int> columns;
+    thread_local std::vector<uint8_t> samples;
+    columns.resize(width);
+    samples.resize(static_cast<size_t>(width) * 3);
+    for (int x = 0; x < width; x++)
+    {
+        // Centre of the output pixel mapped to the source, like a nearest neighbour scaler.
+        int column = static_cast<int>((2 * static_cast<int64_t>(x) + 1) * src->width / (2 * static_cast<int64_t>(width)));
+        columns[x] = column < src->width ? column : src->width - 1;
+    }
+
+    uint8_t* y_row = samples.data();
+    uint8_t* u_row = y_row + width;
+    uint8_t* v_row = u_row + width;
+    BgrRowKernel kernel = BgrKernelFor(isa);
+    for (int y = 0; y < height; y++)
+    {
+        int row = static_cast<int>((2 * static_cast<int64_t>(y) + 1) * src->height / (2 * static_cast<int64_t>(height)));
+        if (row >= src->height)
+            row = src->height - 1;
+
+        const uint8_t* luma = src->data[0] + static_cast<ptrdiff_t>(row) * src->linesize[0];
+        const uint8_t* chroma_u = src->data[1] + static_cast<ptrdiff_t>(row >> chroma_shift) * src->linesize[1];
+        const uint8_t* chroma_v = nv12 ? chroma_u + 1 : src->data[2] + static_cast<ptrdiff_t>(row >> chroma_shift) * src->linesize[2];
+        const int chroma_step = nv12 ? 2 : 1;
+        for (int x = 0; x < width; x++)
+        {
+            const int column = columns[x];
+            y_row[x] = luma[column];
+            u_row[x] = chroma_u[(column / 2) * chroma_step];
+            v_row[x] = chroma_v[(column / 2) * chroma_step];
+        }
+
+        uint8_t* out = bgr + static_cast<ptrdiff_t>(y) * bgr_stride;
+        int done = kernel ? kernel(y_row, u_row, v_row, out, width, matrix) : 0;
+        YuvRowToBgrScalar(y_row, u_row, v_row, out, done, width, matrix);
+    }
+    return true;
+}
+
+ColorConvert::Isa ColorConvert::SupportedIsa()
+{
+    static const Isa supported = DetectIsa();
+    return supported;
+}
+
+ColorConvert::Isa ColorConvert::ActiveIsa()
+{
+    return static_cast<Isa>(ActiveIsaStorage().load(std::memory_order_relaxed));
+}
+
+void ColorConvert::SetActiveIsa(Isa isa)
+{
+    Isa supported = SupportedIsa();
+    ActiveIsaStorage().store(static_cast<int>(isa < supported ? isa : supported), std::memory_order_relaxed);
+}
+
+const char* ColorConvert::IsaName(Isa isa)
+{
+    switch (isa)
+    {
+    case Isa::None:
+        return "swscale";
+    case Isa::Scalar:
+        return "scalar";
+    case Isa::SSE41:
+        return "sse4.1";
+    case Isa::AVX2:
+        return "avx2";
+    case Isa::AVX512:
+        return "avx512";
+    }
+    return "unknown";
+}
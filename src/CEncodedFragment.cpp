@@ -0,0 +1,69 @@
+#include <iostream>
+#include <utility>
+#include <CEncodedFragment.hpp>
+
+
+EncodedFragment::EncodedFragment(AVBufferRef* buffer, size_t size, bool init, bool keyframe, int64_t start_time)
+    : mBuffer(buffer), mSize(buffer ? size : 0), mInit(init), mKeyframe(keyframe), mStartTime(start_time)
+{
+}
+
+EncodedFragment::EncodedFragment(const EncodedFragment& other)
+    : mSize(other.mSize), mInit(other.mInit), mKeyframe(other.mKeyframe), mStartTime(other.mStartTime)
+{
+    if (other.mBuffer)
+    {
+        mBuffer = av_buffer_ref(other.mBuffer);
+        if (!mBuffer)
+        {
+            std::cerr << "Could not reference fragment\n";
+            mSize = 0;
+        }
+    }
+}
+
+EncodedFragment::EncodedFragment(EncodedFragment&& other) noexcept
+    : mBuffer(other.mBuffer), mSize(other.mSize), mInit(other.mInit), mKeyframe(other.mKeyframe),
+      mStartTime(other.mStartTime)
+{
+    other.mBuffer = nullptr;
+    other.mSize = 0;
+}
+
+EncodedFragment& EncodedFragment::operator=(const EncodedFragment& other)
+{
+    if (this != &other)
+    {
+        EncodedFragment copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+EncodedFragment& EncodedFragment::operator=(EncodedFragment&& other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        mBuffer = other.mBuffer;
+        mSize = other.mSize;
+        mInit = other.mInit;
+        mKeyframe = other.mKeyframe;
+        mStartTime = other.mStartTime;
+        other.mBuffer = nullptr;
+        other.mSize = 0;
+    }
+    return *this;
+}
+
+EncodedFragment::~EncodedFragment()
+{
+    reset();
+}
+
+void EncodedFragment::reset()
+{
+    if (mBuffer)
+        av_buffer_unref(&mBuffer);
+    mSize = 0;
+}
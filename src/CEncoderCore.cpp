@@ -0,0 +1,826 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include <libavutil/opt.h>
+#include <libavutil/error.h>
+#include <libavutil/rational.h>
+#include <libswscale/swscale.h>
+}
+#include <CEncoderCore.hpp>
+#include <CColorConvert.hpp>
+#include <CFFPreset.hpp>
+
+// 90 kHz, the usual video clock: fine enough for capture jitter and exact for the common frame rates.
+static const AVRational kVfrTimeBase = { 1, 90000 };
+
+// Latency histogram: 0.1 ms buckets up to one second.
+static const double kLatencyBucketMs = 0.1;
+static const size_t kLatencyBuckets = 10000;
+// Frames the encoder may hold before a packet comes out; older entries belong to frames it dropped.
+static const size_t kMaxInFlight = 512;
+
+// Whether an Annex B H.264 packet holds an IDR slice.
+static bool ContainsIdr(const AVPacket *packet)
+{
+    const uint8_t *data = packet->data;
+    for (int i = 0; i + 3 < packet->size; i++)
+    {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && (data[i + 3] & 0x1f) == 5)
+            return true;
+    }
+    return false;
+}
+
+
+EncoderCore::~EncoderCore()
+{
+    Close();
+}
+
+bool EncoderCore::AddSink(const std::shared_ptr<PacketSink> &sink)
+{
+    if (!sink)
+        return false;
+
+    Attached attached;
+    attached.sink = sink;
+    attached.stats.name = sink->Name();
+    if (mIsOpen && !sink->Open(mContext.codec_context))
+    {
+        std::cout << "could not open sink " << attached.stats.name << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mSinksMutex);
+    mSinks.push_back(attached);
+    return true;
+}
+
+bool EncoderCore::RemoveSink(const std::shared_ptr<PacketSink> &sink)
+{
+    std::lock_guard<std::mutex> lock(mSinksMutex);
+    for (auto it = mSinks.begin(); it != mSinks.end(); ++it)
+    {
+        if (it->sink == sink)
+        {
+            it->sink->Close();
+            mSinks.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EncoderCore::Open(const Params &params)
+{
+    if (mIsOpen)
+        Close();
+
+    do
+    {
+        // The encoder is the one asked for, else the one the preset was written for, else x264.
+        FFPreset preset;
+        std::string preset_file = params.preset_file;
+        std::string encoder = params.codec;
+        if (encoder.empty() && !preset_file.empty() && preset.Load(preset_file))
+            encoder = preset.Encoder();
+        if (encoder.empty())
+            encoder = "libx264";
+        const bool x264 = encoder == "libx264";
+        const bool vpx = encoder.compare(0, 6, "libvpx") == 0;
+        const bool vp9 = encoder == "libvpx-vp9";
+        bool intra_refresh = false;
+        if (preset_file.empty() && vpx)
+            preset_file = FFPreset::Bundled(params.height, params.fps);
+        if (!preset_file.empty() && preset.Path() != preset_file && !preset.Load(preset_file))
+        {
+            if (!params.preset_file.empty())
+                break;
+            std::cout << "using the " << encoder << " defaults" << std::endl;
+        }
+
+        mContext.codec = avcodec_find_encoder_by_name(encoder.c_str());
+        if (!mContext.codec || mContext.codec->type != AVMEDIA_TYPE_VIDEO)
+        {
+            std::cout << "could not find encoder " << encoder << std::endl;
+            break;
+        }
+
+        mContext.codec_context = avcodec_alloc_context3(mContext.codec);
+        if (!mContext.codec_context)
+        {
+            std::cout << "could not allocate mContext codec context" << std::endl;
+            break;
+        }
+
+        mContext.codec_context->codec_id = mContext.codec->id;
+        mContext.codec_context->width = static_cast<int>(params.width);
+        mContext.codec_context->height = static_cast<int>(params.height);
+        mContext.codec_context->time_base = params.vfr ? kVfrTimeBase : av_d2q(1.0 / params.fps, 120);
+        // Rate control works from the nominal rate, the time base only carries the timestamps.
+        mContext.codec_context->framerate = av_d2q(params.fps, 1001000);
+        mContext.codec_context->pix_fmt = params.dst_format;
+        mContext.codec_context->gop_size = 12;
+        mContext.codec_context->max_b_frames = 2;
+
+        // Preset file, then Params::options, then the fields of Params that set the same things.
+        AVDictionary *options = nullptr;
+        if (!preset.Path().empty())
+            preset.AddTo(encoder, &options);
+        if (!params.options.empty() && av_dict_parse_string(&options, params.options.c_str(), "=", ":", 0) < 0)
+        {
+            std::cout << "could not parse encoder options: " << params.options << std::endl;
+            av_dict_free(&options);
+            break;
+        }
+        int ret = av_opt_set_dict2(mContext.codec_context, &options, AV_OPT_SEARCH_CHILDREN);
+        const AVDictionaryEntry *unused = nullptr;
+        while ((unused = av_dict_get(options, "", unused, AV_DICT_IGNORE_SUFFIX)))
+            std::cout << encoder << " has no option " << unused->key << ", ignored" << std::endl;
+        av_dict_free(&options);
+        if (ret < 0)
+        {
+            std::cout << "could not set the encoder options" << std::endl;
+            break;
+        }
+
+        if (params.bitrate)
+            mContext.codec_context->bit_rate = params.bitrate;
+        if (params.gop_size > 0)
+            mContext.codec_context->gop_size = params.gop_size;
+        if (params.keyframe_interval > 0.0)
+        {
+            // Only a backstop: ForceKeyframe places the keyframes.
+            mContext.codec_context->gop_size = 2 * static_cast<int>(std::ceil(params.keyframe_interval * params.fps));
+        }
+        if (params.max_bitrate)
+        {
+            mContext.codec_context->rc_max_rate = params.max_bitrate;
+            mContext.codec_context->rc_buffer_size = static_cast<int>(params.max_bitrate);
+        }
+        if (params.low_latency)
+            mContext.codec_context->max_b_frames = 0;
+
+        mContext.codec_context->thread_count = params.threads > 0 ? params.threads : 0;
+        Threading threading = params.threading;
+        // Slice threads split each frame instead of keeping one frame in flight per thread.
+        if (threading == Threading::Auto && params.low_latency)
+            threading = Threading::Slice;
+        switch (threading)
+        {
+        case Threading::Frame:
+            mContext.codec_context->thread_type = FF_THREAD_FRAME;
+            break;
+        case Threading::Slice:
+            mContext.codec_context->thread_type = FF_THREAD_SLICE;
+            break;
+        case Threading::Auto:
+            break;
+        }
+
+        if (params.global_header)
+            mContext.codec_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+        if (x264)
+        {
+            if (params.preset)
+            {
+                ret = av_opt_set(mContext.codec_context->priv_data, "preset", params.preset, 0);
+                if (ret != 0)
+                {
+                    std::cout << "could not set preset: " << params.preset << std::endl;
+                    break;
+                }
+            }
+
+            ret = av_opt_set_int(mContext.codec_context->priv_data, "crf", params.crf, 0);
+            if (ret != 0)
+            {
+                std::cout << "could not set crf: " << params.crf << std::endl;
+                break;
+            }
+
+            if (params.low_latency)
+            {
+                // zerolatency already turns the lookahead off, rc-lookahead keeps it off whatever the preset says.
+                if (av_opt_set(mContext.codec_context->priv_data, "tune", "zerolatency", 0) != 0 ||
+                    av_opt_set_int(mContext.codec_context->priv_data, "rc-lookahead", 0, 0) != 0)
+                {
+                    std::cout << "could not set the low-latency options" << std::endl;
+                    break;
+                }
+                // Spreads the intra blocks of a keyframe over the GOP, so the bitrate has no spike every gop_size frames.
+                // Refresh points are not IDR frames: FlushPackets clears their keyframe flag, so only forced or
+                // requested IDR frames are keyframes, where fragments are cut and clients start.
+                if (params.intra_refresh && params.keyframe_interval <= 0.0)
+                {
+                    if (av_opt_set_int(mContext.codec_context->priv_data, "intra-refresh", 1, 0) != 0)
+                    {
+                        std::cout << "could not enable intra refresh" << std::endl;
+                        break;
+                    }
+                    intra_refresh = true;
+                }
+            }
+
+            // Forced keyframes, scheduled or requested, are IDR frames a client can start or switch at.
+            if (av_opt_set_int(mContext.codec_context->priv_data, "forced-idr", 1, 0) != 0 ||
+                (params.keyframe_interval > 0.0 && av_opt_set_int(mContext.codec_context->priv_data, "sc_threshold", 0, 0) != 0))
+            {
+                std::cout << "could not set the keyframe options" << std::endl;
+                break;
+            }
+        }
+
+        std::string threading_name = threading == Threading::Frame ? "frame" : threading == Threading::Slice ? "slice" : "default";
+        if (vpx)
+        {
+            if (params.low_latency)
+            {
+                // Realtime mode codes each frame as it comes, without the alt-ref lookahead.
+                if (av_opt_set(mContext.codec_context->priv_data, "deadline", "realtime", 0) != 0 ||
+                    av_opt_set_int(mContext.codec_context->priv_data, "lag-in-frames", 0, 0) != 0)
+                {
+                    std::cout << "could not set the low-latency options" << std::endl;
+                    break;
+                }
+            }
+            // libvpx threads within each frame: VP8 over the token partitions ("slices"), VP9 over tile
+            // columns, which row-mt splits further into rows so threads beyond the columns still help.
+            threading_name = "partition";
+            if (vp9)
+            {
+                int threads = params.threads > 0 ? params.threads : static_cast<int>(std::thread::hardware_concurrency());
+                int64_t tile_columns = -1;
+                av_opt_get_int(mContext.codec_context->priv_data, "tile-columns", 0, &tile_columns);
+                if (tile_columns < 0)
+                {
+                    // Tiles are at least 256 pixels wide.
+                    int columns = std::max(1, std::min(threads, static_cast<int>(params.width) / 256));
+                    tile_columns = 0;
+                    while ((2 << tile_columns) <= columns)
+                        tile_columns++;
+                }
+                if (av_opt_set_int(mContext.codec_context->priv_data, "tile-columns", tile_columns, 0) != 0 ||
+                    av_opt_set_int(mContext.codec_context->priv_data, "row-mt", 1, 0) != 0)
+                {
+                    std::cout << "could not set the tile options" << std::endl;
+                    break;
+                }
+                threading_name = "tile (" + std::to_string(1 << tile_columns) + " columns) and row";
+            }
+        }
+
+        ret = avcodec_open2(mContext.codec_context, mContext.codec, nullptr);
+        if (ret != 0)
+        {
+            std::cout << "could not open codec: " << ret << std::endl;
+            break;
+        }
+
+        std::cout << "Encoder " << mContext.codec->name << (preset.Path().empty() ? std::string() : " (" + preset.Path() + ")") << ": "
+                  << (mContext.codec_context->thread_count ? std::to_string(mContext.codec_context->thread_count) : std::string("auto"))
+                  << " thread(s), " << threading_name << " threading" << std::endl;
+
+        mContext.frame = av_frame_alloc();
+        if (!mContext.frame)
+        {
+            std::cout << "could not allocate mContext frame" << std::endl;
+            break;
+        }
+        mContext.frame->format = mContext.codec_context->pix_fmt;
+        mContext.frame->width = mContext.codec_context->width;
+        mContext.frame->height = mContext.codec_context->height;
+
+        ret = av_frame_get_buffer(mContext.frame, 32);
+        if (ret < 0)
+        {
+            std::cout << "could not allocate the mContext frame data" << std::endl;
+            break;
+        }
+
+        // Raw RGB24 input at the encoder size needs no scaling: the vector kernel replaces the bicubic pass.
+        mContext.rgb_kernel = ColorConvert::CanConvert(params.src_format, params.dst_format);
+        if (!mContext.rgb_kernel)
+        {
+            mContext.sws_context = sws_getContext(
+                mContext.codec_context->width, mContext.codec_context->height, params.src_format,   // src
+                mContext.codec_context->width, mContext.codec_context->height, params.dst_format, // dst
+                SWS_BICUBIC, nullptr, nullptr, nullptr
+            );
+            if (!mContext.sws_context)
+            {
+                std::cout << "could not initialize the conversion context" << std::endl;
+                break;
+            }
+        }
+
+        FrameConverter::Params converter_params;
+        converter_params.format = params.dst_format;
+        converter_params.width = mContext.codec_context->width;
+        converter_params.height = mContext.codec_context->height;
+        converter_params.flags = SWS_BICUBIC;
+        converter_params.threads = params.scale_threads;
+        mConverter.SetParams(converter_params);
+
+        mContext.input_frame = av_frame_alloc();
+        mContext.packet = av_packet_alloc();
+        if (!mContext.input_frame || !mContext.packet)
+        {
+            std::cout << "could not allocate mContext input frame" << std::endl;
+            break;
+        }
+
+        // Sinks are opened last, so they see the extradata avcodec_open2 produced.
+        bool sinks_open = true;
+        {
+            std::lock_guard<std::mutex> lock(mSinksMutex);
+            for (Attached &attached : mSinks)
+            {
+                attached.started = false;
+                attached.stats = SinkStats();
+                attached.stats.name = attached.sink->Name();
+                if (!attached.sink->Open(mContext.codec_context))
+                {
+                    std::cout << "could not open sink " << attached.stats.name << std::endl;
+                    sinks_open = false;
+                    break;
+                }
+            }
+        }
+        if (!sinks_open)
+            break;
+
+        mContext.frame_index = 0;
+        mContext.vfr = params.vfr;
+        mContext.rebase_pts = params.rebase_pts;
+        mContext.keyframe_interval = params.keyframe_interval;
+        mContext.intra_refresh = intra_refresh;
+        mInFlight.clear();
+        mPendingBitrate.store(0);
+        mPendingCrf.store(-1);
+        mKeyframeRequested.store(false);
+        {
+            std::lock_guard<std::mutex> lock(mRequestMutex);
+            mKeyframeRequests.clear();
+            mLastRequestAt = AV_NOPTS_VALUE;
+            mRequestSpacing = static_cast<int64_t>(std::max(params.keyframe_request_spacing, 0.0) * AV_TIME_BASE);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mLatencyMutex);
+            mLatency = Latency();
+            mLatency.histogram.assign(kLatencyBuckets + 1, 0);
+        }
+        mIsOpen = true;
+        return true;
+    } while (false);
+
+    Close();
+
+    return false;
+}
+
+void EncoderCore::Close()
+{
+    if (mIsOpen)
+    {
+        avcodec_send_frame(mContext.codec_context, nullptr);
+        FlushPackets();
+
+        LatencyStats latency = GetLatency();
+        std::cout << "encoder latency: " << latency.frames << " frames, average " << latency.average_ms << " ms, p50 "
+                  << latency.p50_ms << " ms, p95 " << latency.p95_ms << " ms, max " << latency.max_ms << " ms, "
+                  << latency.average_frames << " frames behind" << std::endl;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mSinksMutex);
+        for (Attached &attached : mSinks)
+        {
+            if (mIsOpen)
+            {
+                std::cout << "sink " << attached.stats.name << ": " << attached.stats.packets << " packets, "
+                          << attached.stats.bytes << " bytes" << std::endl;
+            }
+            attached.sink->Close();
+        }
+        mSinks.clear();
+    }
+
+    FreeContext();
+    mIsOpen = false;
+}
+
+void EncoderCore::FreeContext()
+{
+    if (mContext.sws_context)
+        sws_freeContext(mContext.sws_context);
+
+    mConverter.Reset();
+
+    if (mContext.frame)
+        av_frame_free(&mContext.frame);
+
+    if (mContext.input_frame)
+        av_frame_free(&mContext.input_frame);
+
+    if (mContext.packet)
+        av_packet_free(&mContext.packet);
+
+    if (mContext.codec_context)
+        avcodec_free_context(&mContext.codec_context);
+
+    mContext = {};
+}
+
+bool EncoderCore::Write(const unsigned char *data)
+{
+    if (!mIsOpen)
+        return false;
+    ApplyRate();
+
+    auto input = std::chrono::steady_clock::now();
+    auto ret = av_frame_make_writable(mContext.frame);
+    if (ret < 0)
+    {
+        std::cout << "frame not writable" << std::endl;
+        return false;
+    }
+
+    const int in_linesize[1] = { mContext.codec_context->width * 3 };
+
+    if (mContext.rgb_kernel)
+    {
+        ColorConvert::RGB24ToI420(data, in_linesize[0], mContext.frame->data, mContext.frame->linesize,
+            mContext.codec_context->width, mContext.codec_context->height);
+    }
+    else
+    {
+        sws_scale(
+            mContext.sws_context,
+            &data, in_linesize, 0, mContext.codec_context->height,  // src
+            mContext.frame->data, mContext.frame->linesize // dst
+        );
+    }
+    mContext.frame->pts = NextPts(nullptr);
+    mContext.frame->pict_type = AV_PICTURE_TYPE_NONE;
+    ForceKeyframe(mContext.frame);
+
+    ret = avcodec_send_frame(mContext.codec_context, mContext.frame);
+    if (ret < 0)
+    {
+        std::cout << "error sending a frame for encoding" << std::endl;
+        return false;
+    }
+    MarkInput(mContext.last_pts, input);
+
+    return FlushPackets();
+}
+
+bool EncoderCore::Write(const AVFrame *frame)
+{
+    if (!mIsOpen)
+        return false;
+    ApplyRate();
+
+    auto input = std::chrono::steady_clock::now();
+    AVFrame *encode_frame = nullptr;
+    int ret = 0;
+    if (frame->format == mContext.codec_context->pix_fmt &&
+        frame->width == mContext.codec_context->width &&
+        frame->height == mContext.codec_context->height)
+    {
+        // Same format and size: the encoder takes its own reference, no copy needed.
+        ret = av_frame_ref(mContext.input_frame, frame);
+        if (ret < 0)
+        {
+            std::cout << "could not reference input frame" << std::endl;
+            return false;
+        }
+        encode_frame = mContext.input_frame;
+    }
+    else
+    {
+        ret = av_frame_make_writable(mContext.frame);
+        if (ret < 0)
+        {
+            std::cout << "frame not writable" << std::endl;
+            return false;
+        }
+
+        if (!mConverter.Convert(frame, mContext.frame))
+        {
+            std::cout << "could not convert input frame" << std::endl;
+            return false;
+        }
+        encode_frame = mContext.frame;
+    }
+    // Do not let the decoder's picture type force keyframes.
+    encode_frame->pict_type = AV_PICTURE_TYPE_NONE;
+    encode_frame->pts = NextPts(frame);
+    ForceKeyframe(encode_frame);
+    encode_frame->duration = 0;
+    if (mContext.vfr && frame->duration > 0 && frame->time_base.num > 0)
+        encode_frame->duration = av_rescale_q(frame->duration, frame->time_base, mContext.codec_context->time_base);
+
+    ret = avcodec_send_frame(mContext.codec_context, encode_frame);
+    av_frame_unref(mContext.input_frame);
+    if (ret < 0)
+    {
+        std::cout << "error sending a frame for encoding" << std::endl;
+        return false;
+    }
+    MarkInput(mContext.last_pts, input);
+
+    return FlushPackets();
+}
+
+int64_t EncoderCore::NextPts(const AVFrame *frame)
+{
+    const AVRational time_base = mContext.codec_context->time_base;
+    int64_t pts;
+    if (mContext.vfr && frame && frame->pts != AV_NOPTS_VALUE && frame->time_base.num > 0)
+    {
+        if (mContext.first_pts == AV_NOPTS_VALUE)
+            mContext.first_pts = mContext.rebase_pts ? frame->pts : 0;
+        pts = av_rescale_q(frame->pts - mContext.first_pts, frame->time_base, time_base);
+    }
+    else
+    {
+        pts = av_rescale_q(mContext.frame_index, av_inv_q(mContext.codec_context->framerate), time_base);
+    }
+    mContext.frame_index++;
+
+    if (mContext.last_pts != AV_NOPTS_VALUE && pts <= mContext.last_pts)
+        pts = mContext.last_pts + 1;
+    mContext.last_pts = pts;
+    return pts;
+}
+
+void EncoderCore::ForceKeyframe(AVFrame *frame)
+{
+    double seconds = frame->pts * av_q2d(mContext.codec_context->time_base);
+    bool force = false;
+    if (mContext.keyframe_interval > 0.0)
+    {
+        int64_t slot = static_cast<int64_t>(std::floor(seconds / mContext.keyframe_interval));
+        if (slot != mContext.keyframe_slot)
+        {
+            force = true;
+            mContext.keyframe_slot = slot;
+        }
+    }
+
+    // Tested against the instants rather than when the requests came in, which differs per encoder thread.
+    if (mKeyframeRequested.load())
+    {
+        int64_t time = av_rescale_q(frame->pts, mContext.codec_context->time_base, AV_TIME_BASE_Q);
+        std::lock_guard<std::mutex> lock(mRequestMutex);
+        while (!mKeyframeRequests.empty() && time >= mKeyframeRequests.front())
+        {
+            mKeyframeRequests.pop_front();
+            force = true;
+        }
+        mKeyframeRequested.store(!mKeyframeRequests.empty());
+    }
+
+    if (force)
+        frame->pict_type = AV_PICTURE_TYPE_I;
+}
+
+void EncoderCore::MarkInput(int64_t pts, std::chrono::steady_clock::time_point input)
+{
+    if (mInFlight.size() >= kMaxInFlight)
+        mInFlight.pop_front();
+    mInFlight.push_back({ pts, input, mContext.frame_index - 1 });
+}
+
+void EncoderCore::MarkOutput(const AVPacket *packet)
+{
+    // Packets come out in decoding order, so with B-frames the frame is not always the oldest one.
+    auto it = std::find_if(mInFlight.begin(), mInFlight.end(),
+                           [packet](const InFlight &frame) { return frame.pts == packet->pts; });
+    if (it == mInFlight.end())
+        return;
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - it->input).count();
+    uint32_t behind = mContext.frame_index - 1 - it->index;
+    mInFlight.erase(it);
+
+    std::lock_guard<std::mutex> lock(mLatencyMutex);
+    mLatency.frames++;
+    mLatency.total_ms += ms;
+    mLatency.max_ms = std::max(mLatency.max_ms, ms);
+    mLatency.total_frames += behind;
+    size_t bucket = std::min(static_cast<size_t>(ms / kLatencyBucketMs), kLatencyBuckets);
+    if (bucket < mLatency.histogram.size())
+        mLatency.histogram[bucket]++;
+}
+
+EncoderCore::LatencyStats EncoderCore::GetLatency() const
+{
+    std::lock_guard<std::mutex> lock(mLatencyMutex);
+    LatencyStats stats;
+    stats.frames = mLatency.frames;
+    if (!mLatency.frames)
+        return stats;
+
+    stats.average_ms = mLatency.total_ms / mLatency.frames;
+    stats.max_ms = mLatency.max_ms;
+    stats.average_frames = static_cast<double>(mLatency.total_frames) / mLatency.frames;
+
+    // Upper edge of the bucket holding the percentile, never above the largest delay seen.
+    auto percentile = [&](double fraction) {
+        uint64_t rank = static_cast<uint64_t>(fraction * mLatency.frames + 0.5);
+        uint64_t count = 0;
+        for (size_t i = 0; i < mLatency.histogram.size(); i++)
+        {
+            count += mLatency.histogram[i];
+            if (count >= rank && count > 0)
+                return std::min((i + 1) * kLatencyBucketMs, mLatency.max_ms);
+        }
+        return mLatency.max_ms;
+    };
+    stats.p50_ms = percentile(0.50);
+    stats.p95_ms = percentile(0.95);
+    return stats;
+}
+
+bool EncoderCore::SetBitrate(uint32_t bitrate)
+{
+    if (!bitrate)
+        return false;
+    mPendingBitrate.store(bitrate);
+    return true;
+}
+
+bool EncoderCore::SetCrf(uint32_t crf)
+{
+    if (crf > 63)
+        return false;
+    mPendingCrf.store(static_cast<int>(crf));
+    return true;
+}
+
+void EncoderCore::ApplyRate()
+{
+    AVCodecContext *codec_context = mContext.codec_context;
+    uint32_t bitrate = mPendingBitrate.exchange(0);
+    if (bitrate)
+    {
+        codec_context->bit_rate = bitrate;
+        if (codec_context->rc_buffer_size > 0)
+        {
+            codec_context->rc_max_rate = bitrate;
+            codec_context->rc_buffer_size = static_cast<int>(bitrate);
+        }
+    }
+
+    // libx264 compares these with its running configuration before each frame and reconfigures.
+    int crf = mPendingCrf.exchange(-1);
+    if (crf >= 0 && av_opt_set_int(codec_context->priv_data, "crf", crf, 0) != 0)
+        std::cout << "could not set crf: " << crf << std::endl;
+}
+
+bool EncoderCore::RequestKeyframe(int64_t at)
+{
+    if (at == AV_NOPTS_VALUE)
+        return false;
+    std::lock_guard<std::mutex> lock(mRequestMutex);
+    if (mLastRequestAt != AV_NOPTS_VALUE && at < mLastRequestAt + mRequestSpacing)
+        return false;
+    mLastRequestAt = at;
+    mKeyframeRequests.push_back(at);
+    mKeyframeRequested.store(true);
+    return true;
+}
+
+bool EncoderCore::IsOpen() const
+{
+    return mIsOpen;
+}
+
+const AVCodecContext *EncoderCore::CodecContext() const
+{
+    return mIsOpen ? mContext.codec_context : nullptr;
+}
+
+void EncoderCore::ThreadingFromEnvironment(Params &params)
+{
+    const char *env_threads = std::getenv("ENCODE_THREADS");
+    if (env_threads)
+        params.threads = std::atoi(env_threads);
+
+    const char *env_threading = std::getenv("ENCODE_THREADING");
+    if (env_threading)
+    {
+        std::string threading = env_threading;
+        if (threading == "frame")
+            params.threading = Threading::Frame;
+        else if (threading == "slice")
+            params.threading = Threading::Slice;
+        else
+            params.threading = Threading::Auto;
+    }
+}
+
+void EncoderCore::CodecFromEnvironment(Params &params)
+{
+    const char *env_codec = std::getenv("ENCODE_CODEC");
+    if (env_codec)
+    {
+        std::string codec = env_codec;
+        if (codec == "h264")
+            params.codec = "libx264";
+        else if (codec == "vp8")
+            params.codec = "libvpx";
+        else if (codec == "vp9")
+            params.codec = "libvpx-vp9";
+        else
+            params.codec = codec;
+    }
+
+    const char *env_preset_file = std::getenv("ENCODE_PRESET_FILE");
+    if (env_preset_file)
+        params.preset_file = env_preset_file;
+
+    const char *env_options = std::getenv("ENCODE_OPTIONS");
+    if (env_options)
+        params.options = env_options;
+}
+
+std::vector<EncoderCore::SinkStats> EncoderCore::GetStats() const
+{
+    std::vector<SinkStats> stats;
+    std::lock_guard<std::mutex> lock(mSinksMutex);
+    for (const Attached &attached : mSinks)
+        stats.push_back(attached.stats);
+    return stats;
+}
+
+bool EncoderCore::FlushPackets()
+{
+    bool ok = true;
+    AVPacket *packet = mContext.packet;
+    for (;;)
+    {
+        int ret = avcodec_receive_packet(mContext.codec_context, packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            break;
+
+        if (ret < 0)
+        {
+            std::cout << "error encoding a frame: " << ret << std::endl;
+            return false;
+        }
+        // Keep the encoder's own pts/dts: they follow the capture timestamps and account for B-frame reordering.
+        if (packet->pts == AV_NOPTS_VALUE || packet->dts == AV_NOPTS_VALUE)
+        {
+            std::cerr << "Error: PTS or DTS is not set" << std::endl;
+            av_packet_unref(packet);
+            return false;
+        }
+        if (packet->duration <= 0)
+            packet->duration = av_rescale_q(1, av_inv_q(mContext.codec_context->framerate), mContext.codec_context->time_base);
+        MarkOutput(packet);
+        // x264 flags the start of each refresh cycle, a P frame, as a keyframe. Nothing can start decoding there:
+        // keep the flag for IDR frames so sinks and fragment caches only start at those.
+        if (mContext.intra_refresh && (packet->flags & AV_PKT_FLAG_KEY) && !ContainsIdr(packet))
+            packet->flags &= ~AV_PKT_FLAG_KEY;
+
+        {
+            std::lock_guard<std::mutex> lock(mSinksMutex);
+            for (auto it = mSinks.begin(); it != mSinks.end();)
+            {
+                // A sink attached mid-stream cannot decode anything before the next keyframe.
+                if (!it->started && !(packet->flags & AV_PKT_FLAG_KEY))
+                {
+                    it->stats.skipped++;
+                    ++it;
+                    continue;
+                }
+                it->started = true;
+
+                if (!it->sink->Write(packet))
+                {
+                    std::cout << "closing sink " << it->stats.name << " after a write error" << std::endl;
+                    it->sink->Close();
+                    it = mSinks.erase(it);
+                    ok = false;
+                    continue;
+                }
+                it->stats.packets++;
+                it->stats.bytes += packet->size;
+                ++it;
+            }
+        }
+        av_packet_unref(packet);
+    }
+
+    return ok;
+}
@@ -0,0 +1,81 @@
+#include <fstream>
+#include <iostream>
+#include <CFFPreset.hpp>
+
+namespace {
+
+const char *kPresetDirectory = "presets/";
+
+std::string Trim(const std::string &text)
+{
+    const char *blanks = " \t\r\n";
+    size_t first = text.find_first_not_of(blanks);
+    if (first == std::string::npos)
+        return std::string();
+    return text.substr(first, text.find_last_not_of(blanks) - first + 1);
+}
+
+}
+
+
+bool FFPreset::Load(const std::string &path)
+{
+    mPath.clear();
+    mEncoder.clear();
+    mOptions.clear();
+
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cout << "could not open preset " << path << std::endl;
+        return false;
+    }
+    mPath = path;
+
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line))
+    {
+        number++;
+        line = Trim(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        size_t equals = line.find('=');
+        std::string key = equals == std::string::npos ? std::string() : Trim(line.substr(0, equals));
+        if (key.empty())
+        {
+            std::cerr << path << ":" << number << ": ignoring \"" << line << "\", expected key=value\n";
+            continue;
+        }
+        std::string value = Trim(line.substr(equals + 1));
+
+        if (key == "vcodec")
+            mEncoder = value;
+        else
+            mOptions.push_back(Option(key == "vprofile" ? "profile" : key, value));
+    }
+    return true;
+}
+
+void FFPreset::AddTo(const std::string &encoder, AVDictionary **options) const
+{
+    for (const Option &option : mOptions)
+    {
+        if (option.first == "profile" && !mEncoder.empty() && mEncoder != encoder)
+            continue;
+        av_dict_set(options, option.first.c_str(), option.second.c_str(), 0);
+    }
+}
+
+std::string FFPreset::Bundled(uint32_t height, double fps)
+{
+    std::string name;
+    if (height <= 480)
+        name = "360p";
+    else if (height <= 720)
+        name = fps > 30.5 ? "720p50_60" : "720p";
+    else
+        name = fps > 30.5 ? "1080p50_60" : "1080p";
+    return std::string(kPresetDirectory) + "libvpx-" + name + ".ffpreset";
+}
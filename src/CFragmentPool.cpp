@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <iostream>
+#include <CFragmentPool.hpp>
+
+namespace {
+
+constexpr size_t kGranularity = 4096; // buffer sizes are whole pages
+constexpr size_t kInitialSize = 64 * 1024; // until the first fragment is recorded
+constexpr double kAverageWeight = 1.0 / 16; // weight of the newest fragment in the running average
+
+size_t TargetSize(double average)
+{
+    size_t target = static_cast<size_t>(average * 2.0);
+    target = (target + kGranularity - 1) / kGranularity * kGranularity;
+    return std::max(target, kGranularity);
+}
+
+}
+
+
+FragmentPool::~FragmentPool()
+{
+    Reset();
+}
+
+AVBufferRef* FragmentPool::Acquire()
+{
+    if (!mPool)
+    {
+        mPool = av_buffer_pool_init(mBufferSize, nullptr);
+        if (!mPool)
+        {
+            std::cerr << "Could not allocate fragment pool\n";
+            return nullptr;
+        }
+    }
+    return av_buffer_pool_get(mPool);
+}
+
+bool FragmentPool::Reserve(AVBufferRef** buffer, size_t size)
+{
+    if (*buffer && (*buffer)->size >= size)
+        return true;
+
+    size_t current = *buffer ? (*buffer)->size : 0;
+    if (av_buffer_realloc(buffer, std::max(size, current * 2)) < 0)
+    {
+        std::cerr << "Could not grow fragment buffer\n";
+        return false;
+    }
+    if (current)
+        mGrown++;
+    return true;
+}
+
+void FragmentPool::Record(size_t size)
+{
+    mAverage = mCount ? mAverage + (static_cast<double>(size) - mAverage) * kAverageWeight : static_cast<double>(size);
+    mCount++;
+
+    // Resize only when the buffers are too small or more than twice too big, not on every wobble. Growing at
+    // least doubles the size, so a bitrate ramp replaces the pool a few times rather than on every fragment.
+    size_t target = TargetSize(mAverage);
+    if (target > mBufferSize || target * 2 < mBufferSize)
+    {
+        // Buffers taken from the old pool are freed when released.
+        av_buffer_pool_uninit(&mPool);
+        mBufferSize = target > mBufferSize ? std::max(target, mBufferSize * 2) : target;
+        mResizes++;
+    }
+}
+
+void FragmentPool::Reset()
+{
+    av_buffer_pool_uninit(&mPool);
+    mBufferSize = kInitialSize;
+    mAverage = 0.0;
+    mCount = 0;
+}
+
+size_t FragmentPool::BufferSize() const
+{
+    return mBufferSize;
+}
+
+size_t FragmentPool::AverageSize() const
+{
+    return static_cast<size_t>(mAverage);
+}
+
+uint64_t FragmentPool::Grown() const
+{
+    return mGrown;
+}
+
+uint64_t FragmentPool::Resizes() const
+{
+    return mResizes;
+}
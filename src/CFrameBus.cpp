@@ -0,0 +1,157 @@
+#include <iomanip>
+
+#include <CFrameBus.hpp>
+
+
+FrameBus::~FrameBus()
+{
+    Clear();
+}
+
+void FrameBus::Subscribe(Observer* observer, const Params& params)
+{
+    if (!observer)
+        return;
+    Unsubscribe(observer);
+
+    std::unique_ptr<Subscriber> subscriber(new Subscriber());
+    subscriber->observer = observer;
+    subscriber->params = params;
+    if (params.format != AV_PIX_FMT_NONE)
+    {
+        FrameConverter::Params converter;
+        converter.format = params.format;
+        converter.width = params.width;
+        converter.height = params.height;
+        converter.threads = params.scale_threads;
+        // One frame in the observer's hands and one being converted.
+        converter.pool_size = 2;
+        subscriber->converter.SetParams(converter);
+    }
+    Subscriber* raw = subscriber.get();
+    subscriber->thread = std::thread([raw]() { Deliver(*raw); });
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSubscribers.push_back(std::move(subscriber));
+}
+
+bool FrameBus::Unsubscribe(Observer* observer)
+{
+    std::unique_ptr<Subscriber> removed;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto it = mSubscribers.begin(); it != mSubscribers.end(); ++it)
+        {
+            if ((*it)->observer == observer)
+            {
+                removed = std::move(*it);
+                mSubscribers.erase(it);
+                break;
+            }
+        }
+    }
+    if (!removed)
+        return false;
+
+    // Joined outside the lock so Publish is never held up by a delivery in progress.
+    Stop(*removed);
+    return true;
+}
+
+void FrameBus::Clear()
+{
+    std::vector<std::unique_ptr<Subscriber>> removed;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        removed.swap(mSubscribers);
+    }
+    for (auto& subscriber : removed)
+        Stop(*subscriber);
+}
+
+bool FrameBus::HasSubscribers() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return !mSubscribers.empty();
+}
+
+void FrameBus::Publish(const VideoFrame& frame)
+{
+    if (!frame)
+        return;
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& subscriber : mSubscribers)
+        subscriber->mailbox.push(frame);
+}
+
+std::vector<FrameBus::Stats> FrameBus::GetStats() const
+{
+    std::vector<Stats> stats;
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (const auto& subscriber : mSubscribers)
+    {
+        ThreadSafeQueue<VideoFrame>::Stats mailbox = subscriber->mailbox.stats();
+        Stats entry;
+        entry.name = subscriber->params.name;
+        entry.published = mailbox.pushed;
+        entry.delivered = subscriber->delivered.load();
+        entry.skipped = mailbox.dropped + subscriber->failed.load();
+        stats.push_back(entry);
+    }
+    return stats;
+}
+
+void FrameBus::Report(std::ostream& out) const
+{
+    for (const Stats& stats : GetStats())
+    {
+        out << std::left << std::setw(10) << stats.name << std::right
+            << " published " << stats.published
+            << ", delivered " << stats.delivered
+            << ", skipped " << stats.skipped << std::endl;
+    }
+}
+
+void FrameBus::Deliver(Subscriber& subscriber)
+{
+    VideoFrame frame;
+    while (subscriber.mailbox.pop(frame))
+    {
+        if (NeedsConversion(subscriber, frame))
+        {
+            AVFrame* converted = subscriber.converter.Convert(frame.get());
+            if (!converted)
+            {
+                subscriber.failed++;
+                frame.reset();
+                continue;
+            }
+            frame = VideoFrame(converted, frame.captureTime());
+        }
+
+        subscriber.observer->update(frame);
+        subscriber.delivered++;
+        // Release the buffer before waiting, so an idle observer does not pin a pooled frame.
+        frame.reset();
+    }
+}
+
+bool FrameBus::NeedsConversion(const Subscriber& subscriber, const VideoFrame& frame)
+{
+    const Params& params = subscriber.params;
+    if (params.format == AV_PIX_FMT_NONE)
+        return false;
+    bool sized = (!params.width || params.width == frame.width()) && (!params.height || params.height == frame.height());
+    if (!sized)
+        return true;
+    if (frame.format() == params.format)
+        return false;
+    return !(params.accepts && params.accepts(frame.format()));
+}
+
+void FrameBus::Stop(Subscriber& subscriber)
+{
+    subscriber.mailbox.close();
+    if (subscriber.thread.joinable())
+        subscriber.thread.join();
+}
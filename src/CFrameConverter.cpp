@@ -0,0 +1,166 @@
+#include <iostream>
+#include <thread>
+#include <cstdlib>
+
+extern "C" {
+#include <libswscale/swscale.h>
+#include <libavutil/opt.h>
+}
+#include <CFrameConverter.hpp>
+#include <CColorConvert.hpp>
+
+
+FrameConverter::~FrameConverter()
+{
+    Reset();
+}
+
+void FrameConverter::SetParams(const Params& params)
+{
+    Reset();
+    mParams = params;
+}
+
+bool FrameConverter::Matches(const AVFrame* frame) const
+{
+    return frame->format == mParams.format &&
+        frame->width == TargetWidth(frame) &&
+        frame->height == TargetHeight(frame);
+}
+
+AVFrame* FrameConverter::Convert(const AVFrame* frame)
+{
+    int width = TargetWidth(frame);
+    int height = TargetHeight(frame);
+    if (!mPool.Matches(mParams.format, width, height))
+    {
+        mDroppedBefore += mPool.Exhausted();
+        FramePool::Params params;
+        params.format = mParams.format;
+        params.width = width;
+        params.height = height;
+        params.count = mParams.pool_size ? mParams.pool_size : Params().pool_size;
+        params.huge_pages = mParams.huge_pages;
+        if (!mPool.Init(params))
+        {
+            std::cerr << "Could not allocate converted frame pool\n";
+            return nullptr;
+        }
+    }
+
+    AVFrame* output = mPool.Acquire();
+    if (!output)
+        return nullptr; // every pooled frame is still queued, drop this one
+
+    if (!Convert(frame, output))
+    {
+        av_frame_free(&output);
+        return nullptr;
+    }
+    return output;
+}
+
+bool FrameConverter::Convert(const AVFrame* frame, AVFrame* output)
+{
+    // Same size RGB24 to YUV420P needs no filtering, the vector kernel does it in a fraction of the time.
+    if (ColorConvert::Convert(frame, output))
+    {
+        av_frame_copy_props(output, frame);
+        return true;
+    }
+
+    SwsContext* context = GetContext(frame);
+    if (!context)
+        return false;
+
+    av_frame_copy_props(output, frame);
+    // sws_scale_frame goes through the slice API, which is what spreads the work over the context's threads.
+    int ret = sws_scale_frame(context, output, frame);
+    if (ret < 0)
+    {
+        std::cerr << "Could not convert frame: " << ret << "\n";
+        return false;
+    }
+    return true;
+}
+
+uint64_t FrameConverter::DroppedFrames() const
+{
+    return mDroppedBefore + mPool.Exhausted();
+}
+
+void FrameConverter::Reset()
+{
+    if (mContext)
+        sws_freeContext(mContext);
+    mContext = nullptr;
+    mSourceFormat = AV_PIX_FMT_NONE;
+    mSourceWidth = mSourceHeight = 0;
+
+    mDroppedBefore += mPool.Exhausted();
+    mPool.Destroy();
+}
+
+int FrameConverter::ThreadsFromEnvironment()
+{
+    const char* env_threads = std::getenv("SCALER_THREADS");
+    return env_threads ? std::atoi(env_threads) : 0;
+}
+
+SwsContext* FrameConverter::GetContext(const AVFrame* frame)
+{
+    if (mContext && frame->format == mSourceFormat && frame->width == mSourceWidth && frame->height == mSourceHeight)
+        return mContext;
+
+    if (mContext)
+        sws_freeContext(mContext);
+
+    int threads = mParams.threads;
+    if (threads <= 0)
+    {
+        // Beyond a handful of slices the per-slice setup outweighs the gain at video resolutions.
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+        if (threads > 8)
+            threads = 8;
+        if (threads < 1)
+            threads = 1;
+    }
+
+    mContext = sws_alloc_context();
+    if (!mContext)
+    {
+        std::cerr << "Could not allocate sws context\n";
+        return nullptr;
+    }
+    av_opt_set_int(mContext, "srcw", frame->width, 0);
+    av_opt_set_int(mContext, "srch", frame->height, 0);
+    av_opt_set_int(mContext, "src_format", frame->format, 0);
+    av_opt_set_int(mContext, "dstw", TargetWidth(frame), 0);
+    av_opt_set_int(mContext, "dsth", TargetHeight(frame), 0);
+    av_opt_set_int(mContext, "dst_format", mParams.format, 0);
+    av_opt_set_int(mContext, "sws_flags", mParams.flags ? mParams.flags : SWS_BICUBIC, 0);
+    av_opt_set_int(mContext, "threads", threads, 0);
+
+    if (sws_init_context(mContext, nullptr, nullptr) < 0)
+    {
+        std::cerr << "Could not initialize sws context\n";
+        sws_freeContext(mContext);
+        mContext = nullptr;
+        return nullptr;
+    }
+
+    mSourceFormat = frame->format;
+    mSourceWidth = frame->width;
+    mSourceHeight = frame->height;
+    return mContext;
+}
+
+int FrameConverter::TargetWidth(const AVFrame* frame) const
+{
+    return mParams.width > 0 ? mParams.width : frame->width;
+}
+
+int FrameConverter::TargetHeight(const AVFrame* frame) const
+{
+    return mParams.height > 0 ? mParams.height : frame->height;
+}
@@ -0,0 +1,342 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+}
+#include <CFramePool.hpp>
+
+namespace {
+
+constexpr size_t kAlignment = 64; // cache line, also enough for AVX-512 loads
+constexpr uint32_t kEmpty = 0; // free list link meaning "no buffer", indices are stored plus one
+
+size_t AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+}
+
+/**
+ * Slab shared between the pool and the frames it handed out.
+ *
+ * The free buffers form a lock-free stack of indices. The head packs a 32 bit modification tag with the
+ * index of the top buffer so a concurrent pop/push pair cannot be mistaken for an unchanged head (ABA).
+ */
+struct FramePool::Slab
+{
+    Params params;
+    uint8_t* memory = nullptr;
+    size_t memory_size = 0;
+    bool mapped = false; // memory comes from VirtualAlloc or mmap rather than av_malloc
+    bool huge_pages = false; // and is backed by reserved huge/large pages
+
+    size_t slot_size = 0;
+    int planes = 0;
+    int linesize[4] = {};
+    size_t plane_offset[4] = {};
+
+    std::unique_ptr<std::atomic<uint32_t>[]> next;
+    alignas(kAlignment) std::atomic<uint64_t> head{ 0 };
+    alignas(kAlignment) std::atomic<size_t> available{ 0 };
+    std::atomic<uint64_t> exhausted{ 0 };
+    std::atomic<size_t> refs{ 1 }; // the pool itself plus one per buffer in flight
+
+    ~Slab()
+    {
+        if (!memory)
+            return;
+#if defined(_WIN32)
+        if (mapped)
+        {
+            VirtualFree(memory, 0, MEM_RELEASE);
+            return;
+        }
+#else
+        if (mapped)
+        {
+            munmap(memory, memory_size);
+            return;
+        }
+#endif
+        av_free(memory);
+    }
+
+    bool Allocate(size_t size, bool want_huge_pages)
+    {
+        if (want_huge_pages)
+        {
+#if defined(_WIN32)
+            // Needs the "Lock pages in memory" privilege, silently falls back to normal pages otherwise.
+            SIZE_T large_page = GetLargePageMinimum();
+            if (large_page)
+            {
+                size_t huge_size = AlignUp(size, large_page);
+                memory = static_cast<uint8_t*>(VirtualAlloc(nullptr, huge_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+                if (memory)
+                {
+                    memory_size = huge_size;
+                    mapped = true;
+                    huge_pages = true;
+                    return true;
+                }
+            }
+#elif defined(MAP_HUGETLB)
+            // Needs reserved huge pages (vm.nr_hugepages), falls back to transparent huge pages otherwise.
+            size_t huge_size = AlignUp(size, 2 * 1024 * 1024);
+            void* region = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            bool reserved = region != MAP_FAILED;
+            if (!reserved)
+            {
+                // Transparent huge pages are only a hint: the kernel may or may not back the region with them.
+                region = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+                if (region != MAP_FAILED)
+                    madvise(region, huge_size, MADV_HUGEPAGE);
+#endif
+            }
+            if (region != MAP_FAILED)
+            {
+                memory = static_cast<uint8_t*>(region);
+                memory_size = huge_size;
+                mapped = true;
+                huge_pages = reserved;
+                if (!reserved)
+                    std::cout << "no reserved huge pages, asked for transparent huge pages for the frame pool" << std::endl;
+                return true;
+            }
+#endif
+            std::cout << "huge pages not available, using normal pages for the frame pool" << std::endl;
+        }
+
+        memory = static_cast<uint8_t*>(av_malloc(size));
+        memory_size = size;
+        return memory != nullptr;
+    }
+
+    bool Pop(uint32_t& index)
+    {
+        uint64_t old_head = head.load(std::memory_order_acquire);
+        while (true)
+        {
+            uint32_t top = static_cast<uint32_t>(old_head);
+            if (top == kEmpty)
+                return false;
+
+            uint64_t new_head = ((old_head >> 32) + 1) << 32 | next[top - 1].load(std::memory_order_relaxed);
+            if (head.compare_exchange_weak(old_head, new_head, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                index = top - 1;
+                available.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+
+    void Push(uint32_t index)
+    {
+        uint64_t old_head = head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            next[index].store(static_cast<uint32_t>(old_head), std::memory_order_relaxed);
+            uint64_t new_head = ((old_head >> 32) + 1) << 32 | (index + 1);
+            if (head.compare_exchange_weak(old_head, new_head, std::memory_order_release, std::memory_order_relaxed))
+            {
+                available.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+    void Unref()
+    {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+    static void ReleaseBuffer(void* opaque, uint8_t* data)
+    {
+        Slab* slab = static_cast<Slab*>(opaque);
+        slab->Push(static_cast<uint32_t>((data - slab->memory) / slab->slot_size));
+        slab->Unref();
+    }
+
+    // Attaches a free buffer to the frame, leaving its format and dimensions alone.
+    bool Attach(AVFrame* frame)
+    {
+        uint32_t index = 0;
+        if (!Pop(index))
+        {
+            exhausted.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        uint8_t* slot = memory + index * slot_size;
+        refs.fetch_add(1, std::memory_order_relaxed);
+        frame->buf[0] = av_buffer_create(slot, slot_size, &Slab::ReleaseBuffer, this, 0);
+        if (!frame->buf[0])
+        {
+            Push(index);
+            Unref();
+            return false;
+        }
+
+        for (int i = 0; i < planes; i++)
+        {
+            frame->data[i] = slot + plane_offset[i];
+            frame->linesize[i] = linesize[i];
+        }
+        frame->extended_data = frame->data;
+        return true;
+    }
+};
+
+
+FramePool::~FramePool()
+{
+    Destroy();
+}
+
+bool FramePool::Init(const Params& params)
+{
+    Destroy();
+
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(params.format);
+    if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL)) || params.width <= 0 || params.height <= 0 || !params.count)
+    {
+        std::cout << "unsupported frame pool layout" << std::endl;
+        return false;
+    }
+
+    std::unique_ptr<Slab> slab(new Slab());
+    slab->params = params;
+    int alloc_width = params.padded_width > params.width ? params.padded_width : params.width;
+    int alloc_height = params.padded_height > params.height ? params.padded_height : params.height;
+
+    if (av_image_fill_linesizes(slab->linesize, params.format, alloc_width) < 0)
+    {
+        std::cout << "could not compute frame pool linesizes" << std::endl;
+        return false;
+    }
+
+    ptrdiff_t linesizes[4] = {};
+    for (int i = 0; i < 4; i++)
+    {
+        slab->linesize[i] = static_cast<int>(AlignUp(slab->linesize[i], kAlignment));
+        linesizes[i] = slab->linesize[i];
+    }
+
+    size_t plane_sizes[4] = {};
+    if (av_image_fill_plane_sizes(plane_sizes, params.format, alloc_height, linesizes) < 0)
+    {
+        std::cout << "could not compute frame pool plane sizes" << std::endl;
+        return false;
+    }
+
+    size_t offset = 0;
+    for (int i = 0; i < 4 && plane_sizes[i]; i++)
+    {
+        slab->plane_offset[i] = offset;
+        offset += AlignUp(plane_sizes[i], kAlignment);
+        slab->planes = i + 1;
+    }
+    // Slack after the last plane for SIMD code that reads or writes past the end of a row.
+    slab->slot_size = AlignUp(offset + kAlignment, kAlignment);
+
+    if (!slab->Allocate(slab->slot_size * params.count, params.huge_pages))
+    {
+        std::cout << "could not allocate frame pool of " << params.count << " x " << slab->slot_size << " bytes" << std::endl;
+        return false;
+    }
+
+    slab->next.reset(new std::atomic<uint32_t>[params.count]);
+    for (size_t i = params.count; i > 0; i--)
+        slab->Push(static_cast<uint32_t>(i - 1));
+
+    mSlab = slab.release();
+    return true;
+}
+
+void FramePool::Destroy()
+{
+    if (mSlab)
+    {
+        mSlab->Unref();
+        mSlab = nullptr;
+    }
+}
+
+bool FramePool::Matches(AVPixelFormat format, int width, int height) const
+{
+    return mSlab && mSlab->params.format == format && mSlab->params.width == width && mSlab->params.height == height;
+}
+
+AVFrame* FramePool::Acquire()
+{
+    AVFrame* frame = av_frame_alloc();
+    if (!frame)
+        return nullptr;
+
+    if (!Acquire(frame))
+    {
+        av_frame_free(&frame);
+        return nullptr;
+    }
+    return frame;
+}
+
+bool FramePool::Acquire(AVFrame* frame)
+{
+    if (!mSlab || !mSlab->Attach(frame))
+        return false;
+
+    frame->format = mSlab->params.format;
+    frame->width = mSlab->params.width;
+    frame->height = mSlab->params.height;
+    return true;
+}
+
+size_t FramePool::Capacity() const
+{
+    return mSlab ? mSlab->params.count : 0;
+}
+
+size_t FramePool::Available() const
+{
+    return mSlab ? mSlab->available.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t FramePool::Exhausted() const
+{
+    return mSlab ? mSlab->exhausted.load(std::memory_order_relaxed) : 0;
+}
+
+bool FramePool::UsesHugePages() const
+{
+    return mSlab && mSlab->huge_pages;
+}
+
+int FramePool::GetBuffer2(AVCodecContext* context, AVFrame* frame, int flags)
+{
+    FramePool* pool = static_cast<FramePool*>(context->opaque);
+    if (!pool || !pool->mSlab)
+        return avcodec_default_get_buffer2(context, frame, flags);
+
+    const Params& params = pool->mSlab->params;
+    if (frame->format != params.format || frame->width > params.width || frame->height > params.height)
+        return avcodec_default_get_buffer2(context, frame, flags);
+
+    return pool->mSlab->Attach(frame) ? 0 : AVERROR(ENOMEM);
+}
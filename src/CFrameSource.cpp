@@ -0,0 +1,473 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <cstdlib>
+
+extern "C" {
+#include <libavdevice/avdevice.h>
+#include <libavutil/error.h>
+}
+#include <CFrameSource.hpp>
+
+
+FrameSource::~FrameSource()
+{
+    Close();
+}
+
+bool FrameSource::Open(const Params& params)
+{
+    Close();
+    avdevice_register_all();
+
+    mParams = params;
+    const AVInputFormat* inputFormat = InputFormat();
+    std::string url = InputUrl(params);
+    AVDictionary* options = nullptr;
+    InputOptions(&options, params);
+
+    do
+    {
+        if (avformat_open_input(&mFormatContext, url.c_str(), inputFormat, &options) != 0)
+        {
+            std::cerr << "Could not open " << Name() << " source: " << url << std::endl;
+            break;
+        }
+
+        if (avformat_find_stream_info(mFormatContext, nullptr) < 0)
+        {
+            std::cerr << "Could not find stream information" << std::endl;
+            break;
+        }
+
+        const AVCodec* decoder = nullptr;
+        mStreamIndex = av_find_best_stream(mFormatContext, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0);
+        if (mStreamIndex < 0)
+        {
+            std::cerr << "Could not find video stream" << std::endl;
+            break;
+        }
+        if (!decoder)
+        {
+            std::cerr << "Could not find decoder" << std::endl;
+            break;
+        }
+
+        mDecoderContext = avcodec_alloc_context3(decoder);
+        if (!mDecoderContext)
+        {
+            std::cerr << "Could not allocate decoder context" << std::endl;
+            break;
+        }
+
+        if (avcodec_parameters_to_context(mDecoderContext, mFormatContext->streams[mStreamIndex]->codecpar) < 0)
+        {
+            std::cerr << "Could not copy codec parameters to decoder context" << std::endl;
+            break;
+        }
+        mDecoderContext->pkt_timebase = mFormatContext->streams[mStreamIndex]->time_base;
+        InitThreading(decoder);
+        InitFramePool(decoder);
+
+        if (avcodec_open2(mDecoderContext, decoder, nullptr) < 0)
+        {
+            std::cerr << "Could not open decoder" << std::endl;
+            break;
+        }
+        std::cout << "Decoder " << decoder->name << ": " << mDecoderContext->thread_count << " thread(s), "
+                  << (mDecoderContext->active_thread_type == FF_THREAD_FRAME ? "frame" :
+                      mDecoderContext->active_thread_type == FF_THREAD_SLICE ? "slice" : "no") << " threading" << std::endl;
+
+        mPacket = av_packet_alloc();
+        if (!mPacket)
+        {
+            std::cerr << "Could not allocate packet" << std::endl;
+            break;
+        }
+
+        av_dict_free(&options);
+        mFramesRead = 0;
+        mStartPts = mLastPts = AV_NOPTS_VALUE;
+        mLastDuration = 0;
+        mPtsOffset = 0;
+        mFramesDropped = 0;
+        mDroppedSinceFrame = 0;
+        mFramesMissed = 0;
+        mDecodeTime = mLastDecodeTime = mTotalDecodeTime = std::chrono::steady_clock::duration::zero();
+        {
+            AVStream* stream = mFormatContext->streams[mStreamIndex];
+            AVRational rate = stream->avg_frame_rate.num > 0 ? stream->avg_frame_rate : stream->r_frame_rate;
+            if (rate.num <= 0 || rate.den <= 0)
+                rate = av_d2q(params.fps, 1001000);
+            mFrameDuration = rate.num > 0 ? av_rescale_q(1, av_inv_q(rate), stream->time_base) : 0;
+        }
+        mIsOpen = true;
+        std::cout << "Opened " << Name() << " source: " << url << std::endl;
+        return true;
+    } while (false);
+
+    av_dict_free(&options);
+    Close();
+    return false;
+}
+
+void FrameSource::Close()
+{
+    if (mPacket)
+        av_packet_free(&mPacket);
+
+    if (mDecoderContext)
+        avcodec_free_context(&mDecoderContext);
+
+    if (mFormatContext)
+        avformat_close_input(&mFormatContext);
+
+    mFramePool.Destroy();
+    mStreamIndex = -1;
+    mIsOpen = false;
+}
+
+bool FrameSource::IsOpen() const
+{
+    return mIsOpen;
+}
+
+AVRational FrameSource::TimeBase() const
+{
+    if (!mFormatContext || mStreamIndex < 0)
+        return AVRational{ 1, AV_TIME_BASE };
+    return mFormatContext->streams[mStreamIndex]->time_base;
+}
+
+bool FrameSource::ReadFrame(AVFrame* frame)
+{
+    if (!mIsOpen)
+        return false;
+
+    if (mParams.max_frames && mFramesRead >= mParams.max_frames)
+        return false;
+
+    av_frame_unref(frame);
+    while (true)
+    {
+        auto decodeStart = std::chrono::steady_clock::now();
+        int ret = avcodec_receive_frame(mDecoderContext, frame);
+        mDecodeTime += std::chrono::steady_clock::now() - decodeStart;
+        if (ret == 0)
+        {
+            mLastDecodeTime = mDecodeTime;
+            mTotalDecodeTime += mDecodeTime;
+            mDecodeTime = std::chrono::steady_clock::duration::zero();
+
+            int64_t pts = frame->best_effort_timestamp;
+            if (pts == AV_NOPTS_VALUE)
+                pts = mLastPts == AV_NOPTS_VALUE ? 0 : mLastPts - mPtsOffset + (mLastDuration ? mLastDuration : 1);
+
+            frame->pts = pts + mPtsOffset;
+            if (mLastPts != AV_NOPTS_VALUE && mFrameDuration > 0)
+            {
+                int64_t gap = frame->pts - mLastPts;
+                if (gap * 2 > mFrameDuration * 3)
+                {
+                    // Frames skipped for an empty pool are in the gap too, and already counted as dropped.
+                    int64_t missed = (gap + mFrameDuration / 2) / mFrameDuration - 1 - static_cast<int64_t>(mDroppedSinceFrame);
+                    if (missed > 0)
+                        mFramesMissed += missed;
+                }
+            }
+            mDroppedSinceFrame = 0;
+            mLastDuration = frame->duration;
+            mLastPts = frame->pts;
+            if (mFramesRead++ == 0)
+            {
+                mStartPts = frame->pts;
+                mStartTime = std::chrono::steady_clock::now();
+            }
+            Pace(frame->pts);
+            return true;
+        }
+
+        if (ret == AVERROR_EOF)
+        {
+            if (mParams.loop && IsSeekable() && Rewind())
+                continue;
+            return false;
+        }
+
+        if (ret != AVERROR(EAGAIN))
+        {
+            std::cerr << "Error receiving frame: " << ret << std::endl;
+            return false;
+        }
+
+        ret = av_read_frame(mFormatContext, mPacket);
+        if (ret == AVERROR_EOF)
+        {
+            // Drain the frames still buffered in the decoder.
+            avcodec_send_packet(mDecoderContext, nullptr);
+            continue;
+        }
+        if (ret < 0)
+        {
+            std::cerr << "Error reading from " << Name() << " source: " << ret << std::endl;
+            return false;
+        }
+
+        if (mPacket->stream_index == mStreamIndex)
+        {
+            if (mFramePool.IsInitialized() && mFramePool.Available() == 0)
+            {
+                // Everything is still queued downstream: drop the frame rather than grow memory.
+                mFramesDropped++;
+                mDroppedSinceFrame++;
+            }
+            else
+            {
+                // With frame threading this blocks while every decoder thread is busy.
+                auto decodeStart = std::chrono::steady_clock::now();
+                ret = avcodec_send_packet(mDecoderContext, mPacket);
+                mDecodeTime += std::chrono::steady_clock::now() - decodeStart;
+                if (ret < 0)
+                    std::cerr << "Error sending packet, skipping corrupted frame.\n";
+            }
+        }
+        av_packet_unref(mPacket);
+    }
+}
+
+uint64_t FrameSource::DroppedFrames() const
+{
+    return mFramesDropped;
+}
+
+uint64_t FrameSource::MissedFrames() const
+{
+    return mFramesMissed;
+}
+
+double FrameSource::LastDecodeTime() const
+{
+    return std::chrono::duration<double, std::milli>(mLastDecodeTime).count();
+}
+
+double FrameSource::AverageDecodeTime() const
+{
+    if (!mFramesRead)
+        return 0.0;
+    return std::chrono::duration<double, std::milli>(mTotalDecodeTime).count() / mFramesRead;
+}
+
+void FrameSource::InitThreading(const AVCodec* decoder)
+{
+    int threads = mParams.decode_threads;
+    if (threads <= 0)
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    mDecoderContext->thread_count = threads > 0 ? threads : 1;
+
+    int supported = 0;
+    if (decoder->capabilities & AV_CODEC_CAP_FRAME_THREADS)
+        supported |= FF_THREAD_FRAME;
+    if (decoder->capabilities & AV_CODEC_CAP_SLICE_THREADS)
+        supported |= FF_THREAD_SLICE;
+
+    switch (mParams.decode_threading)
+    {
+    case DecodeThreading::Frame:
+        mDecoderContext->thread_type = FF_THREAD_FRAME;
+        break;
+    case DecodeThreading::Slice:
+        mDecoderContext->thread_type = FF_THREAD_SLICE;
+        break;
+    case DecodeThreading::Auto:
+        mDecoderContext->thread_type = supported ? supported : FF_THREAD_FRAME | FF_THREAD_SLICE;
+        break;
+    }
+    if (supported && !(mDecoderContext->thread_type & supported))
+        std::cout << decoder->name << " does not support the requested threading mode, decoding single threaded" << std::endl;
+}
+
+void FrameSource::InitFramePool(const AVCodec* decoder)
+{
+    // Only intra-only decoders (MJPEG, the usual webcam codec) decode into the fixed pool: dropping a
+    // packet when the pool is empty is safe for them, and they keep no reference frames of their own.
+    // rawvideo references the packets directly and other decoders keep their own recycled pools.
+    const AVCodecDescriptor* desc = avcodec_descriptor_get(decoder->id);
+    if (!mParams.frame_pool_size || !(decoder->capabilities & AV_CODEC_CAP_DR1) ||
+        !desc || !(desc->props & AV_CODEC_PROP_INTRA_ONLY) ||
+        mDecoderContext->pix_fmt == AV_PIX_FMT_NONE || mDecoderContext->width <= 0 || mDecoderContext->height <= 0)
+        return;
+
+    FramePool::Params params;
+    params.format = mDecoderContext->pix_fmt;
+    params.width = mDecoderContext->width;
+    params.height = mDecoderContext->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    params.padded_width = params.width;
+    params.padded_height = params.height;
+    avcodec_align_dimensions2(mDecoderContext, &params.padded_width, &params.padded_height, linesize_align);
+    params.count = mParams.frame_pool_size;
+    // Every frame thread holds a picture of its own while decoding.
+    if ((mDecoderContext->thread_type & FF_THREAD_FRAME) && (decoder->capabilities & AV_CODEC_CAP_FRAME_THREADS))
+        params.count += mDecoderContext->thread_count;
+    params.huge_pages = mParams.huge_pages;
+    if (!mFramePool.Init(params))
+        return;
+
+    mDecoderContext->opaque = &mFramePool;
+    mDecoderContext->get_buffer2 = &FramePool::GetBuffer2;
+}
+
+bool FrameSource::Rewind()
+{
+    if (av_seek_frame(mFormatContext, mStreamIndex, 0, AVSEEK_FLAG_BACKWARD) < 0)
+    {
+        std::cerr << "Could not rewind " << Name() << " source" << std::endl;
+        return false;
+    }
+    avcodec_flush_buffers(mDecoderContext);
+
+    // Continue the timeline right after the last frame of the previous loop.
+    if (mLastPts != AV_NOPTS_VALUE)
+        mPtsOffset = mLastPts + (mLastDuration ? mLastDuration : 1);
+    return true;
+}
+
+void FrameSource::Pace(int64_t pts)
+{
+    if (mParams.pacing != Pacing::RealTime || IsLive())
+        return;
+
+    // Sleep until the frame is due relative to the first frame, like playVideo does.
+    int64_t due = av_rescale_q(pts - mStartPts, TimeBase(), AVRational{ 1, 1000000 });
+    auto target = mStartTime + std::chrono::microseconds(due);
+    std::this_thread::sleep_until(target);
+}
+
+void FrameSource::InputOptions(AVDictionary** options, const Params& params) const
+{
+    (void)options;
+    (void)params;
+}
+
+bool FrameSource::IsLive() const
+{
+    return false;
+}
+
+bool FrameSource::IsSeekable() const
+{
+    return true;
+}
+
+std::unique_ptr<FrameSource> FrameSource::Create(const std::string& kind)
+{
+    if (kind == "webcam")
+        return std::make_unique<WebcamFrameSource>();
+    if (kind == "file")
+        return std::make_unique<FileFrameSource>();
+    if (kind == "testsrc")
+        return std::make_unique<SyntheticFrameSource>();
+
+    std::cerr << "Unknown frame source: " << kind << std::endl;
+    return nullptr;
+}
+
+void FrameSource::FromEnvironment(std::string& kind, Params& params)
+{
+    const char* env_source = std::getenv("FRAME_SOURCE");
+    kind = env_source ? env_source : "webcam";
+
+    const char* env_url = std::getenv("FRAME_SOURCE_URL");
+    if (env_url)
+        params.url = env_url;
+
+    const char* env_pacing = std::getenv("FRAME_SOURCE_PACING");
+    if (env_pacing)
+        params.pacing = std::string(env_pacing) == "fast" ? Pacing::AsFastAsPossible : Pacing::RealTime;
+
+    const char* env_loop = std::getenv("FRAME_SOURCE_LOOP");
+    if (env_loop)
+        params.loop = std::atoi(env_loop) != 0;
+
+    const char* env_max_frames = std::getenv("FRAME_SOURCE_MAX_FRAMES");
+    if (env_max_frames)
+        params.max_frames = std::strtoull(env_max_frames, nullptr, 10);
+
+    const char* env_pool_size = std::getenv("FRAME_POOL_SIZE");
+    if (env_pool_size)
+        params.frame_pool_size = std::strtoull(env_pool_size, nullptr, 10);
+
+    const char* env_huge_pages = std::getenv("FRAME_POOL_HUGE_PAGES");
+    if (env_huge_pages)
+        params.huge_pages = std::atoi(env_huge_pages) != 0;
+
+    const char* env_decode_threads = std::getenv("DECODE_THREADS");
+    if (env_decode_threads)
+        params.decode_threads = std::atoi(env_decode_threads);
+
+    const char* env_decode_threading = std::getenv("DECODE_THREADING");
+    if (env_decode_threading)
+    {
+        std::string threading = env_decode_threading;
+        if (threading == "frame")
+            params.decode_threading = DecodeThreading::Frame;
+        else if (threading == "slice")
+            params.decode_threading = DecodeThreading::Slice;
+        else
+            params.decode_threading = DecodeThreading::Auto;
+    }
+}
+
+
+const AVInputFormat* WebcamFrameSource::InputFormat() const
+{
+#if defined(_WIN32)
+    return av_find_input_format("dshow");
+#elif defined(__APPLE__)
+    return av_find_input_format("avfoundation");
+#else
+    return av_find_input_format("v4l2");
+#endif
+}
+
+std::string WebcamFrameSource::InputUrl(const Params& params) const
+{
+#if defined(_WIN32)
+    return "video=" + (params.url.empty() ? std::string("Integrated Webcam") : params.url);
+#elif defined(__APPLE__)
+    return params.url.empty() ? std::string("0") : params.url;
+#else
+    return params.url.empty() ? std::string("/dev/video0") : params.url;
+#endif
+}
+
+void WebcamFrameSource::InputOptions(AVDictionary** options, const Params& params) const
+{
+#if defined(_WIN32)
+    av_dict_set(options, "rtbufsize", "100M", 0); // Increase buffer size to 100MB
+#endif
+    std::string size = std::to_string(params.width) + "x" + std::to_string(params.height);
+    av_dict_set(options, "video_size", size.c_str(), 0);
+    av_dict_set(options, "framerate", std::to_string(params.fps).c_str(), 0);
+}
+
+
+std::string FileFrameSource::InputUrl(const Params& params) const
+{
+    return params.url;
+}
+
+
+const AVInputFormat* SyntheticFrameSource::InputFormat() const
+{
+    return av_find_input_format("lavfi");
+}
+
+std::string SyntheticFrameSource::InputUrl(const Params& params) const
+{
+    if (!params.url.empty())
+        return params.url;
+
+    return "testsrc=size=" + std::to_string(params.width) + "x" + std::to_string(params.height) +
+           ":rate=" + std::to_string(params.fps);
+}
@@ -0,0 +1,501 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+#include <random>
+#include <vector>
+extern "C" {
+#include <libswscale/swscale.h>
+}
+#include <CStreamVideo.hpp>
+#include <CColorConvert.hpp>
+#include <CEncoderCore.hpp>
+#include <CParallelTranscoder.hpp>
+#include <CThreadSafeQueue.hpp>
+#include <CSpscRingBuffer.hpp>
+
+/**
+ * Moves items from a producer thread to a consumer thread through the queue and prints the throughput.
+ */
+template <typename Queue>
+static void benchmarkQueue(const char* name, Queue& queue, uint64_t items) {
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&]() {
+        uint64_t value;
+        while (queue.pop(value))
+            sum += value;
+    });
+    for (uint64_t i = 0; i < items; i++)
+        queue.push(i);
+    queue.close();
+    consumer.join();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool ok = sum == items * (items - 1) / 2;
+    std::cout << name << ": " << items / elapsed / 1e6 << " M items/s, " << elapsed * 1e9 / items << " ns/item"
+              << (ok ? "" : " (LOST ITEMS)") << std::endl;
+}
+
+/**
+ * Compares the mutex based ThreadSafeQueue with the lock-free SpscRingBuffer for a one producer,
+ * one consumer hand-off, both bounded and blocking.
+ */
+static int benchmarkQueues(uint64_t items, size_t capacity) {
+    std::cout << "Queue hand-off, " << items << " items, capacity " << capacity << std::endl;
+    {
+        ThreadSafeQueue<uint64_t> queue(capacity, ThreadSafeQueue<uint64_t>::OverflowPolicy::Block);
+        benchmarkQueue("ThreadSafeQueue", queue, items);
+    }
+    {
+        SpscRingBuffer<uint64_t> queue(capacity, SpscRingBuffer<uint64_t>::OverflowPolicy::Block);
+        benchmarkQueue("SpscRingBuffer ", queue, items);
+    }
+    return 0;
+}
+
+/**
+ * Packed RGB24 picture and the three YUV 4:2:0 planes it converts to.
+ */
+struct ConvertBuffers {
+    ConvertBuffers(int w, int h)
+        : width(w), height(h), rgb(static_cast<size_t>(w) * 3 * h),
+          y(static_cast<size_t>(w) * h), u(static_cast<size_t>((w + 1) / 2) * ((h + 1) / 2)), v(u.size()) {}
+
+    uint8_t* planes[3] = {};
+    int strides[3] = {};
+
+    void bind() {
+        planes[0] = y.data();
+        planes[1] = u.data();
+        planes[2] = v.data();
+        strides[0] = width;
+        strides[1] = strides[2] = (width + 1) / 2;
+    }
+
+    int width;
+    int height;
+    std::vector<uint8_t> rgb;
+    std::vector<uint8_t> y, u, v;
+};
+
+static int maxDifference(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+    int diff = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        diff = std::max(diff, std::abs(a[i] - b[i]));
+    return diff;
+}
+
+/**
+ * Checks the RGB24 to YUV420P kernels: every instruction set must match the scalar kernel byte for byte
+ * on random pictures (odd sizes included), and the scalar kernel must stay within rounding of libswscale
+ * on a smooth picture, where chroma siting does not matter.
+ */
+static int checkColorConvert() {
+    typedef ColorConvert::Isa Isa;
+    std::cout << "CPU supports " << ColorConvert::IsaName(ColorConvert::SupportedIsa()) << std::endl;
+
+    bool ok = true;
+    std::mt19937 random(1);
+    const int sizes[][2] = { { 1, 1 }, { 3, 5 }, { 17, 3 }, { 66, 9 }, { 130, 7 }, { 1279, 721 }, { 1920, 1080 } };
+    for (const auto& size : sizes) {
+        ConvertBuffers reference(size[0], size[1]);
+        for (auto& byte : reference.rgb)
+            byte = static_cast<uint8_t>(random());
+        reference.bind();
+        ColorConvert::RGB24ToI420(reference.rgb.data(), reference.width * 3, reference.planes, reference.strides,
+                                  reference.width, reference.height, Isa::Scalar);
+
+        for (Isa isa : { Isa::SSE41, Isa::AVX2, Isa::AVX512 }) {
+            ConvertBuffers out(size[0], size[1]);
+            out.rgb = reference.rgb;
+            out.bind();
+            if (!ColorConvert::RGB24ToI420(out.rgb.data(), out.width * 3, out.planes, out.strides,
+                                           out.width, out.height, isa))
+                continue;
+            if (out.y != reference.y || out.u != reference.u || out.v != reference.v) {
+                std::cout << ColorConvert::IsaName(isa) << " differs from scalar at " << size[0] << "x" << size[1] << std::endl;
+                ok = false;
+            }
+        }
+    }
+
+    const int width = 1280, height = 720;
+    ConvertBuffers kernel(width, height), swscale(width, height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t* pixel = &kernel.rgb[(static_cast<size_t>(y) * width + x) * 3];
+            pixel[0] = static_cast<uint8_t>(x * 255 / (width - 1));
+            pixel[1] = static_cast<uint8_t>(y * 255 / (height - 1));
+            pixel[2] = static_cast<uint8_t>(255 - (x + y) * 255 / (width + height - 2));
+        }
+    }
+    swscale.rgb = kernel.rgb;
+    kernel.bind();
+    swscale.bind();
+    ColorConvert::RGB24ToI420(kernel.rgb.data(), width * 3, kernel.planes, kernel.strides, width, height, Isa::Scalar);
+
+    SwsContext* context = sws_getContext(width, height, AV_PIX_FMT_RGB24, width, height, AV_PIX_FMT_YUV420P,
+                                         SWS_BICUBIC, nullptr, nullptr, nullptr);
+    if (!context) {
+        std::cerr << "Could not create the swscale reference context\n";
+        return 1;
+    }
+    const uint8_t* src[1] = { swscale.rgb.data() };
+    const int src_stride[1] = { width * 3 };
+    sws_scale(context, src, src_stride, 0, height, swscale.planes, swscale.strides);
+    sws_freeContext(context);
+
+    int diff_y = maxDifference(kernel.y, swscale.y);
+    int diff_u = maxDifference(kernel.u, swscale.u);
+    int diff_v = maxDifference(kernel.v, swscale.v);
+    std::cout << "Max difference to swscale: Y " << diff_y << ", U " << diff_u << ", V " << diff_v << std::endl;
+    ok = ok && diff_y <= 1 && diff_u <= 2 && diff_v <= 2;
+
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
+
+/**
+ * Times the RGB24 to YUV420P conversion at 720p, 1080p and 4K for every supported kernel and for a
+ * single threaded bicubic libswscale context, the path the encoders used before.
+ */
+static int benchmarkColorConvert(int iterations) {
+    typedef ColorConvert::Isa Isa;
+    if (iterations < 1)
+        iterations = 1;
+    const int sizes[][2] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+    std::mt19937 random(1);
+    for (const auto& size : sizes) {
+        ConvertBuffers buffers(size[0], size[1]);
+        for (auto& byte : buffers.rgb)
+            byte = static_cast<uint8_t>(random());
+        buffers.bind();
+        std::cout << size[0] << "x" << size[1] << ", " << iterations << " frames" << std::endl;
+
+        auto report = [&](const char* name, double elapsed) {
+            double ms = elapsed * 1000 / iterations;
+            std::cout << "  " << name << ": " << ms << " ms/frame, "
+                      << static_cast<double>(size[0]) * size[1] * iterations / elapsed / 1e6 << " Mpixel/s" << std::endl;
+        };
+
+        for (Isa isa : { Isa::Scalar, Isa::SSE41, Isa::AVX2, Isa::AVX512 }) {
+            if (isa > ColorConvert::SupportedIsa())
+                continue;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; i++)
+                ColorConvert::RGB24ToI420(buffers.rgb.data(), size[0] * 3, buffers.planes, buffers.strides,
+                                          size[0], size[1], isa);
+            report(ColorConvert::IsaName(isa), std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        SwsContext* context = sws_getContext(size[0], size[1], AV_PIX_FMT_RGB24, size[0], size[1], AV_PIX_FMT_YUV420P,
+                                             SWS_BICUBIC, nullptr, nullptr, nullptr);
+        if (!context)
+            continue;
+        const uint8_t* src[1] = { buffers.rgb.data() };
+        const int src_stride[1] = { size[0] * 3 };
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++)
+            sws_scale(context, src, src_stride, 0, size[1], buffers.planes, buffers.strides);
+        report("swscale", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        sws_freeContext(context);
+    }
+    return 0;
+}
+
+/**
+ * Draws frame number index of a synthetic test clip in RGB24: a scrolling XOR texture over
+ * moving gradients, busy enough that the encoder has real motion and detail to code.
+ */
+static void drawSyntheticFrame(std::vector<uint8_t>& rgb, int width, int height, int index) {
+    for (int y = 0; y < height; y++) {
+        uint8_t* pixel = &rgb[static_cast<size_t>(y) * width * 3];
+        for (int x = 0; x < width; x++, pixel += 3) {
+            pixel[0] = static_cast<uint8_t>(x + index * 4);
+            pixel[1] = static_cast<uint8_t>(y + index * 2);
+            pixel[2] = static_cast<uint8_t>(((x + index) ^ y) & 0xff);
+        }
+    }
+}
+
+/**
+ * Sink that only counts what it is given, so benchmarks measure the encoder and not a muxer.
+ */
+class CountingSink : public PacketSink {
+public:
+    bool Open(const AVCodecContext*) override {
+        packets = bytes = largest = 0;
+        return true;
+    }
+    bool Write(const AVPacket* packet) override {
+        packets++;
+        bytes += packet->size;
+        largest = std::max<uint64_t>(largest, packet->size);
+        return true;
+    }
+    void Close() override {}
+    std::string Name() const override { return "count"; }
+
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t largest = 0;
+};
+
+/**
+ * Encoder parameters of the benchmarks: the live settings, RGB24 input.
+ */
+static EncoderCore::Params benchmarkParams(int width, int height, double fps) {
+    EncoderCore::Params params;
+    params.width = width;
+    params.height = height;
+    params.fps = fps;
+    params.bitrate = 400000;
+    params.preset = "medium";
+    params.crf = 23;
+    params.src_format = AV_PIX_FMT_RGB24;
+    params.dst_format = AV_PIX_FMT_YUV420P;
+    return params;
+}
+
+/**
+ * Feeds a synthetic 720p30 clip to the encoder in real time, once with the default profile and once with
+ * the low-latency one (with and without intra refresh), and prints the input-to-packet delay and packet sizes.
+ */
+static int benchmarkLatency(int frames) {
+    if (frames < 1)
+        frames = 1;
+    const int width = 1280, height = 720;
+    const double fps = 30.0;
+    std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+
+    struct Profile {
+        const char* name;
+        bool low_latency;
+        bool intra_refresh;
+    };
+    const Profile profiles[] = { { "default", false, false }, { "low-latency", true, true }, { "low-latency-idr", true, false } };
+    for (const Profile& profile : profiles) {
+        EncoderCore::Params params = benchmarkParams(width, height, fps);
+        params.low_latency = profile.low_latency;
+        params.intra_refresh = profile.intra_refresh;
+
+        EncoderCore core;
+        auto sink = std::make_shared<CountingSink>();
+        core.AddSink(sink);
+        if (!core.Open(params)) {
+            std::cerr << "Could not open the encoder for " << profile.name << std::endl;
+            return 1;
+        }
+
+        const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / fps));
+        auto next = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++) {
+            drawSyntheticFrame(rgb, width, height, i);
+            std::this_thread::sleep_until(next);
+            next += interval;
+            if (!core.Write(rgb.data()))
+                break;
+        }
+        // Close drains the encoder; the sink keeps its counters once detached and the core keeps the latency.
+        core.Close();
+        EncoderCore::LatencyStats latency = core.GetLatency();
+        std::cout << profile.name << ": average " << latency.average_ms << " ms, p50 " << latency.p50_ms
+                  << " ms, p95 " << latency.p95_ms << " ms, max " << latency.max_ms << " ms, "
+                  << latency.average_frames << " frames behind, " << sink->bytes * 8 / (frames / fps) / 1000
+                  << " kbit/s, largest packet " << sink->largest << " bytes" << std::endl;
+    }
+    return 0;
+}
+
+/**
+ * Encodes the same synthetic 720p clip as fast as possible with 1, 2, 4, 8 and 16 threads, in frame and in
+ * slice threading, and prints the encoding rate, the input-to-packet delay and the output size of each run.
+ * The clip is drawn before the timer starts and cycled, so only the encoder is measured.
+ */
+static int benchmarkThreads(int frames) {
+    if (frames < 1)
+        frames = 1;
+    const int width = 1280, height = 720, clip_length = 30;
+    const double fps = 30.0;
+    std::vector<std::vector<uint8_t>> clip(clip_length, std::vector<uint8_t>(static_cast<size_t>(width) * height * 3));
+    for (int i = 0; i < clip_length; i++)
+        drawSyntheticFrame(clip[i], width, height, i);
+
+    std::cout << width << "x" << height << ", " << frames << " frames, " << std::thread::hardware_concurrency()
+              << " hardware threads" << std::endl;
+    for (EncoderCore::Threading threading : { EncoderCore::Threading::Frame, EncoderCore::Threading::Slice }) {
+        const char* name = threading == EncoderCore::Threading::Frame ? "frame" : "slice";
+        for (int threads : { 1, 2, 4, 8, 16 }) {
+            EncoderCore::Params params = benchmarkParams(width, height, fps);
+            params.threads = threads;
+            params.threading = threading;
+
+            EncoderCore core;
+            auto sink = std::make_shared<CountingSink>();
+            core.AddSink(sink);
+            if (!core.Open(params)) {
+                std::cerr << "Could not open the encoder with " << threads << " " << name << " threads" << std::endl;
+                return 1;
+            }
+            auto start = std::chrono::steady_clock::now();
+            int written = 0;
+            for (; written < frames; written++) {
+                if (!core.Write(clip[written % clip_length].data()))
+                    break;
+            }
+            core.Close();
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            EncoderCore::LatencyStats latency = core.GetLatency();
+            std::cout << "  " << name << " x" << threads << ": " << (elapsed > 0 ? written / elapsed : 0.0) << " fps, latency average "
+                      << latency.average_ms << " ms, p95 " << latency.p95_ms << " ms, " << latency.average_frames
+                      << " frames behind, " << sink->bytes << " bytes" << std::endl;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Encodes the same synthetic 720p clip with x264 and with libvpx VP8 and VP9, from the bundled
+ * presets/libvpx-720p.ffpreset and in realtime mode, and prints the CPU time spent per kbit of output.
+ * std::clock gives the CPU time of every thread of the process on Linux but wall time on Windows.
+ */
+static int benchmarkCodecs(int frames) {
+    if (frames < 1)
+        frames = 1;
+    const int width = 1280, height = 720, clip_length = 30;
+    const double fps = 30.0;
+    std::vector<std::vector<uint8_t>> clip(clip_length, std::vector<uint8_t>(static_cast<size_t>(width) * height * 3));
+    for (int i = 0; i < clip_length; i++)
+        drawSyntheticFrame(clip[i], width, height, i);
+
+    struct Setup {
+        const char* name;
+        const char* codec;
+        const char* options;
+    };
+    const Setup setups[] = {
+        { "h264", "libx264", "" },
+        { "vp8", "libvpx", "" },
+        { "vp8-realtime", "libvpx", "deadline=realtime:cpu-used=8" },
+        { "vp9", "libvpx-vp9", "" },
+        { "vp9-realtime", "libvpx-vp9", "deadline=realtime:cpu-used=8" },
+    };
+    std::cout << width << "x" << height << ", " << frames << " frames" << std::endl;
+    for (const Setup& setup : setups) {
+        EncoderCore::Params params = benchmarkParams(width, height, fps);
+        params.codec = setup.codec;
+        params.options = setup.options;
+
+        EncoderCore core;
+        auto sink = std::make_shared<CountingSink>();
+        core.AddSink(sink);
+        if (!core.Open(params)) {
+            std::cerr << "Could not open the encoder for " << setup.name << std::endl;
+            return 1;
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::clock_t cpu_start = std::clock();
+        int written = 0;
+        for (; written < frames; written++) {
+            if (!core.Write(clip[written % clip_length].data()))
+                break;
+        }
+        core.Close();
+        double cpu = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double kbits = sink->bytes * 8 / 1000.0;
+        std::cout << "  " << setup.name << ": " << (elapsed > 0 ? written / elapsed : 0.0) << " fps, " << cpu << " s CPU, "
+                  << kbits * fps / std::max(written, 1) << " kbit/s, "
+                  << (kbits > 0 ? cpu * 1e6 / kbits : 0.0) << " us CPU per kbit" << std::endl;
+    }
+    return 0;
+}
+
+/**
+ * Re-encodes a recording with ParallelTranscoder at crf 23, capped at kbps when given, and prints the rate.
+ */
+static int transcode(const std::string& input, const std::string& output, int workers, int kbps) {
+    ParallelTranscoder::Params params;
+    params.workers = workers;
+    params.encoder.width = 0;
+    params.encoder.height = 0;
+    params.encoder.fps = 0.0;
+    params.encoder.bitrate = kbps > 0 ? kbps * 1000 : 400000;
+    params.encoder.max_bitrate = kbps > 0 ? kbps * 1000 : 0;
+    params.encoder.preset = "medium";
+    params.encoder.crf = 23;
+    params.encoder.dst_format = AV_PIX_FMT_YUV420P;
+    EncoderCore::CodecFromEnvironment(params.encoder);
+
+    ParallelTranscoder transcoder;
+    if (!transcoder.Run(input, output, params))
+        return 1;
+    ParallelTranscoder::Stats stats = transcoder.GetStats();
+    std::cout << stats.chunks << " chunks on " << stats.workers << " workers, " << stats.bytes << " bytes, "
+              << (stats.seconds > 0 ? stats.frames / stats.seconds : 0.0) << " fps" << std::endl;
+    return 0;
+}
+
+/**
+ * Headless entry point used on servers without a webcam or a window system.
+ *
+ * The frame source is selected with the FRAME_SOURCE* environment variables (see FrameSource::FromEnvironment),
+ * e.g. FRAME_SOURCE=testsrc FRAME_SOURCE_PACING=fast FRAME_SOURCE_MAX_FRAMES=900 to load test the pipeline.
+ * Press q and enter, or let the source run out, to stop.
+ */
+int main(int argc, char** argv) {
+    std::string mode = argc > 1 ? argv[1] : "record";
+    if (mode == "bench-queue") {
+        uint64_t items = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10000000;
+        size_t capacity = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1024;
+        return benchmarkQueues(items, capacity);
+    }
+    if (mode == "check-rgb2yuv")
+        return checkColorConvert();
+    if (mode == "bench-rgb2yuv")
+        return benchmarkColorConvert(argc > 2 ? std::atoi(argv[2]) : 100);
+    if (mode == "bench-latency")
+        return benchmarkLatency(argc > 2 ? std::atoi(argv[2]) : 300);
+    if (mode == "bench-threads")
+        return benchmarkThreads(argc > 2 ? std::atoi(argv[2]) : 300);
+    if (mode == "bench-codecs")
+        return benchmarkCodecs(argc > 2 ? std::atoi(argv[2]) : 90);
+    if (mode == "transcode" && argc > 3)
+        return transcode(argv[2], argv[3], argc > 4 ? std::atoi(argv[4]) : 0, argc > 5 ? std::atoi(argv[5]) : 0);
+    if (mode != "record" && mode != "live") {
+        std::cerr << "usage: " << argv[0] << " [record|live|bench-queue [items [capacity]]|check-rgb2yuv|bench-rgb2yuv [frames]|bench-latency [frames]|bench-threads [frames]|bench-codecs [frames]|transcode input output [workers [kbps]]]\n"
+                  << "  record         capture and encode to FILE_PATH\n"
+                  << "  live           capture, encode and stream to websocket clients on port 9002\n"
+                  << "  bench-queue    compare ThreadSafeQueue and SpscRingBuffer hand-off throughput\n"
+                  << "  check-rgb2yuv  check the RGB24 to YUV420P kernels against each other and swscale\n"
+                  << "  bench-rgb2yuv  time the RGB24 to YUV420P kernels and swscale at 720p, 1080p and 4K\n"
+                  << "  bench-latency  encoder input-to-packet delay of the default and low-latency profiles, 720p30 in real time\n"
+                  << "  bench-threads  encoder fps, latency and size at 1 to 16 frame and slice threads on a synthetic 720p clip\n"
+                  << "  bench-codecs   CPU time per kbit of H.264, VP8 and VP9 on a synthetic 720p clip\n"
+                  << "  transcode      re-encode a recording in keyframe-aligned chunks on parallel workers (default one per core)\n";
+        return 1;
+    }
+
+    videoStream stream;
+    stream.m_recording.store(true);
+
+    auto start = std::chrono::steady_clock::now();
+    int ret = 0;
+    if (mode == "record") {
+        ret = stream.videoCaptureAndEncoding();
+    } else {
+        stream.sendLiveVideoToClient();
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t frames = stream.m_framesCaptured.load();
+    std::cout << "Captured " << frames << " frames in " << elapsed << " s ("
+              << (elapsed > 0 ? frames / elapsed : 0.0) << " fps)" << std::endl;
+    return ret;
+}
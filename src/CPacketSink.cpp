@@ -0,0 +1,536 @@
+#include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/dict.h>
+}
+#include <CPacketSink.hpp>
+
+
+static bool EndsWith(const std::string &text, const char *suffix)
+{
+    std::string tail(suffix);
+    if (text.size() < tail.size())
+        return false;
+    std::string end = text.substr(text.size() - tail.size());
+    std::transform(end.begin(), end.end(), end.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return end == tail;
+}
+
+static bool StartsWith(const std::string &text, const char *prefix)
+{
+    return text.compare(0, std::char_traits<char>::length(prefix), prefix) == 0;
+}
+
+// RFC 6381 codecs parameter of an encoder's stream, as MediaSource.isTypeSupported expects it.
+static std::string MimeCodec(const AVCodecContext *codec)
+{
+    char text[32];
+    if (codec->codec_id == AV_CODEC_ID_VP9)
+    {
+        // Level from the picture size, 8 bit 4:2:0.
+        const int64_t samples = (int64_t)codec->width * codec->height;
+        const int level = samples <= 36864 ? 10 : samples <= 122880 ? 20 : samples <= 245760 ? 21 :
+                          samples <= 552960 ? 30 : samples <= 983040 ? 31 : samples <= 2228224 ? 41 :
+                          samples <= 8912896 ? 51 : 61;
+        std::snprintf(text, sizeof(text), "vp09.%02d.%02d.08", std::max(codec->profile, 0), level);
+        return text;
+    }
+    if (codec->codec_id == AV_CODEC_ID_H264)
+    {
+        // profile_idc, the constraint flags and level_idc open the SPS. libx264 writes its global header in
+        // Annex B, start code then SPS NAL; avcC extradata carries the same three bytes at offset 1.
+        const uint8_t *data = codec->extradata;
+        const int size = codec->extradata_size;
+        for (int i = 0; data && i + 6 < size; i++)
+        {
+            if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && (data[i + 3] & 0x1f) == 7)
+            {
+                std::snprintf(text, sizeof(text), "avc1.%02x%02x%02x", data[i + 4], data[i + 5], data[i + 6]);
+                return text;
+            }
+        }
+        if (size >= 4 && data[0] == 1)
+        {
+            std::snprintf(text, sizeof(text), "avc1.%02x%02x%02x", data[1], data[2], data[3]);
+            return text;
+        }
+        return "avc1.64001e";
+    }
+    return avcodec_get_name(codec->codec_id);
+}
+
+std::shared_ptr<PacketSink> PacketSink::Create(const std::string &target)
+{
+    if (EndsWith(target, ".h264") || EndsWith(target, ".264"))
+        return std::make_shared<AnnexBSink>(target);
+    if (StartsWith(target, "udp://") || StartsWith(target, "tcp://") || StartsWith(target, "srt://"))
+        return std::make_shared<MuxerSink>(target, "mpegts");
+    if (StartsWith(target, "rtmp://"))
+        return std::make_shared<MuxerSink>(target, "flv");
+    return std::make_shared<MuxerSink>(target);
+}
+
+
+MuxerSink::MuxerSink(const std::string &url, const std::string &format, const std::string &options)
+    : mUrl(url), mFormat(format), mOptions(options)
+{
+}
+
+MuxerSink::~MuxerSink()
+{
+    Close();
+}
+
+bool MuxerSink::Open(const AVCodecContext *codec)
+{
+    Close();
+
+    do
+    {
+        avformat_alloc_output_context2(&mFormatContext, nullptr, mFormat.empty() ? nullptr : mFormat.c_str(), mUrl.c_str());
+        if (!mFormatContext)
+        {
+            std::cout << "could not allocate output format for " << mUrl << std::endl;
+            break;
+        }
+
+        mStream = avformat_new_stream(mFormatContext, nullptr);
+        if (!mStream)
+        {
+            std::cout << "could not create stream" << std::endl;
+            break;
+        }
+        mStream->id = (int)(mFormatContext->nb_streams - 1);
+
+        int ret = avcodec_parameters_from_context(mStream->codecpar, codec);
+        if (ret < 0)
+        {
+            std::cout << "could not copy the stream parameters" << std::endl;
+            break;
+        }
+        mStream->time_base = codec->time_base;
+        mStream->avg_frame_rate = codec->framerate;
+        mCodecTimeBase = codec->time_base;
+
+        mPacket = av_packet_alloc();
+        if (!mPacket)
+        {
+            std::cout << "could not allocate packet" << std::endl;
+            break;
+        }
+
+        av_dump_format(mFormatContext, 0, mUrl.c_str(), 1);
+
+        if (!(mFormatContext->oformat->flags & AVFMT_NOFILE))
+        {
+            ret = avio_open(&mFormatContext->pb, mUrl.c_str(), AVIO_FLAG_WRITE);
+            if (ret < 0)
+            {
+                std::cout << "could not open " << mUrl << std::endl;
+                break;
+            }
+        }
+
+        AVDictionary *options = nullptr;
+        if (!mOptions.empty())
+            av_dict_parse_string(&options, mOptions.c_str(), "=", ":", 0);
+        ret = avformat_write_header(mFormatContext, &options);
+        av_dict_free(&options);
+        if (ret < 0)
+        {
+            std::cout << "could not write header to " << mUrl << std::endl;
+            break;
+        }
+
+        mHeaderWritten = true;
+        return true;
+    } while (false);
+
+    Close();
+    return false;
+}
+
+bool MuxerSink::Write(const AVPacket *packet)
+{
+    if (!mHeaderWritten)
+        return false;
+
+    int ret = av_packet_ref(mPacket, packet);
+    if (ret < 0)
+    {
+        std::cout << "could not reference packet" << std::endl;
+        return false;
+    }
+    mPacket->stream_index = mStream->index;
+    av_packet_rescale_ts(mPacket, mCodecTimeBase, mStream->time_base);
+
+    // The muxer takes over the reference and leaves mPacket blank.
+    ret = av_interleaved_write_frame(mFormatContext, mPacket);
+    if (ret < 0)
+    {
+        std::cout << "error while writing output packet to " << mUrl << ": " << ret << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void MuxerSink::Close()
+{
+    if (mHeaderWritten)
+        av_write_trailer(mFormatContext);
+    mHeaderWritten = false;
+
+    if (mFormatContext)
+    {
+        if (mFormatContext->pb && !(mFormatContext->oformat->flags & AVFMT_NOFILE))
+        {
+            if (avio_closep(&mFormatContext->pb) != 0)
+                std::cout << "failed to close " << mUrl << std::endl;
+        }
+        avformat_free_context(mFormatContext);
+        mFormatContext = nullptr;
+    }
+    mStream = nullptr;
+
+    if (mPacket)
+        av_packet_free(&mPacket);
+}
+
+std::string MuxerSink::Name() const
+{
+    return mUrl;
+}
+
+
+FragmentSink::FragmentSink(const Params &params)
+    : mParams(params)
+{
+}
+
+FragmentSink::~FragmentSink()
+{
+    Close();
+}
+
+void FragmentSink::SetParams(const Params &params)
+{
+    mParams = params;
+}
+
+bool FragmentSink::Open(const AVCodecContext *codec)
+{
+    Close();
+    mFragments.reopen();
+
+    do
+    {
+        avformat_alloc_output_context2(&mFormatContext, nullptr, "mp4", nullptr);
+        if (!mFormatContext)
+        {
+            std::cout << "could not allocate output format" << std::endl;
+            break;
+        }
+
+        mStream = avformat_new_stream(mFormatContext, nullptr);
+        if (!mStream)
+        {
+            std::cout << "could not create stream" << std::endl;
+            break;
+        }
+
+        int ret = avcodec_parameters_from_context(mStream->codecpar, codec);
+        if (ret < 0)
+        {
+            std::cout << "could not copy the stream parameters" << std::endl;
+            break;
+        }
+        mStream->time_base = codec->time_base;
+        mStream->avg_frame_rate = codec->framerate;
+        mCodecTimeBase = codec->time_base;
+        mCodec = MimeCodec(codec);
+
+        mPacket = av_packet_alloc();
+        if (!mPacket)
+        {
+            std::cout << "could not allocate packet" << std::endl;
+            break;
+        }
+
+        const int buffer_size = 64 * 1024;
+        uint8_t *buffer = (uint8_t *)av_malloc(buffer_size);
+        if (buffer)
+            mFormatContext->pb = avio_alloc_context(buffer, buffer_size, 1, this, nullptr, &FragmentSink::WriteOutput, nullptr);
+        if (!mFormatContext->pb)
+        {
+            av_free(buffer);
+            std::cout << "could not allocate output buffer" << std::endl;
+            break;
+        }
+
+        // frag_custom: fragments are cut by FlushFragment only.
+        AVDictionary *opts = nullptr;
+        av_dict_set(&opts, "movflags", "empty_moov+default_base_moof+frag_custom", 0);
+        mPendingInit = true;
+        ret = avformat_write_header(mFormatContext, &opts);
+        av_dict_free(&opts);
+        if (ret < 0)
+        {
+            std::cout << "could not write header" << std::endl;
+            break;
+        }
+        mHeaderWritten = true;
+
+        avio_flush(mFormatContext->pb);
+        mInitSegment = TakePending(true);
+        mPendingInit = false;
+        if (!mInitSegment)
+        {
+            std::cout << "could not store the init segment" << std::endl;
+            break;
+        }
+        if (!mFragments.push(mInitSegment))
+            mFragmentsDropped++;
+        return true;
+    } while (false);
+
+    Close();
+    return false;
+}
+
+bool FragmentSink::Write(const AVPacket *packet)
+{
+    if (!mHeaderWritten)
+        return false;
+
+    // Start every keyframe on a new fragment, so a fragment never spans two GOPs.
+    if ((packet->flags & AV_PKT_FLAG_KEY) && mFragmentFrames > 0 && !FlushFragment())
+        return false;
+    if (mFragmentFrames == 0)
+    {
+        mPendingKeyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+        mPendingStartTime = av_rescale_q(packet->pts, mCodecTimeBase, AV_TIME_BASE_Q);
+    }
+
+    int ret = av_packet_ref(mPacket, packet);
+    if (ret < 0)
+    {
+        std::cout << "could not reference packet" << std::endl;
+        return false;
+    }
+    mPacket->stream_index = mStream->index;
+    av_packet_rescale_ts(mPacket, mCodecTimeBase, mStream->time_base);
+    ret = av_write_frame(mFormatContext, mPacket);
+    av_packet_unref(mPacket);
+    if (ret < 0)
+    {
+        std::cerr << "Error while writing output packet" << std::endl;
+        return false;
+    }
+
+    mFragmentFrames++;
+    mFragmentDuration += packet->duration;
+    bool full = mParams.frames_per_fragment > 0 && mFragmentFrames >= mParams.frames_per_fragment;
+    if (mParams.fragment_duration_ms > 0 &&
+        av_rescale_q(mFragmentDuration, mCodecTimeBase, AVRational{ 1, 1000 }) >= mParams.fragment_duration_ms)
+        full = true;
+    return full ? FlushFragment() : true;
+}
+
+bool FragmentSink::FlushFragment()
+{
+    int ret = av_write_frame(mFormatContext, nullptr);
+    avio_flush(mFormatContext->pb);
+    mFragmentFrames = 0;
+    mFragmentDuration = 0;
+    if (ret < 0)
+    {
+        std::cerr << "Error while writing fragment" << std::endl;
+        av_buffer_unref(&mPendingBuffer);
+        mPendingSize = 0;
+        return false;
+    }
+    if (mPendingSize > 0)
+    {
+        if (!mFragments.push(TakePending(false)))
+            mFragmentsDropped++;
+        mFragmentCount++;
+    }
+    return true;
+}
+
+EncodedFragment FragmentSink::TakePending(bool init)
+{
+    if (!init)
+        (mPendingKeyframe ? mKeyframePool : mDeltaPool).Record(mPendingSize);
+    EncodedFragment fragment(mPendingBuffer, mPendingSize, init, init || mPendingKeyframe,
+                             init ? AV_NOPTS_VALUE : mPendingStartTime);
+    mPendingBuffer = nullptr;
+    mPendingSize = 0;
+    return fragment;
+}
+
+void FragmentSink::Close()
+{
+    if (mHeaderWritten)
+    {
+        if (mFragmentFrames > 0)
+            FlushFragment();
+        // The trailer only adds an mfra index a live client has no use for.
+        av_write_trailer(mFormatContext);
+
+        if (mFragmentCount)
+        {
+            std::cout << "fMP4 fragments: " << mFragmentCount << ", average " << mKeyframePool.AverageSize()
+                      << " bytes with a keyframe, " << mDeltaPool.AverageSize() << " without, buffers grown "
+                      << mKeyframePool.Grown() + mDeltaPool.Grown() << " times" << std::endl;
+        }
+        if (mFragmentsDropped)
+            std::cout << "fMP4 pieces dropped, nobody took them: " << mFragmentsDropped << std::endl;
+    }
+    mHeaderWritten = false;
+    mPendingInit = false;
+    av_buffer_unref(&mPendingBuffer);
+    mPendingSize = 0;
+    mFragmentFrames = 0;
+    mFragmentDuration = 0;
+    mFragmentCount = 0;
+    mFragmentsDropped = 0;
+
+    if (mFormatContext)
+    {
+        if (mFormatContext->pb)
+        {
+            av_freep(&mFormatContext->pb->buffer);
+            avio_context_free(&mFormatContext->pb);
+        }
+        avformat_free_context(mFormatContext);
+        mFormatContext = nullptr;
+    }
+    mStream = nullptr;
+
+    if (mPacket)
+        av_packet_free(&mPacket);
+
+    // Wake Pop callers once the remaining pieces are consumed
+    mFragments.close();
+}
+
+int FragmentSink::WriteOutput(void *opaque, const uint8_t *buf, int buf_size)
+{
+    FragmentSink *sink = static_cast<FragmentSink *>(opaque);
+    FragmentPool &pool = sink->mPendingKeyframe ? sink->mKeyframePool : sink->mDeltaPool;
+    // The init segment is written once, it gets an exact buffer instead of a pooled one.
+    if (!sink->mPendingBuffer && !sink->mPendingInit)
+        sink->mPendingBuffer = pool.Acquire();
+    if (!pool.Reserve(&sink->mPendingBuffer, sink->mPendingSize + buf_size))
+        return AVERROR(ENOMEM);
+    std::memcpy(sink->mPendingBuffer->data + sink->mPendingSize, buf, buf_size);
+    sink->mPendingSize += buf_size;
+    return buf_size;
+}
+
+std::string FragmentSink::Name() const
+{
+    return "fmp4";
+}
+
+bool FragmentSink::Pop(EncodedFragment &fragment)
+{
+    return mFragments.pop(fragment);
+}
+
+bool FragmentSink::TryPop(EncodedFragment &fragment)
+{
+    return mFragments.try_pop(fragment);
+}
+
+bool FragmentSink::Empty() const
+{
+    return mFragments.empty();
+}
+
+const EncodedFragment &FragmentSink::InitSegment() const
+{
+    return mInitSegment;
+}
+
+const std::string &FragmentSink::Codec() const
+{
+    return mCodec;
+}
+
+
+static bool IsAnnexB(const uint8_t *data, int size)
+{
+    return (size >= 3 && data[0] == 0 && data[1] == 0 && data[2] == 1) ||
+        (size >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1);
+}
+
+AnnexBSink::AnnexBSink(const std::string &path)
+    : mPath(path)
+{
+}
+
+AnnexBSink::~AnnexBSink()
+{
+    Close();
+}
+
+bool AnnexBSink::Open(const AVCodecContext *codec)
+{
+    Close();
+
+    mHeaders.clear();
+    if (codec->codec_id != AV_CODEC_ID_H264)
+    {
+        std::cout << "encoder does not produce H.264, cannot write " << mPath << std::endl;
+        return false;
+    }
+    if (codec->extradata_size > 0)
+    {
+        if (!IsAnnexB(codec->extradata, codec->extradata_size))
+        {
+            std::cout << "encoder does not produce Annex-B output, cannot write " << mPath << std::endl;
+            return false;
+        }
+        mHeaders.assign(codec->extradata, codec->extradata + codec->extradata_size);
+    }
+
+    mFile.open(mPath, std::ios::binary | std::ios::trunc);
+    if (!mFile)
+    {
+        std::cout << "could not open " << mPath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool AnnexBSink::Write(const AVPacket *packet)
+{
+    if (!mFile.is_open())
+        return false;
+    if ((packet->flags & AV_PKT_FLAG_KEY) && !mHeaders.empty())
+        mFile.write(reinterpret_cast<const char *>(mHeaders.data()), (std::streamsize)mHeaders.size());
+    mFile.write(reinterpret_cast<const char *>(packet->data), packet->size);
+    if (!mFile)
+    {
+        std::cout << "error while writing to " << mPath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void AnnexBSink::Close()
+{
+    if (mFile.is_open())
+        mFile.close();
+}
+
+std::string AnnexBSink::Name() const
+{
+    return mPath;
+}
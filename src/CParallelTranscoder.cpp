@@ -0,0 +1,489 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <CPacketSink.hpp>
+#include <CParallelTranscoder.hpp>
+
+namespace {
+
+/**
+ * @brief Keeps the packets of one chunk's encoder, and its parameters once open.
+ */
+class ChunkSink : public PacketSink
+{
+public:
+    explicit ChunkSink(std::vector<AVPacket*> &packets)
+        : mPackets(packets)
+    {
+    }
+
+    ~ChunkSink() override
+    {
+        avcodec_parameters_free(&mCodecpar);
+    }
+
+    bool Open(const AVCodecContext *codec) override
+    {
+        avcodec_parameters_free(&mCodecpar);
+        mCodecpar = avcodec_parameters_alloc();
+        if (!mCodecpar || avcodec_parameters_from_context(mCodecpar, codec) < 0)
+        {
+            std::cout << "could not copy the chunk parameters" << std::endl;
+            return false;
+        }
+        mTimeBase = codec->time_base;
+        mFramerate = codec->framerate;
+        return true;
+    }
+
+    bool Write(const AVPacket *packet) override
+    {
+        AVPacket *clone = av_packet_clone(packet);
+        if (!clone)
+        {
+            std::cout << "could not reference packet" << std::endl;
+            return false;
+        }
+        mPackets.push_back(clone);
+        return true;
+    }
+
+    void Close() override
+    {
+    }
+
+    std::string Name() const override
+    {
+        return "chunk";
+    }
+
+    /**
+     * @brief Hands the parameters over to the caller.
+     */
+    AVCodecParameters* TakeCodecpar()
+    {
+        AVCodecParameters *codecpar = mCodecpar;
+        mCodecpar = nullptr;
+        return codecpar;
+    }
+
+    AVRational TimeBase() const { return mTimeBase; }
+    AVRational Framerate() const { return mFramerate; }
+
+private:
+    std::vector<AVPacket*> &mPackets; ///< Packets of the chunk, owned by the caller.
+    AVCodecParameters *mCodecpar = nullptr; ///< Parameters of the encoder.
+    AVRational mTimeBase = { 0, 1 }; ///< Codec time base.
+    AVRational mFramerate = { 0, 1 }; ///< Codec frame rate.
+};
+
+int64_t PacketTime(const AVPacket *packet)
+{
+    return packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+}
+
+bool SameExtradata(const AVCodecParameters *a, const AVCodecParameters *b)
+{
+    return a->extradata_size == b->extradata_size &&
+           (a->extradata_size == 0 || std::memcmp(a->extradata, b->extradata, a->extradata_size) == 0);
+}
+
+}
+
+
+bool ParallelTranscoder::Run(const std::string &input, const std::string &output, const Params &params)
+{
+    auto started = std::chrono::steady_clock::now();
+    mStats = Stats();
+    for (Chunk &chunk : mChunks)
+        FreeChunk(chunk);
+    mChunks.clear();
+    mNextChunk = 0;
+    mWritten = 0;
+    mFailed = false;
+
+    int workers = params.workers > 0 ? params.workers : (int)std::thread::hardware_concurrency();
+    workers = std::max(workers, 1);
+
+    Input in;
+    if (!OpenInput(input, in))
+    {
+        CloseInput(in);
+        return false;
+    }
+
+    // Resolve what the chunks leave to the input, so every chunk encodes with the same parameters.
+    mEncoderParams = params.encoder;
+    const AVStream *stream = in.format_context->streams[in.stream_index];
+    if (!mEncoderParams.width || !mEncoderParams.height)
+    {
+        mEncoderParams.width = in.decoder->width;
+        mEncoderParams.height = in.decoder->height;
+    }
+    if (mEncoderParams.fps <= 0.0)
+    {
+        AVRational rate = stream->avg_frame_rate.num ? stream->avg_frame_rate : stream->r_frame_rate;
+        mEncoderParams.fps = rate.num && rate.den ? av_q2d(rate) : 30.0;
+    }
+    mEncoderParams.src_format = in.decoder->pix_fmt;
+    mEncoderParams.vfr = true;
+    mEncoderParams.rebase_pts = false;
+    mEncoderParams.keyframe_interval = 0.0;
+    // The workers already keep the cores busy; more encoder threads per chunk only add contention.
+    if (mEncoderParams.threads <= 0)
+        mEncoderParams.threads = 1;
+
+    bool indexed = BuildChunks(in, workers, params.chunks_per_worker);
+    CloseInput(in);
+    if (!indexed)
+        return false;
+
+    workers = std::min<int>(workers, (int)mChunks.size());
+    mWindow = 2 * (size_t)workers;
+    mStats.workers = workers;
+    mStats.chunks = mChunks.size();
+    std::cout << "Transcoding " << input << " in " << mChunks.size() << " chunk(s) on "
+              << workers << " worker(s)" << std::endl;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; i++)
+        threads.emplace_back(&ParallelTranscoder::WorkerLoop, this, input);
+
+    MuxerSink muxer(output, params.format);
+    int64_t last_dts = AV_NOPTS_VALUE;
+    bool ok = true;
+    for (size_t i = 0; i < mChunks.size() && ok; i++)
+    {
+        Chunk &chunk = mChunks[i];
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mChanged.wait(lock, [&] { return chunk.done || mFailed; });
+            ok = chunk.ok;
+        }
+        if (!ok)
+            break;
+
+        // The worker is done with the chunk: it can be read without the lock.
+        if (i == 0)
+        {
+            AVCodecContext *codec = avcodec_alloc_context3(nullptr);
+            if (!codec || avcodec_parameters_to_context(codec, chunk.codecpar) < 0)
+            {
+                std::cout << "could not set up the output parameters" << std::endl;
+                ok = false;
+            }
+            else
+            {
+                codec->time_base = chunk.time_base;
+                codec->framerate = chunk.framerate;
+                ok = muxer.Open(codec);
+            }
+            avcodec_free_context(&codec);
+        }
+        else if (!SameExtradata(chunk.codecpar, mChunks[0].codecpar) ||
+                 av_cmp_q(chunk.time_base, mChunks[0].time_base) != 0)
+        {
+            std::cerr << "chunk " << i << " came out with different codec headers, cannot join it" << std::endl;
+            ok = false;
+        }
+
+        for (size_t p = 0; p < chunk.packets.size() && ok; p++)
+        {
+            AVPacket *packet = chunk.packets[p];
+            // Chunks join on a keyframe so decode order carries on, but keep it strictly increasing for the muxer.
+            if (last_dts != AV_NOPTS_VALUE && packet->dts != AV_NOPTS_VALUE && packet->dts <= last_dts)
+            {
+                packet->dts = last_dts + 1;
+                if (packet->pts != AV_NOPTS_VALUE && packet->dts > packet->pts)
+                {
+                    std::cerr << "chunk " << i << " overlaps the previous one, cannot join it" << std::endl;
+                    ok = false;
+                    break;
+                }
+            }
+            if (packet->dts != AV_NOPTS_VALUE)
+                last_dts = packet->dts;
+            ok = muxer.Write(packet);
+            mStats.bytes += packet->size;
+        }
+        mStats.frames += chunk.frames;
+        // The parameters stay until the end: later chunks are checked against the first one's.
+        for (AVPacket *&packet : chunk.packets)
+            av_packet_free(&packet);
+        chunk.packets.clear();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mWritten = i + 1;
+        if (!ok)
+            mFailed = true;
+        mChanged.notify_all();
+    }
+    if (!ok)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFailed = true;
+        mChanged.notify_all();
+    }
+
+    for (std::thread &thread : threads)
+        thread.join();
+    muxer.Close();
+    for (Chunk &chunk : mChunks)
+        FreeChunk(chunk);
+
+    mStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    if (!ok)
+    {
+        std::cerr << "Transcoding " << input << " failed" << std::endl;
+        return false;
+    }
+    std::cout << "Transcoded " << mStats.frames << " frames to " << output << " in " << mStats.seconds << " s ("
+              << (mStats.seconds > 0.0 ? mStats.frames / mStats.seconds : 0.0) << " fps)" << std::endl;
+    return true;
+}
+
+ParallelTranscoder::Stats ParallelTranscoder::GetStats() const
+{
+    return mStats;
+}
+
+bool ParallelTranscoder::OpenInput(const std::string &input, Input &in)
+{
+    int ret = avformat_open_input(&in.format_context, input.c_str(), nullptr, nullptr);
+    if (ret < 0)
+    {
+        std::cout << "could not open " << input << std::endl;
+        return false;
+    }
+
+    ret = avformat_find_stream_info(in.format_context, nullptr);
+    if (ret < 0)
+    {
+        std::cout << "could not read stream information of " << input << std::endl;
+        return false;
+    }
+
+    const AVCodec *codec = nullptr;
+    in.stream_index = av_find_best_stream(in.format_context, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (in.stream_index < 0 || !codec)
+    {
+        std::cout << "no decodable video stream in " << input << std::endl;
+        return false;
+    }
+
+    in.decoder = avcodec_alloc_context3(codec);
+    if (!in.decoder)
+    {
+        std::cout << "could not allocate decoder context" << std::endl;
+        return false;
+    }
+    AVStream *stream = in.format_context->streams[in.stream_index];
+    ret = avcodec_parameters_to_context(in.decoder, stream->codecpar);
+    if (ret < 0)
+    {
+        std::cout << "could not copy the decoder parameters" << std::endl;
+        return false;
+    }
+    in.decoder->pkt_timebase = stream->time_base;
+    in.decoder->thread_count = 1;
+
+    ret = avcodec_open2(in.decoder, codec, nullptr);
+    if (ret < 0)
+    {
+        std::cout << "could not open decoder" << std::endl;
+        return false;
+    }
+
+    in.packet = av_packet_alloc();
+    in.frame = av_frame_alloc();
+    if (!in.packet || !in.frame)
+    {
+        std::cout << "could not allocate packet or frame" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void ParallelTranscoder::CloseInput(Input &in)
+{
+    av_frame_free(&in.frame);
+    av_packet_free(&in.packet);
+    avcodec_free_context(&in.decoder);
+    avformat_close_input(&in.format_context);
+    in.stream_index = -1;
+}
+
+bool ParallelTranscoder::BuildChunks(Input &in, int workers, int chunks_per_worker)
+{
+    // Keyframe timestamps and the number of frames of the GOP each one starts.
+    std::vector<int64_t> keyframes;
+    std::vector<uint64_t> gop_frames;
+    uint64_t total_frames = 0;
+    while (av_read_frame(in.format_context, in.packet) >= 0)
+    {
+        if (in.packet->stream_index == in.stream_index)
+        {
+            if ((in.packet->flags & AV_PKT_FLAG_KEY) && PacketTime(in.packet) != AV_NOPTS_VALUE)
+            {
+                keyframes.push_back(PacketTime(in.packet));
+                gop_frames.push_back(0);
+            }
+            if (!gop_frames.empty())
+            {
+                gop_frames.back()++;
+                total_frames++;
+            }
+        }
+        av_packet_unref(in.packet);
+    }
+
+    if (keyframes.empty())
+    {
+        std::cout << "no keyframe in the input" << std::endl;
+        return false;
+    }
+
+    // Whole GOPs, about the same number of frames per chunk.
+    uint64_t wanted = (uint64_t)std::max(workers * std::max(chunks_per_worker, 1), 1);
+    uint64_t target = std::max<uint64_t>(total_frames / wanted, 1);
+    Chunk chunk;
+    for (size_t i = 0; i < keyframes.size(); i++)
+    {
+        if (chunk.start == AV_NOPTS_VALUE)
+            chunk.start = keyframes[i];
+        chunk.frames += gop_frames[i];
+        if (chunk.frames >= target || i + 1 == keyframes.size())
+        {
+            chunk.end = i + 1 < keyframes.size() ? keyframes[i + 1] : AV_NOPTS_VALUE;
+            // The index count is only for balancing, the worker counts what it encodes.
+            chunk.frames = 0;
+            mChunks.push_back(chunk);
+            chunk = Chunk();
+        }
+    }
+    return true;
+}
+
+void ParallelTranscoder::WorkerLoop(const std::string &input)
+{
+    Input in;
+    bool opened = OpenInput(input, in);
+
+    for (;;)
+    {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mChanged.wait(lock, [&] { return mFailed || mNextChunk >= mChunks.size() || mNextChunk < mWritten + mWindow; });
+            if (mFailed || mNextChunk >= mChunks.size())
+                break;
+            index = mNextChunk++;
+        }
+
+        Chunk &chunk = mChunks[index];
+        bool ok = opened && EncodeChunk(in, chunk);
+        if (!ok)
+            std::cerr << "could not transcode chunk " << index << std::endl;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        chunk.ok = ok;
+        chunk.done = true;
+        if (!ok)
+            mFailed = true;
+        mChanged.notify_all();
+    }
+
+    CloseInput(in);
+}
+
+bool ParallelTranscoder::EncodeChunk(Input &in, Chunk &chunk)
+{
+    AVStream *stream = in.format_context->streams[in.stream_index];
+    // Output timestamps start at the first chunk, whatever the input's start time was.
+    const int64_t origin = mChunks.front().start;
+
+    // Seeking lands on the chunk's keyframe or one before it; frames before the start are dropped.
+    int ret = av_seek_frame(in.format_context, in.stream_index, chunk.start, AVSEEK_FLAG_BACKWARD);
+    if (ret < 0)
+    {
+        std::cout << "could not seek to " << chunk.start << std::endl;
+        return false;
+    }
+    avcodec_flush_buffers(in.decoder);
+
+    auto sink = std::make_shared<ChunkSink>(chunk.packets);
+    EncoderCore encoder;
+    encoder.AddSink(sink);
+    if (!encoder.Open(mEncoderParams))
+        return false;
+
+    bool ok = true;
+    auto receive = [&]() {
+        while (ok && (ret = avcodec_receive_frame(in.decoder, in.frame)) >= 0)
+        {
+            int64_t pts = in.frame->best_effort_timestamp;
+            if (pts != AV_NOPTS_VALUE && pts >= chunk.start && (chunk.end == AV_NOPTS_VALUE || pts < chunk.end))
+            {
+                in.frame->pts = pts - origin;
+                in.frame->time_base = stream->time_base;
+                ok = encoder.Write(in.frame);
+                chunk.frames++;
+            }
+            av_frame_unref(in.frame);
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+        {
+            std::cout << "error during decoding" << std::endl;
+            ok = false;
+        }
+    };
+
+    // Recordings use closed GOPs: every frame of the chunk is read before the next chunk's keyframe.
+    while (ok && av_read_frame(in.format_context, in.packet) >= 0)
+    {
+        if (in.packet->stream_index != in.stream_index)
+        {
+            av_packet_unref(in.packet);
+            continue;
+        }
+        if (chunk.end != AV_NOPTS_VALUE && (in.packet->flags & AV_PKT_FLAG_KEY) && PacketTime(in.packet) >= chunk.end)
+        {
+            av_packet_unref(in.packet);
+            break;
+        }
+        // Frames are drained after every packet, so the decoder always takes the next one.
+        ret = avcodec_send_packet(in.decoder, in.packet);
+        av_packet_unref(in.packet);
+        if (ret < 0)
+        {
+            std::cout << "error sending a packet for decoding" << std::endl;
+            ok = false;
+            break;
+        }
+        receive();
+    }
+
+    if (ok)
+    {
+        avcodec_send_packet(in.decoder, nullptr);
+        receive();
+    }
+    // Leaves the decoder ready for the next chunk after draining.
+    avcodec_flush_buffers(in.decoder);
+
+    encoder.Close();
+    chunk.codecpar = sink->TakeCodecpar();
+    chunk.time_base = sink->TimeBase();
+    chunk.framerate = sink->Framerate();
+    return ok && chunk.codecpar && !chunk.packets.empty();
+}
+
+void ParallelTranscoder::FreeChunk(Chunk &chunk)
+{
+    for (AVPacket *&packet : chunk.packets)
+        av_packet_free(&packet);
+    chunk.packets.clear();
+    avcodec_parameters_free(&chunk.codecpar);
+}
@@ -0,0 +1,51 @@
+#include <iomanip>
+#include <CPipeline.hpp>
+
+
+Pipeline::~Pipeline()
+{
+    Stop();
+    Wait();
+}
+
+void Pipeline::Start()
+{
+    // Consumers first, so nothing is pushed to a stage whose workers are not running yet.
+    for (auto it = mStages.rbegin(); it != mStages.rend(); ++it)
+        (*it)->Start();
+}
+
+void Pipeline::Stop()
+{
+    for (auto& stage : mStages)
+        stage->RequestStop();
+}
+
+void Pipeline::Wait()
+{
+    for (auto& stage : mStages)
+        stage->Join();
+}
+
+std::vector<PipelineStage::Stats> Pipeline::GetStats() const
+{
+    std::vector<PipelineStage::Stats> stats;
+    for (auto& stage : mStages)
+        stats.push_back(stage->GetStats());
+    return stats;
+}
+
+void Pipeline::Report(std::ostream& out) const
+{
+    for (const PipelineStage::Stats& stats : GetStats())
+    {
+        double rate = stats.elapsed_seconds > 0 ? stats.processed / stats.elapsed_seconds : 0.0;
+        double busy = stats.elapsed_seconds > 0 ? 100.0 * stats.busy_seconds / stats.elapsed_seconds : 0.0;
+        out << std::left << std::setw(10) << stats.name << std::right
+            << " processed " << stats.processed << " (" << std::fixed << std::setprecision(1) << rate << "/s)"
+            << ", emitted " << stats.emitted
+            << ", busy " << busy << "%"
+            << ", queue " << stats.queue_depth << " (high water " << stats.queue_high_water << ")"
+            << ", dropped " << stats.dropped << std::defaultfloat << std::endl;
+    }
+}
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <CRateController.hpp>
+
+namespace {
+
+double Seconds(RateController::Clock::duration duration)
+{
+    return std::chrono::duration<double>(duration).count();
+}
+
+}
+
+
+RateController::RateController(uint32_t bitrate)
+    : RateController(bitrate, Params())
+{
+}
+
+RateController::RateController(uint32_t bitrate, const Params &params)
+    : mParams(params)
+{
+    mParams.min_bitrate = std::max<uint32_t>(mParams.min_bitrate, 1);
+    mParams.max_bitrate = std::max(mParams.max_bitrate, mParams.min_bitrate);
+    Reset(bitrate, Clock::now());
+}
+
+void RateController::Reset(uint32_t bitrate, Clock::time_point now)
+{
+    mBitrate = std::min(std::max(bitrate, mParams.min_bitrate), mParams.max_bitrate);
+    mChangeTime = now;
+    mCalmSince = now;
+    mChangeBacklog = 0;
+    mChanges = 0;
+}
+
+uint32_t RateController::Update(Clock::time_point now, size_t backlog, size_t queue_depth)
+{
+    double backlog_seconds = backlog * 8.0 / mBitrate;
+    double since_change = Seconds(now - mChangeTime);
+
+    bool queue_congested = queue_depth > mParams.max_queue_depth;
+    bool link_congested = backlog_seconds > mParams.max_backlog_seconds;
+    if (queue_congested || link_congested)
+    {
+        mCalmSince = now;
+        // A backlog that shrank since the last cut is one the link is already catching up with.
+        bool draining = link_congested && mChanges > 0 && backlog < mChangeBacklog;
+        if (since_change >= mParams.hold_seconds && !draining && mBitrate > mParams.min_bitrate)
+        {
+            ChangeTo(mBitrate * mParams.decrease, now);
+            mChangeBacklog = backlog;
+        }
+        return mBitrate;
+    }
+
+    if (backlog_seconds > mParams.calm_backlog_seconds)
+    {
+        mCalmSince = now;
+    }
+    else if (mBitrate < mParams.max_bitrate && Seconds(now - mCalmSince) >= mParams.increase_after_seconds &&
+             since_change >= mParams.hold_seconds)
+    {
+        ChangeTo(mBitrate + mParams.max_bitrate * mParams.increase, now);
+        mChangeBacklog = backlog;
+    }
+    return mBitrate;
+}
+
+void RateController::ChangeTo(double bitrate, Clock::time_point now)
+{
+    mBitrate = static_cast<uint32_t>(std::min(std::max(bitrate, static_cast<double>(mParams.min_bitrate)),
+                                              static_cast<double>(mParams.max_bitrate)));
+    mChangeTime = now;
+    mChanges++;
+}
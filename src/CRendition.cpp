@@ -0,0 +1,55 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <CRendition.hpp>
+
+
+std::string Rendition::Name() const
+{
+    return std::to_string(height) + "p";
+}
+
+std::vector<Rendition> Rendition::Parse(const std::string &ladder)
+{
+    std::vector<Rendition> renditions;
+    std::stringstream entries(ladder);
+    std::string entry;
+    while (std::getline(entries, entry, ','))
+    {
+        entry.erase(std::remove_if(entry.begin(), entry.end(), [](char c) { return c == ' ' || c == '\t'; }), entry.end());
+        if (entry.empty())
+            continue;
+
+        unsigned width = 0, height = 0, kbps = 0;
+        char end = 0;
+        if (std::sscanf(entry.c_str(), "%ux%u@%u%c", &width, &height, &kbps, &end) != 3 || !width || !height || !kbps)
+        {
+            std::cerr << "Ignoring rendition \"" << entry << "\", expected WIDTHxHEIGHT@KBPS\n";
+            continue;
+        }
+
+        Rendition rendition;
+        // Encoders work on even sizes for 4:2:0.
+        rendition.width = width & ~1u;
+        rendition.height = height & ~1u;
+        rendition.bitrate = kbps * 1000;
+        renditions.push_back(rendition);
+    }
+
+    std::stable_sort(renditions.begin(), renditions.end(),
+                     [](const Rendition &a, const Rendition &b) { return a.bitrate < b.bitrate; });
+    return renditions;
+}
+
+std::vector<Rendition> Rendition::FromEnvironment()
+{
+    std::vector<Rendition> renditions;
+    const char *env_renditions = std::getenv("LIVE_RENDITIONS");
+    if (env_renditions)
+        renditions = Parse(env_renditions);
+    if (renditions.empty())
+        renditions.push_back(Rendition());
+    return renditions;
+}
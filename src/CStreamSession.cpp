@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <iostream>
+#include <CStreamSession.hpp>
+
+namespace {
+
+// Fragments kept per tier: 20 s of one-frame fragments at 30 fps, so a GOP of up to 600 frames (LIVE_GOP_SIZE,
+// 4 s by default) can be replayed whole.
+const size_t kMaxCachedFragments = 600;
+
+}
+
+
+void TierCache::Add(const EncodedFragment &fragment)
+{
+    if (fragment.isInit())
+    {
+        init = fragment;
+        gop.clear();
+        return;
+    }
+    if (fragment.startsWithKeyframe())
+        gop.clear();
+    else if (gop.size() >= kMaxCachedFragments)
+        gop.clear();
+    if (!gop.empty() || fragment.startsWithKeyframe())
+        gop.push_back(fragment);
+}
+
+bool TierCache::CanStart(int64_t resume_time) const
+{
+    return init && !gop.empty() &&
+        (resume_time == AV_NOPTS_VALUE || gop.front().startTime() >= resume_time);
+}
+
+
+StreamSession::StreamSession(const std::vector<uint32_t> &bitrates)
+    : mAbr(bitrates)
+{
+    mAbr.Reset(0, AbrController::Clock::now());
+}
+
+bool StreamSession::Start(const std::vector<TierCache> &tiers, Transport &transport)
+{
+    if (mStarted || mTier >= tiers.size() || !tiers[mTier].CanStart(mResumeTime))
+        return true;
+    return CatchUp(tiers[mTier], transport);
+}
+
+bool StreamSession::Deliver(const std::vector<TierCache> &tiers, size_t tier, const EncodedFragment &fragment, Transport &transport)
+{
+    if (tier != mTier)
+        return true;
+
+    if (mStarted && fragment.startsWithKeyframe() && mTarget != mTier)
+    {
+        // The session's tier ends here; the target takes over from its keyframe of the same instant.
+        std::cout << "Client moves from " << tiers[mTier].rendition.Name() << " to " << tiers[mTarget].rendition.Name()
+                  << ", throughput " << mAbr.Throughput() / 1000 << " kbit/s" << std::endl;
+        mTier = mTarget;
+        mStarted = false;
+        mResumeTime = fragment.startTime();
+        // Else the target gets there later and starts the session from Deliver.
+        return Start(tiers, transport);
+    }
+    if (!mStarted)
+        return Start(tiers, transport);
+    return Send(fragment, transport);
+}
+
+void StreamSession::SetTier(size_t tier, size_t tiers)
+{
+    mAutomatic = false;
+    mTarget = std::min(tier, tiers - 1);
+    if (!mStarted)
+        mTier = mTarget;
+}
+
+void StreamSession::SetAutomatic(AbrController::Clock::time_point now)
+{
+    mAutomatic = true;
+    mBytesSent = 0;
+    mAbr.Reset(mTarget, now);
+}
+
+void StreamSession::Resync()
+{
+    if (!mStarted)
+        return;
+    // The cached GOP was sent already: wait for one that starts later.
+    mStarted = false;
+    mResumeTime = mLastTime == AV_NOPTS_VALUE ? AV_NOPTS_VALUE : mLastTime + 1;
+}
+
+bool StreamSession::CatchUp(const TierCache &cache, Transport &transport)
+{
+    bool connected = Send(cache.init, transport);
+    for (size_t i = 0; connected && i < cache.gop.size(); i++)
+        connected = Send(cache.gop[i], transport);
+    mStarted = true;
+    return connected;
+}
+
+bool StreamSession::Send(const EncodedFragment &fragment, Transport &transport)
+{
+    if (!transport.Send(fragment, mBuffered))
+        return false;
+    mBytesSent += fragment.size();
+    if (fragment.startTime() != AV_NOPTS_VALUE)
+        mLastTime = fragment.startTime();
+
+    size_t target = mAbr.Update(AbrController::Clock::now(), mBytesSent, mBuffered);
+    if (mAutomatic)
+        mTarget = target;
+    return true;
+}
@@ -1,35 +1,82 @@
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <winsock2.h>
-#include <thread>
 #include <conio.h> 
+#else
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#include <thread>
 #include <iostream>
 #include <string>
+#include <cstring>
+#include <chrono>
 #include <atomic> 
 #include <algorithm>
 #include <CFFmpegEncoder.hpp>
+#ifdef _WIN32
 #include <CVideoCaptureGUI.hpp>
+#endif
 #include <CVideoStreamSocket.hpp>
 #include <CVideoStreamEncoder.hpp>
+#include <CRendition.hpp>
+#include <CRateController.hpp>
 
 
 extern "C" {
 #include <libswscale/swscale.h>
 #include <libavdevice/avdevice.h>
 #include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
 }
 
 
 #include<CStreamVideo.hpp>
+#include <CColorConvert.hpp>
 // Global variables
 
 
 
-videoStream::videoStream(): m_formatContext{nullptr}, 
-                            m_decoderContext{nullptr}, 
-                            m_videoStreamIndex{-1}                                                   
+videoStream::videoStream()
 {
-    //do nothing
+    FrameSource::FromEnvironment(m_frameSourceKind, m_frameSourceParams);
+    m_captureSession.SetScalerQuality(CaptureSession::QualityFromEnvironment());
+    m_captureSession.SetPoolSize(m_frameSourceParams.frame_pool_size, m_frameSourceParams.huge_pages);
+
+    const char* env_capture_format = std::getenv("CAPTURE_FORMAT");
+    m_nativeCapture = !env_capture_format || std::string(env_capture_format) != "rgb";
+
+    const char* env_queue_size = std::getenv("FRAME_QUEUE_SIZE");
+    if (env_queue_size)
+        m_frameQueueSize = std::strtoull(env_queue_size, nullptr, 10);
+
+    const char* env_queue_policy = std::getenv("FRAME_QUEUE_POLICY");
+    if (env_queue_policy) {
+        std::string policy = env_queue_policy;
+        if (policy == "block")
+            m_frameQueuePolicy = ThreadSafeQueue<VideoFrame>::OverflowPolicy::Block;
+        else if (policy == "drop-newest")
+            m_frameQueuePolicy = ThreadSafeQueue<VideoFrame>::OverflowPolicy::DropNewest;
+        else
+            m_frameQueuePolicy = ThreadSafeQueue<VideoFrame>::OverflowPolicy::DropOldest;
+    }
+
+    const char* env_extra_sinks = std::getenv("EXTRA_SINKS");
+    if (env_extra_sinks) {
+        std::string targets = env_extra_sinks;
+        size_t start = 0;
+        while (start <= targets.size()) {
+            size_t end = targets.find(',', start);
+            if (end == std::string::npos)
+                end = targets.size();
+            if (end > start)
+                m_extraSinks.push_back(targets.substr(start, end - start));
+            start = end + 1;
+        }
+    }
 }
 
 videoStream::~videoStream()
@@ -126,154 +173,151 @@ bool videoStream::remuxVideo(const char* inputFilename, const char* outputFilena
 }
 
 bool videoStream::initializeCamera() {
-    avdevice_register_all();
-    
-    m_formatContext = avformat_alloc_context();
-    const AVInputFormat* inputFormat = av_find_input_format("dshow");
-    AVDictionary* options = nullptr;
-    av_dict_set(&options, "rtbufsize", "100M", 0); // Increase buffer size to 100MB
-
-    if (avformat_open_input(&m_formatContext, "video=Integrated Webcam", inputFormat, &options) != 0) {
-        fprintf(stderr, "Could not open video device\n");
+    m_frameSource = FrameSource::Create(m_frameSourceKind);
+    if (!m_frameSource) {
         return false;
     }
-    av_dict_free(&options);
-
+    m_captureOrigin = AV_NOPTS_VALUE;
 
-    if (avformat_find_stream_info(m_formatContext, NULL) < 0) {
-        fprintf(stderr, "Could not find stream information\n");
-        avformat_close_input(&m_formatContext);
+    if (!m_frameSource->Open(m_frameSourceParams)) {
+        fprintf(stderr, "Could not open video device\n");
+        m_frameSource.reset();
         return false;
     }
 
-    const AVCodec* decoder = nullptr;
-    AVCodecParameters* codecParams = nullptr;
-
-    for (unsigned int i = 0; i < m_formatContext->nb_streams; i++) {
-        if (m_formatContext->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-            m_videoStreamIndex = i;
-            codecParams = m_formatContext->streams[i]->codecpar;
-            decoder = avcodec_find_decoder(codecParams->codec_id);
-            break;
+    if (!m_decodedFrame) {
+        m_decodedFrame = av_frame_alloc();
+        if (!m_decodedFrame) {
+            fprintf(stderr, "Could not allocate frame\n");
+            return false;
         }
     }
 
-    if (m_videoStreamIndex == -1) {
-        fprintf(stderr, "Could not find video stream\n");
-        avformat_close_input(&m_formatContext);
-        return false;
-    }
+    return true;
+}
 
-    if (!decoder) {
-        fprintf(stderr, "Could not find decoder\n");
-        avformat_close_input(&m_formatContext);
-        return false;
+VideoFrame videoStream::getFrame() {
+    if (!m_recording.load()) {
+        return VideoFrame();
     }
 
-    m_decoderContext = avcodec_alloc_context3(decoder);
-    if (!m_decoderContext) {
-        fprintf(stderr, "Could not allocate decoder context\n");
-        avformat_close_input(&m_formatContext);
-        return false;
+    if (!m_frameSource || !m_frameSource->ReadFrame(m_decodedFrame)) {
+        std::cout << "Frame source ended, stopping capture\n";
+        m_recording.store(false);
+        return VideoFrame();
     }
 
-    if (avcodec_parameters_to_context(m_decoderContext, codecParams) < 0) {
-        fprintf(stderr, "Could not copy codec parameters to decoder context\n");
-        avcodec_free_context(&m_decoderContext);
-        avformat_close_input(&m_formatContext);
-        return false;
+    auto captureTime = VideoFrame::Clock::now();
+    m_decodedFrame->time_base = m_frameSource->TimeBase();
+    if (m_decodedFrame->pts != AV_NOPTS_VALUE) {
+        if (m_captureOrigin == AV_NOPTS_VALUE)
+            m_captureOrigin = m_decodedFrame->pts;
+        m_decodedFrame->pts -= m_captureOrigin;
+        // Before the frame goes to the encoders: none of them is past it.
+        m_lastCaptureTime.store(av_rescale_q(m_decodedFrame->pts, m_decodedFrame->time_base, AV_TIME_BASE_Q));
     }
-
-    if (avcodec_open2(m_decoderContext, decoder, NULL) < 0) {
-        fprintf(stderr, "Could not open decoder\n");
-        avcodec_free_context(&m_decoderContext);
-        avformat_close_input(&m_formatContext);
-        return false;
+    m_framesCaptured.fetch_add(1);
+    if (m_nativeCapture) {
+        // New reference to the decoder's buffers, no pixel copy
+        return VideoFrame::Reference(m_decodedFrame, captureTime);
     }
+    return VideoFrame(m_captureSession.ConvertToRGBFrame(m_decodedFrame), captureTime);
+}
 
-    return true;
+void videoStream::previewFrame(const VideoFrame& frame) {
+    notifyObserver(frame);
 }
 
-unsigned char* videoStream::getFrameData(int& width, int& height) {
-    AVFrame* frame = av_frame_alloc();
-    if (!frame) {
-        std::cerr << "Could not allocate frame\n";
-        return nullptr;
-    }
-    AVPacket packet;
-    av_init_packet(&packet);
-    while (m_recording.load()) {
-        if (av_read_frame(m_formatContext, &packet) >= 0) {
-            if (packet.stream_index == m_videoStreamIndex) {
-                if (avcodec_send_packet(m_decoderContext, &packet) == 0) {
-                    if (avcodec_receive_frame(m_decoderContext, frame) == 0) {
-                        width = frame->width;
-                        height = frame->height;
-                        // Allocate buffer for RGB data
-                        AVFrame* rgbFrame = av_frame_alloc();
-                        if (!rgbFrame) {
-                            std::cerr << "Could not allocate RGB frame\n";
-                            av_packet_unref(&packet);
-                            av_frame_free(&frame);
-                            return nullptr;
-                        }
-                        int numBytes = av_image_get_buffer_size(AV_PIX_FMT_RGB24, width, height, 1);
-                        unsigned char* rgbBuffer = (unsigned char*)av_malloc(numBytes * sizeof(unsigned char));
-                        if (!rgbBuffer) {
-                            std::cerr << "Could not allocate RGB buffer\n";
-                            av_packet_unref(&packet);
-                            av_frame_free(&frame);
-                            av_frame_free(&rgbFrame);
-                            return nullptr;
-                        }
-                        av_image_fill_arrays(rgbFrame->data, rgbFrame->linesize, rgbBuffer, AV_PIX_FMT_RGB24, width, height, 1);
-                        // Initialize the conversion context with color range
-                        struct SwsContext* swsCtx = sws_getContext(
-                            frame->width, frame->height, AV_PIX_FMT_YUV420P, // Source dimensions and format
-                            width, height, AV_PIX_FMT_RGB24, // Destination dimensions and format
-                            SWS_LANCZOS, nullptr, nullptr, nullptr
-                        );
-                        if (!swsCtx) {
-                            std::cerr << "Could not initialize sws context\n";
-                            av_packet_unref(&packet);
-                            av_frame_free(&frame);
-                            av_frame_free(&rgbFrame);
-                            av_free(rgbBuffer);
-                            return nullptr;
-                        }
-                        // Set color range
-                        av_opt_set_int(swsCtx, "src_range", 1, 0); // Full range for source
-                        av_opt_set_int(swsCtx, "dst_range", 1, 0); // Full range for destination
-                        // Convert the frame
-                        sws_scale(swsCtx, frame->data, frame->linesize, 0, frame->height, rgbFrame->data, rgbFrame->linesize);
-                        // Clean up
-                        sws_freeContext(swsCtx);
-                        av_packet_unref(&packet);
-                        av_frame_free(&frame);
-                        return rgbFrame->data[0];
-                    } else {
-                        std::cerr << "Error receiving frame, skipping corrupted frame.\n";
-                    }
-                } else {
-                    std::cerr << "Error sending packet, skipping corrupted frame.\n";
-                }
+void videoStream::setObserver(Observer* observer) {
+    FrameBus::Params params;
+    params.name = "preview";
+    params.format = AV_PIX_FMT_RGB24;
+    params.accepts = ColorConvert::CanPreview;
+    m_frameBus.Subscribe(observer, params);
+}
+
+SourceStage<VideoFrame>& videoStream::addCaptureStage(Pipeline& pipeline) {
+    return pipeline.Add<SourceStage<VideoFrame>>("capture",
+        [this](StageOutput<VideoFrame>& out) {
+            VideoFrame frame = getFrame();
+            if (frame) {
+                previewFrame(frame);
+                out.Push(std::move(frame));
             }
-            av_packet_unref(&packet);
-        }
+            return m_recording.load();
+        },
+        [this](StageOutput<VideoFrame>&) {
+            cleanupCamera();
+        });
+}
+
+TransformStage<VideoFrame, VideoFrame>& videoStream::addConvertStage(Pipeline& pipeline, AVPixelFormat format, int width, int height,
+                                                                     const std::string& name) {
+    auto converter = std::make_shared<FrameConverter>();
+    FrameConverter::Params params;
+    params.format = format;
+    params.width = width;
+    params.height = height;
+    params.threads = FrameConverter::ThreadsFromEnvironment();
+    // 0 lets the decoder allocate its own frames; the converter then keeps its default pool.
+    if (m_frameSourceParams.frame_pool_size)
+        params.pool_size = m_frameSourceParams.frame_pool_size;
+    params.huge_pages = m_frameSourceParams.huge_pages;
+    converter->SetParams(params);
+
+    return pipeline.Add<TransformStage<VideoFrame, VideoFrame>>(name,
+        [converter](VideoFrame& frame, StageOutput<VideoFrame>& out) {
+            if (converter->Matches(frame.get())) {
+                out.Push(std::move(frame));
+                return;
+            }
+            VideoFrame converted(converter->Convert(frame.get()), frame.captureTime());
+            frame.reset();
+            if (converted) {
+                out.Push(std::move(converted));
+            }
+        },
+        [converter](StageOutput<VideoFrame>&) {
+            if (converter->DroppedFrames()) {
+                std::cout << "Frames dropped because the converted frame pool was full: " << converter->DroppedFrames() << "\n";
+            }
+            converter->Reset();
+        },
+        frameStageParams());
+}
+
+void videoStream::addExtraSinks(EncoderCore& core) {
+    for (const std::string& target : m_extraSinks) {
+        if (core.AddSink(PacketSink::Create(target)))
+            std::cout << "Also writing the encoded video to " << target << "\n";
     }
-    av_frame_free(&frame);
-    return nullptr;
+}
+
+QueuedStage<VideoFrame, ThreadSafeQueue<VideoFrame>>::Params videoStream::frameStageParams() const {
+    QueuedStage<VideoFrame, ThreadSafeQueue<VideoFrame>>::Params params;
+    // Bounded so a slow encoder drops frames instead of growing memory and latency
+    params.capacity = m_frameQueueSize;
+    params.policy = m_frameQueuePolicy;
+    return params;
 }
 
 void videoStream::cleanupCamera() {
-    if (m_decoderContext) {
-        avcodec_free_context(&m_decoderContext);
-        m_decoderContext = nullptr;
-    }
-    if (m_formatContext) {
-        avformat_close_input(&m_formatContext);
-        m_formatContext = nullptr;
-    }
+    if (m_frameSource) {
+        uint64_t dropped = m_frameSource->DroppedFrames() + m_captureSession.DroppedFrames();
+        if (dropped)
+            std::cout << "Frames dropped because the frame pool was full: " << dropped << "\n";
+        uint64_t missed = m_frameSource->MissedFrames();
+        if (missed)
+            std::cout << "Frames missing from the capture timestamps: " << missed << "\n";
+        std::cout << "Average decode time: " << m_frameSource->AverageDecodeTime() << " ms per frame\n";
+        m_frameBus.Report(std::cout);
+        m_frameSource->Close();
+        m_frameSource.reset();
+    }
+    if (m_decodedFrame) {
+        av_frame_free(&m_decodedFrame);
+    }
+    m_captureSession.Reset();
     std::cout << "Camera resources released\n";
 }
 
@@ -281,6 +325,7 @@ void videoStream::cleanupCamera() {
 
 
 void videoStream::listenForKeyPress() {
+#ifdef _WIN32
     while (m_recording.load()) {
         if (_kbhit()) {
             char ch = _getch();
@@ -291,77 +336,119 @@ void videoStream::listenForKeyPress() {
             }
         }
     }
-}
-
-
-Box readBox(const uint8_t* data, size_t& offset, size_t dataSize) {
-    if (offset + 8 > dataSize) {
-        throw std::runtime_error("Incomplete box header");
-    }
-
-    Box box;
-    box.size = ntohl(*reinterpret_cast<const uint32_t*>(data + offset));
-    offset += 4;
-
-    char type[5] = {0};
-    std::memcpy(type, data + offset, 4);
-    box.type = std::string(type);
-    offset += 4;
-
-    if (offset + box.size - 8 > dataSize) {
-        throw std::runtime_error("Incomplete box data");
-    }
-
-    box.data.resize(box.size - 8);
-    std::memcpy(box.data.data(), data + offset, box.data.size());
-    offset += box.data.size();
-
-    return box;
-}
-std::vector<uint8_t> videoStream::filterAtoms(const std::vector<uint8_t>& packet) {
-    std::vector<uint8_t> filtered_packet;
-    size_t offset = 0;
-
-    while (offset < packet.size()) {
-        try {
-            Box box = readBox(packet.data(), offset, packet.size());
-            if (box.type != "ftyp" && box.type != "moov") {
-                uint32_t size = htonl(box.size);
-                filtered_packet.insert(filtered_packet.end(), reinterpret_cast<uint8_t*>(&size), reinterpret_cast<uint8_t*>(&size) + 4);
-                filtered_packet.insert(filtered_packet.end(), box.type.begin(), box.type.end());
-                filtered_packet.insert(filtered_packet.end(), box.data.begin(), box.data.end());
+#else
+    // Headless: poll stdin so a frame source that ends can still stop the capture.
+    bool stdinOpen = true;
+    while (m_recording.load()) {
+        if (!stdinOpen) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+        if (poll(&fd, 1, 100) > 0) {
+            char ch = 0;
+            if (read(STDIN_FILENO, &ch, 1) <= 0) {
+                stdinOpen = false;
+            } else if (ch == 'Q' || ch == 'q') {
+                m_recording.store(false);
+                break;
             }
-        } catch (const std::exception& e) {
-            std::cerr << "Error reading box: " << e.what() << std::endl;
-            break;
         }
     }
-
-    return filtered_packet;
+#endif
 }
 
+
 void videoStream::sendLiveVideoToClient() {
     std::cout << "Starting live video to HTML5 client\n";
-    int width = 1280, height = 720;
+    std::vector<Rendition> renditions = Rendition::FromEnvironment();
 
     VideoStreamEncoder::Params params;
-    params.width = width;
-    params.height = height;
     params.fps = 30.0;
-    params.bitrate = 400000;
     params.preset = "medium";
     params.crf = 23;
     params.src_format = AV_PIX_FMT_RGB24;
     params.dst_format = AV_PIX_FMT_YUV420P;
+    params.vfr = true;
+    // Capture stamps frames from 0 already, and the tiers must keep the same timeline to be switchable.
+    params.rebase_pts = false;
+    params.scale_threads = FrameConverter::ThreadsFromEnvironment();
+    EncoderCore::ThreadingFromEnvironment(params);
+    EncoderCore::CodecFromEnvironment(params);
+    if (params.codec == "libvpx") {
+        std::cerr << "VP8 cannot be carried in fMP4, use ENCODE_CODEC=vp9 for the live stream\n";
+        return;
+    }
+    if (params.codec == "libvpx-vp9" && params.options.empty()) {
+        // The bundled presets are for offline quality; live frames must be coded as fast as they come,
+        // without the presets' 16 frame alt-ref lookahead holding them back.
+        params.options = "deadline=realtime:cpu-used=8:lag-in-frames=0:auto-alt-ref=0";
+    }
+    const char* env_fragment_frames = std::getenv("FMP4_FRAGMENT_FRAMES");
+    if (env_fragment_frames)
+        params.frames_per_fragment = std::atoi(env_fragment_frames);
+    const char* env_fragment_ms = std::getenv("FMP4_FRAGMENT_MS");
+    if (env_fragment_ms)
+        params.fragment_duration_ms = std::atoi(env_fragment_ms);
+    const char* env_profile = std::getenv("LIVE_PROFILE");
+    params.low_latency = env_profile && std::string(env_profile) == "low-latency";
+    const char* env_intra_refresh = std::getenv("LIVE_INTRA_REFRESH");
+    if (env_intra_refresh)
+        params.intra_refresh = std::atoi(env_intra_refresh) != 0;
+    // Clients joining or resyncing ask for a keyframe, so the GOP can be long: 4 seconds unless LIVE_GOP_SIZE says otherwise.
+    const char* env_gop_size = std::getenv("LIVE_GOP_SIZE");
+    params.gop_size = env_gop_size ? std::atoi(env_gop_size) : static_cast<int>(4 * params.fps);
+    if (params.gop_size <= 0)
+        params.gop_size = 12;
+    if (renditions.size() > 1) {
+        // Keyframes at the same instants on every tier are where clients switch; each tier is capped to its bitrate.
+        const char* env_keyframe_interval = std::getenv("LIVE_KEYFRAME_INTERVAL");
+        params.keyframe_interval = env_keyframe_interval ? std::atof(env_keyframe_interval) : 1.0;
+        if (params.keyframe_interval <= 0.0)
+            params.keyframe_interval = 1.0;
+    }
+
+    // A single tier follows the link between LIVE_MIN_BITRATE and LIVE_MAX_BITRATE; a ladder adapts per client instead.
+    std::unique_ptr<RateController> rate;
+    if (renditions.size() == 1) {
+        RateController::Params rate_params;
+        const char* env_min_bitrate = std::getenv("LIVE_MIN_BITRATE");
+        if (env_min_bitrate)
+            rate_params.min_bitrate = static_cast<uint32_t>(std::atoi(env_min_bitrate)) * 1000;
+        // Unset, the limit leaves room for the tier's own bitrate.
+        const char* env_max_bitrate = std::getenv("LIVE_MAX_BITRATE");
+        if (env_max_bitrate)
+            rate_params.max_bitrate = static_cast<uint32_t>(std::atoi(env_max_bitrate)) * 1000;
+        else
+            rate_params.max_bitrate = std::max(rate_params.max_bitrate, renditions[0].bitrate);
+        if (rate_params.max_bitrate > 0) {
+            if (renditions[0].bitrate > rate_params.max_bitrate || renditions[0].bitrate < rate_params.min_bitrate)
+                std::cerr << "Warning: " << renditions[0].Name() << " at " << renditions[0].bitrate / 1000
+                          << " kbit/s is outside LIVE_MIN_BITRATE/LIVE_MAX_BITRATE, starting at the nearest limit\n";
+            rate.reset(new RateController(renditions[0].bitrate, rate_params));
+            std::cout << "Live bitrate adapts between " << rate_params.min_bitrate / 1000 << " and "
+                      << rate_params.max_bitrate / 1000 << " kbit/s\n";
+        }
+    }
 
-    //Create encoder instance
-    VideoStreamEncoder encoder;
-
-    // Open encoder
-    if (!encoder.Open(params)) {
-        std::cerr << "Failed to open encoder\n";
-        return; // Exit if encoder fails to open
+    // One encoder per tier, lowest bitrate first
+    std::vector<std::unique_ptr<VideoStreamEncoder>> encoders;
+    for (const Rendition& rendition : renditions) {
+        params.width = rendition.width;
+        params.height = rendition.height;
+        params.bitrate = rate ? rate->Bitrate() : rendition.bitrate;
+        // The cap is what steers a crf encode, and x264 only changes it while running if it was set at open.
+        params.max_bitrate = renditions.size() > 1 || rate ? params.bitrate : 0;
+        encoders.emplace_back(new VideoStreamEncoder());
+        if (!encoders.back()->Open(params)) {
+            std::cerr << "Failed to open encoder for " << rendition.Name() << "\n";
+            return; // Exit if encoder fails to open
+        }
+        std::cout << "Rendition " << rendition.Name() << ": " << rendition.width << "x" << rendition.height
+                  << " at " << rendition.bitrate / 1000 << " kbit/s\n";
     }
+    // Recordings and extra outputs take the best tier
+    addExtraSinks(encoders.back()->Core());
     //getchar();
 
     if (!initializeCamera()) {
@@ -375,87 +462,93 @@ void videoStream::sendLiveVideoToClient() {
 
     // Create WebSocket server instance
     VideoStreamSocket server;
+    server.set_renditions(renditions);
+    // The best tier has the highest level, which covers the others.
+    server.set_codec(encoders.back()->Codec());
+    // One instant for all tiers, just after the newest captured frame, which no encoder has passed yet: the keyframe
+    // lands on the same frame everywhere and clients can switch there. The millisecond absorbs timestamp rounding.
+    server.set_keyframe_handler([this, &encoders]() {
+        int64_t captured = m_lastCaptureTime.load();
+        if (captured == AV_NOPTS_VALUE)
+            return; // The first frame is a keyframe anyway
+        for (auto& encoder : encoders)
+            encoder->RequestKeyframe(captured + 1000);
+    });
     std::thread serverThread([&server]() {
         server.run(9002);
     });
 
+    // capture -> convert (per tier) -> encode (per tier) -> send
+    Pipeline pipeline;
+    auto& capture = addCaptureStage(pipeline);
+
+    // Clients are routed by the socket, whose sessions replay each tier's init segment and GOP, so nothing waits for a client here
+    PipelineStage* send_stage = nullptr;
+    auto& send = pipeline.Add<SinkStage<RenditionFragment>>("send",
+        [&](RenditionFragment& piece) {
+            try {
+                if (piece.fragment.isInit())
+                    std::cout << "Initialization data of " << renditions[piece.tier].Name() << " ready" << std::endl;
+                server.send_fragment(piece.tier, piece.fragment);
+                if (rate) {
+                    // Slowest client's send buffer and the fragments queued behind this one
+                    uint32_t bitrate = rate->Bitrate();
+                    if (rate->Update(RateController::Clock::now(), server.max_buffered(0), send_stage->GetStats().queue_depth) != bitrate) {
+                        encoders[0]->SetBitrate(rate->Bitrate());
+                        std::cout << "Live bitrate " << bitrate / 1000 << " -> " << rate->Bitrate() / 1000 << " kbit/s" << std::endl;
+                    }
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Exception in send stage: " << e.what() << std::endl;
+            } catch (...) {
+                std::cerr << "Unknown exception in send stage" << std::endl;
+            }
+        });
 
-    // Frame queue
-    ThreadSafeQueue<unsigned char*> frameQueue;
+    for (size_t tier = 0; tier < renditions.size(); tier++) {
+        VideoStreamEncoder& encoder = *encoders[tier];
+        const std::string name = renditions[tier].Name();
+        auto& convert = addConvertStage(pipeline, params.dst_format, renditions[tier].width, renditions[tier].height,
+                                        "convert-" + name);
 
-    // Combined thread for reading frames and rendering
-    std::thread frameReaderAndRenderer([&](){
-        //std::cout << "Inside frameReaderAndRenderer thread\n";
-        while (m_recording.load()) {
-            unsigned char* data = getFrameData(width, height);
-            if (data) {
-                //m_pGUIptr->RenderFrame(m_pGUIptr->getPreviewWindow(), data, width, height);
-                notifyObserver(data, width, height);
-                frameQueue.push(data);
-            }
-        }
-        std::cout << "Ends frameReaderAndRenderer thread\n";
-        cleanupCamera();
-        
-    });
-    
-    // Thread to encode frames
-    std::thread frameEncoder([&]() {
-        while (m_recording.load() || !frameQueue.empty()) {
-            unsigned char* data;
-            if (frameQueue.pop(data)) {
-                if (!encoder.Write(data)) {
+        auto& encode = pipeline.Add<TransformStage<VideoFrame, RenditionFragment>>("encode-" + name,
+            [&encoder, tier](VideoFrame& frame, StageOutput<RenditionFragment>& out) {
+                if (!encoder.Write(frame.get())) {
                     std::cerr << "Failed to write frame to encoder\n";
                 }
-                av_free(data);
-            } else {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                
-            }
-        }
-        std::cout << "Ends frameEncoder thread\n";
-
-        encoder.Close();
-    });
-    // Thread to send encoded data to WebSocket server
-    std::thread dataSender([&](){
-        try {
-            std::unique_lock<std::mutex> lock(server.m_mutex);
-            server.m_cv.wait(lock, [&server] { return server.m_client_connected; });
-            lock.unlock(); // Release the lock before entering the loop
-
-            while (m_recording.load() || !encoder.isencodedFramesQueueEmpty()) {
-                std::vector<uint8_t> encodedpacket;
-                std::vector<uint8_t> filtered_packet;
-                if (encoder.getEncodedFrame(encodedpacket)) {
-                    if (!m_initialization_sent) {
-                        std::cout << "Sending initialization data" << std::endl;
-                        m_initialization_sent = true;
-                        server.send_video_data(encodedpacket);
-                    } else {
-                        filtered_packet = filterAtoms(encodedpacket);
-                        server.send_video_data(filtered_packet);
-                    }
-                    std::cout << "encoded packet size:" << encodedpacket.size() << " filtered packet size:" << filtered_packet.size() << std::endl;
+                frame.reset();
+                RenditionFragment piece;
+                piece.tier = tier;
+                while (encoder.tryGetEncodedFrame(piece.fragment)) {
+                    out.Push(piece);
                 }
-            }
-        } catch (const std::exception& e) {
-            std::cerr << "Exception in dataSender thread: " << e.what() << std::endl;
-        } catch (...) {
-            std::cerr << "Unknown exception in dataSender thread" << std::endl;
-        }
-    });
-    
-    
+            },
+            [&encoder, tier](StageOutput<RenditionFragment>& out) {
+                encoder.Close();
+                RenditionFragment piece;
+                piece.tier = tier;
+                while (encoder.tryGetEncodedFrame(piece.fragment)) {
+                    out.Push(piece);
+                }
+            },
+            frameStageParams());
 
+        pipeline.Connect(capture, convert);
+        pipeline.Connect(convert, encode);
+        pipeline.Connect(encode, send);
+    }
+    send_stage = &send;
+    pipeline.Start();
 
     keyListener.join();
-    frameReaderAndRenderer.join();
-    frameEncoder.join();
-    dataSender.join();
+    pipeline.Wait();
+    pipeline.Report(std::cout);
+    if (rate)
+        std::cout << "Live bitrate ended at " << rate->Bitrate() / 1000 << " kbit/s after " << rate->Changes() << " change(s)" << std::endl;
+    // run only returns once the server is stopped
+    server.stop();
     serverThread.join();
 
-    
     std::cerr << "Video capture finished" << std::endl;
 }
 
@@ -473,6 +566,10 @@ int videoStream::videoCaptureAndEncoding() {
     params.crf = 23;
     params.src_format = AV_PIX_FMT_RGB24;
     params.dst_format = AV_PIX_FMT_YUV420P;
+    params.vfr = true;
+    params.scale_threads = FrameConverter::ThreadsFromEnvironment();
+    EncoderCore::ThreadingFromEnvironment(params);
+    EncoderCore::CodecFromEnvironment(params);
 
     // Create encoder instance
     FFmpegEncoder encoder;
@@ -484,6 +581,7 @@ int videoStream::videoCaptureAndEncoding() {
         std::cerr << "Failed to open encoder\n";
         return -1;
     }
+    addExtraSinks(encoder.Core());
 
     if (!initializeCamera()) {
         std::cerr << "Failed to initialize camera\n";
@@ -493,49 +591,29 @@ int videoStream::videoCaptureAndEncoding() {
     }
 
     std::thread keyListener(&videoStream::listenForKeyPress, this);
-    ThreadSafeQueue<unsigned char*> frameQueue;
-
-    // Combined thread for reading frames and rendering
-    std::thread frameReaderAndRenderer([&](){
-        while (m_recording.load()) {
-            unsigned char* data = getFrameData(width, height);
-            if (data) {
-                //std::cout << "Frame captured: " << width << "x" << height << std::endl;
-                // Render the frame
-                
-                //m_pGUIptr->RenderFrame(m_pGUIptr->getPreviewWindow(), data, width, height);
-                notifyObserver(data, width, height);
-
-                // Push the data to the encoding queue
-                frameQueue.push(data);
-            } else {
-                //std::cerr << "Failed to capture frame\n";
-            }
-        }
-        std::cout << "exiting frameReaderAndRenderer thread\n";
-    });
 
-    // Thread to encode frames
-    std::thread frameEncoder([&]() {
-        while (m_recording.load() || !frameQueue.empty()) {
-            unsigned char* data;
-            if (frameQueue.pop(data)) {
-                if (!encoder.Write(data)) {
-                    std::cerr << "Failed to write frame to encoder\n";
-                }
-                av_free(data);
-            } else {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    // capture -> convert -> encode (the encoder also muxes to FILE_PATH)
+    Pipeline pipeline;
+    auto& capture = addCaptureStage(pipeline);
+    auto& convert = addConvertStage(pipeline, params.dst_format, width, height);
+    auto& encode = pipeline.Add<SinkStage<VideoFrame>>("encode",
+        [&](VideoFrame& frame) {
+            if (!encoder.Write(frame.get())) {
+                std::cerr << "Failed to write frame to encoder\n";
             }
-        }
-        std::cout << "exiting frameEncoder thread\n";
-    });
+        },
+        [&]() {
+            encoder.Close();
+        },
+        frameStageParams());
+
+    pipeline.Connect(capture, convert);
+    pipeline.Connect(convert, encode);
+    pipeline.Start();
 
     keyListener.join();
-    frameReaderAndRenderer.join();
-    frameEncoder.join();
-    encoder.Close();
-    cleanupCamera();
+    pipeline.Wait();
+    pipeline.Report(std::cout);
 
     std::cout << "videocapture finished" << std::endl;
     return 0;
@@ -605,23 +683,10 @@ void videoStream::playVideo(const char* filename) {
         if (packet.stream_index == videoStreamIndex) {
             if (avcodec_send_packet(codecContext, &packet) == 0) {
                 while (avcodec_receive_frame(codecContext, frame) == 0) {
-                    int width = frame->width;
-                    int height = frame->height;
-                    AVFrame* rgbFrame = av_frame_alloc();
-                    int numBytes = av_image_get_buffer_size(AV_PIX_FMT_RGB24, width, height, 1);
-                    unsigned char* rgbBuffer = (unsigned char*)av_malloc(numBytes * sizeof(unsigned char));
-                    av_image_fill_arrays(rgbFrame->data, rgbFrame->linesize, rgbBuffer, AV_PIX_FMT_RGB24, width, height, 1);
-                    struct SwsContext* swsCtx = sws_getContext(
-                        frame->width, frame->height, codecContext->pix_fmt,
-                        width, height, AV_PIX_FMT_RGB24,
-                        SWS_BILINEAR, nullptr, nullptr, nullptr
-                    );
-                    sws_scale(swsCtx, frame->data, frame->linesize, 0, frame->height, rgbFrame->data, rgbFrame->linesize);
-                    //m_pGUIptr->RenderFrame(m_pGUIptr->getPreviewWindow(), rgbFrame->data[0], width, height);
-                    notifyObserver(rgbFrame->data[0], width, height);
-                    av_free(rgbBuffer);
-                    av_frame_free(&rgbFrame);
-                    sws_freeContext(swsCtx);
+                    // The bus converts for each observer on its own thread; the reference keeps the
+                    // decoded buffer alive after the decoder moves on.
+                    if (m_frameBus.HasSubscribers())
+                        notifyObserver(VideoFrame::Reference(frame, VideoFrame::Clock::now()));
 
                     // Calculate the delay based on the frame's presentation timestamp (PTS)
                     int64_t pts = av_rescale_q(frame->pts, timeBase, AV_TIME_BASE_Q);
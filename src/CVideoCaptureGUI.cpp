@@ -6,6 +6,7 @@
 #include <fstream>
 #include <CVideoCaptureGUI.hpp>
 #include <CWebSocketServer.hpp>
+#include <CColorConvert.hpp>
 extern "C" {
 
 #include <libavcodec/avcodec.h>
@@ -35,6 +36,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 
     std::cout << "Console window created:" <<nCmdShow << std::endl; 
     uiPtr->Show(nCmdShow);
+    // The window is gone: stop frame delivery before the GUI object is destroyed.
+    vsPtr->removeObserver(uiPtr.get());
 
     return 0;
 }
@@ -127,9 +130,74 @@ VideoCaptureGUI::~VideoCaptureGUI() {
 
 }
 
-void VideoCaptureGUI::update(unsigned char* data , uint32_t width, uint32_t height)
+void VideoCaptureGUI::update(const VideoFrame& frame)
 {
-    RenderFrame(getPreviewWindow(), data, width, height);
+    HWND hWnd = getPreviewWindow();
+    if (frame.format() != AV_PIX_FMT_RGB24) {
+        // Convert straight to the displayed size, the window then draws it without stretching.
+        int x, y, width, height;
+        fitPreview(hWnd, frame.width(), frame.height(), x, y, width, height);
+        if (width <= 0 || height <= 0)
+            return;
+        int dibStride = (width * 3 + 3) & ~3;
+        m_previewRows.resize(static_cast<size_t>(dibStride) * height);
+        if (ColorConvert::ToBGRPreview(frame.get(), m_previewRows.data(), dibStride, width, height))
+            drawPreview(hWnd, m_previewRows.data(), x, y, width, height);
+        return;
+    }
+
+    // DIB rows are DWORD aligned, pooled frames are padded further: repack the rows when they differ.
+    int dibStride = (frame.width() * 3 + 3) & ~3;
+    if (frame.stride() == dibStride)
+    {
+        RenderFrame(hWnd, frame.data(), frame.width(), frame.height());
+        return;
+    }
+
+    m_previewRows.resize(static_cast<size_t>(dibStride) * frame.height());
+    for (int y = 0; y < frame.height(); y++)
+        memcpy(&m_previewRows[static_cast<size_t>(y) * dibStride], frame.data() + static_cast<size_t>(y) * frame.stride(), frame.width() * 3);
+    RenderFrame(hWnd, m_previewRows.data(), frame.width(), frame.height());
+}
+
+void VideoCaptureGUI::fitPreview(HWND hWnd, int width, int height, int& x, int& y, int& destWidth, int& destHeight)
+{
+    RECT rect;
+    GetClientRect(hWnd, &rect);
+    destWidth = rect.right - rect.left;
+    destHeight = rect.bottom - rect.top;
+
+    // Maintain aspect ratio
+    float aspectRatio = static_cast<float>(width) / height;
+    if (destWidth > destHeight * aspectRatio) {
+        destWidth = static_cast<int>(destHeight * aspectRatio);
+    } else {
+        destHeight = static_cast<int>(destWidth / aspectRatio);
+    }
+
+    // Center the video frame within the subwindow
+    x = (rect.right - rect.left - destWidth) / 2;
+    y = (rect.bottom - rect.top - destHeight) / 2;
+}
+
+void VideoCaptureGUI::drawPreview(HWND hWnd, const unsigned char* bgr, int x, int y, int width, int height)
+{
+    HDC hdc = GetDC(hWnd);
+    if (!hdc) {
+        std::cerr << "Could not get device context\n";
+        return;
+    }
+
+    BITMAPINFO bmi = {};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = width;
+    bmi.bmiHeader.biHeight = -height; // Negative to indicate top-down bitmap
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 24;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    SetDIBitsToDevice(hdc, x, y, width, height, 0, 0, 0, height, bgr, &bmi, DIB_RGB_COLORS);
+    ReleaseDC(hWnd, hdc);
 }
 
 void VideoCaptureGUI::Show(int nCmdShow) {
@@ -255,7 +323,7 @@ LRESULT CALLBACK VideoCaptureGUI::WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam
 
 
 
-void VideoCaptureGUI::RenderFrame(HWND hWnd, unsigned char* data, int width, int height) {
+void VideoCaptureGUI::RenderFrame(HWND hWnd, const unsigned char* data, int width, int height) {
     HDC hdc = GetDC(hWnd);
     if (!hdc) {
         std::cerr << "Could not get device context\n";
@@ -270,23 +338,9 @@ void VideoCaptureGUI::RenderFrame(HWND hWnd, unsigned char* data, int width, int
     bmi.bmiHeader.biBitCount = 24;
     bmi.bmiHeader.biCompression = BI_RGB;
 
-    // Get the dimensions of the subwindow
-    RECT rect;
-    GetClientRect(hWnd, &rect);
-    int destWidth = rect.right - rect.left;
-    int destHeight = rect.bottom - rect.top;
-
-    // Maintain aspect ratio
-    float aspectRatio = static_cast<float>(width) / height;
-    if (destWidth > destHeight * aspectRatio) {
-        destWidth = static_cast<int>(destHeight * aspectRatio);
-    } else {
-        destHeight = static_cast<int>(destWidth / aspectRatio);
-    }
-
-    // Center the video frame within the subwindow
-    int offsetX = (rect.right - rect.left - destWidth) / 2;
-    int offsetY = (rect.bottom - rect.top - destHeight) / 2;
+    // Fit the frame in the subwindow, keeping its aspect ratio
+    int offsetX, offsetY, destWidth, destHeight;
+    fitPreview(hWnd, width, height, offsetX, offsetY, destWidth, destHeight);
 
     // Use a higher-quality scaling method
     SetStretchBltMode(hdc, HALFTONE);
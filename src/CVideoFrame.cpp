@@ -0,0 +1,67 @@
+#include <iostream>
+#include <utility>
+#include <CVideoFrame.hpp>
+
+
+VideoFrame::VideoFrame(AVFrame* frame, Clock::time_point captureTime)
+    : mFrame(frame), mCaptureTime(captureTime)
+{
+}
+
+VideoFrame VideoFrame::Reference(const AVFrame* frame, Clock::time_point captureTime)
+{
+    AVFrame* ref = av_frame_clone(frame);
+    if (!ref)
+        std::cerr << "Could not reference frame\n";
+    return VideoFrame(ref, captureTime);
+}
+
+VideoFrame::VideoFrame(const VideoFrame& other)
+    : mCaptureTime(other.mCaptureTime)
+{
+    if (other.mFrame)
+    {
+        mFrame = av_frame_clone(other.mFrame);
+        if (!mFrame)
+            std::cerr << "Could not reference frame\n";
+    }
+}
+
+VideoFrame::VideoFrame(VideoFrame&& other) noexcept
+    : mFrame(other.mFrame), mCaptureTime(other.mCaptureTime)
+{
+    other.mFrame = nullptr;
+}
+
+VideoFrame& VideoFrame::operator=(const VideoFrame& other)
+{
+    if (this != &other)
+    {
+        VideoFrame copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+VideoFrame& VideoFrame::operator=(VideoFrame&& other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        mFrame = other.mFrame;
+        mCaptureTime = other.mCaptureTime;
+        other.mFrame = nullptr;
+    }
+    return *this;
+}
+
+VideoFrame::~VideoFrame()
+{
+    reset();
+}
+
+void VideoFrame::reset()
+{
+    if (mFrame)
+        av_frame_free(&mFrame);
+}
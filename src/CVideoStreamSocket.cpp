@@ -1,12 +1,42 @@
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
-#include <set>
+#include <iterator>
+#include <sstream>
 #include <chrono>
 #include <thread>
+#include <utility>
 #include <functional> // For std::bind
 #include<CVideoStreamSocket.hpp>
 
 typedef websocketpp::server<websocketpp::config::asio> server;
 
+namespace {
+
+// A session's way out: one websocket connection of the server.
+class Connection : public StreamSession::Transport {
+public:
+    Connection(server& server, websocketpp::connection_hdl hdl) : m_server(server), m_hdl(hdl) {}
+
+    bool Send(const EncodedFragment& fragment, size_t& buffered) override {
+        websocketpp::lib::error_code ec;
+        server::connection_ptr connection = m_server.get_con_from_hdl(m_hdl, ec);
+        if (ec)
+            return false;
+        ec = connection->send(fragment.data(), fragment.size(), websocketpp::frame::opcode::binary);
+        if (ec)
+            return false;
+        buffered = connection->get_buffered_amount();
+        return true;
+    }
+
+private:
+    server& m_server;
+    websocketpp::connection_hdl m_hdl;
+};
+
+}
+
 VideoStreamSocket::VideoStreamSocket() {
     m_server.init_asio();
     m_server.set_open_handler([this](websocketpp::connection_hdl hdl) { on_open(hdl); });
@@ -29,12 +59,42 @@ void VideoStreamSocket::run(uint16_t port) {
     m_server.run();
 }
 
+void VideoStreamSocket::stop() {
+    websocketpp::lib::error_code ec;
+    m_server.stop_listening(ec);
+    if (ec)
+        std::cout << "Stop listening: " << ec.message() << std::endl;
+
+    // Closed outside the lock, on_close takes it.
+    std::vector<websocketpp::connection_hdl> connections;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& connection : m_connections)
+            connections.push_back(connection.first);
+    }
+    for (websocketpp::connection_hdl& hdl : connections) {
+        m_server.close(hdl, websocketpp::close::status::going_away, "server stopping", ec);
+        if (ec)
+            std::cout << "Close: " << ec.message() << std::endl;
+    }
+    m_server.stop();
+}
+
 void VideoStreamSocket::on_open(websocketpp::connection_hdl hdl) {
+    // Before any fragment: the client needs the codec to create its source buffer.
+    m_server.send(hdl, "codec " + m_codec, websocketpp::frame::opcode::text);
     {
         std::lock_guard<std::mutex> lock(m_mutex);
-        m_connections.insert(hdl);
-        m_client_connected = true;
+        auto it = m_connections.emplace(hdl, StreamSession(m_bitrates)).first;
+        // A late joiner starts right away from the cached init segment and GOP.
+        Connection connection(m_server, hdl);
+        if (!it->second.Start(m_tiers, connection))
+            m_connections.erase(it);
+        m_client_connected = !m_connections.empty();
     }
+    // The cache can be a long GOP behind, or empty; a new keyframe brings the client to the live edge.
+    if (m_keyframe_handler)
+        m_keyframe_handler();
     m_cv.notify_all();
 }
 
@@ -50,7 +110,40 @@ void VideoStreamSocket::on_message(websocketpp::connection_hdl hdl, server::mess
     std::string payload = msg->get_payload();
     std::cout << "Received message: " << payload << std::endl;
 
-    if (payload == "get_epoch") {
+    if (payload == "renditions") {
+        std::ostringstream reply;
+        reply << "renditions";
+        for (const TierCache& tier : m_tiers)
+            reply << " " << tier.rendition.width << "x" << tier.rendition.height << "@" << tier.rendition.bitrate / 1000;
+        m_server.send(hdl, reply.str(), websocketpp::frame::opcode::text);
+    } else if (payload.compare(0, 5, "tier ") == 0) {
+        std::string value = payload.substr(5);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_connections.find(hdl);
+        if (it == m_connections.end() || m_tiers.empty())
+            return;
+        StreamSession& session = it->second;
+        if (value == "auto") {
+            session.SetAutomatic(AbrController::Clock::now());
+        } else {
+            session.SetTier(static_cast<size_t>(std::strtoul(value.c_str(), nullptr, 10)), m_tiers.size());
+            // Not started yet: the pinned tier may have a GOP to start from already.
+            Connection connection(m_server, hdl);
+            if (!session.Start(m_tiers, connection))
+                m_connections.erase(it);
+        }
+        std::cout << "Client asked for tier " << value << std::endl;
+    } else if (payload == "resync") {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_connections.find(hdl);
+            if (it == m_connections.end())
+                return;
+            it->second.Resync();
+        }
+        if (m_keyframe_handler)
+            m_keyframe_handler();
+    } else if (payload == "get_epoch") {
         auto now = std::chrono::system_clock::now();
         auto epoch = std::chrono::system_clock::to_time_t(now);
         std::string epoch_str = std::to_string(epoch);
@@ -61,10 +154,48 @@ void VideoStreamSocket::on_message(websocketpp::connection_hdl hdl, server::mess
     }
 }
 
-void VideoStreamSocket::send_video_data(const std::vector<uint8_t>& data) {
+void VideoStreamSocket::set_renditions(const std::vector<Rendition>& renditions) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tiers.clear();
+    m_bitrates.clear();
+    for (const Rendition& rendition : renditions) {
+        TierCache tier;
+        tier.rendition = rendition;
+        m_tiers.push_back(tier);
+        m_bitrates.push_back(rendition.bitrate);
+    }
+}
+
+void VideoStreamSocket::set_codec(const std::string& codec) {
+    m_codec = codec;
+}
+
+void VideoStreamSocket::set_keyframe_handler(std::function<void()> handler) {
+    m_keyframe_handler = std::move(handler);
+}
+
+void VideoStreamSocket::send_fragment(size_t tier_index, const EncodedFragment& fragment) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (tier_index >= m_tiers.size() || !fragment)
+        return;
+
+    m_tiers[tier_index].Add(fragment);
+    if (fragment.isInit())
+        return;
+
+    for (auto it = m_connections.begin(); it != m_connections.end();) {
+        Connection connection(m_server, it->first);
+        bool connected = it->second.Deliver(m_tiers, tier_index, fragment, connection);
+        it = connected ? std::next(it) : m_connections.erase(it);
+    }
+}
+
+size_t VideoStreamSocket::max_buffered(size_t tier) {
     std::lock_guard<std::mutex> lock(m_mutex);
-    for (auto& hdl : m_connections) {
-        m_server.send(hdl, data.data(), data.size(), websocketpp::frame::opcode::binary);
-        std::cout << "Sent data of size: " << data.size() << std::endl;
+    size_t buffered = 0;
+    for (const auto& connection : m_connections) {
+        if (connection.second.Started() && connection.second.Tier() == tier)
+            buffered = std::max(buffered, connection.second.Buffered());
     }
+    return buffered;
 }